@@ -0,0 +1,64 @@
+#pragma once
+
+#include "debug_draw.hpp"
+#include <cstdint>
+
+// Debug-draw backend that draws nothing and only counts what it's given
+// For running experiments without a window or a GL context, e.g. on machines without a GPU.
+// Debug-draw still batches everything up on the CPU, so the cost of submitting
+// and flushing is all there, minus the driver
+class DDRenderInterfaceCounting final : public dd::RenderInterface
+{
+public:
+	struct Counts
+	{
+		uint64_t points{};
+		uint64_t lines{};
+		uint64_t glyphs{};
+		// One per list debug-draw hands over
+		uint64_t drawCalls{};
+	};
+
+	void drawPointList( const dd::DrawVertex* points, int count, bool depthEnabled ) override
+	{
+		counts.points += uint64_t( count );
+		counts.drawCalls++;
+	}
+
+	// Two vertices per line
+	void drawLineList( const dd::DrawVertex* lines, int count, bool depthEnabled ) override
+	{
+		counts.lines += uint64_t( count / 2 );
+		counts.drawCalls++;
+	}
+
+	// Six vertices per glyph, two triangles
+	void drawGlyphList( const dd::DrawVertex* glyphs, int count, dd::GlyphTextureHandle glyphTex ) override
+	{
+		counts.glyphs += uint64_t( count / 6 );
+		counts.drawCalls++;
+	}
+
+	// Debug-draw only checks it's not null
+	dd::GlyphTextureHandle createGlyphTexture( int width, int height, const void* pixels ) override
+	{
+		return reinterpret_cast<dd::GlyphTextureHandle>( &counts );
+	}
+
+	void destroyGlyphTexture( dd::GlyphTextureHandle glyphTex ) override
+	{
+	}
+
+	const Counts& GetCounts() const
+	{
+		return counts;
+	}
+
+	void ResetCounts()
+	{
+		counts = {};
+	}
+
+private:
+	Counts counts;
+};
@@ -109,8 +109,8 @@ void DDRenderInterfaceCoreGL::drawGlyphList( const dd::DrawVertex* glyphs, int c
     // These doesn't have to be reset every draw call, I'm just being lazy ;)
     glUniform1i( textProgram_GlyphTextureLocation, 0 );
     glUniform2f( textProgram_ScreenDimensions,
-        static_cast<GLfloat>(1600),
-        static_cast<GLfloat>(900) );
+        static_cast<GLfloat>(screenWidth),
+        static_cast<GLfloat>(screenHeight) );
 
     if ( glyphTex != nullptr )
     {
@@ -174,6 +174,8 @@ void DDRenderInterfaceCoreGL::destroyGlyphTexture( dd::GlyphTextureHandle glyphT
 
 DDRenderInterfaceCoreGL::DDRenderInterfaceCoreGL()
     : mvpMatrix( nullptr )
+    , screenWidth( 0 )
+    , screenHeight( 0 )
     , linePointProgram( 0 )
     , linePointProgram_MvpMatrixLocation( -1 )
     , textProgram( 0 )
@@ -50,6 +50,10 @@ public:
     // In this demo, it consists of the camera's view and projection matrices only.
     const float* mvpMatrix;
 
+    // Window size in pixels, screen text is laid out in it
+    int screenWidth;
+    int screenHeight;
+
 private:
 
     GLuint linePointProgram;
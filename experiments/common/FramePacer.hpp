@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+// Keeps frames to a target rate, or lets them run flat-out
+//
+// Frames are scheduled on a fixed grid of deadlines rather than "sleep for whatever's left",
+// so a late frame doesn't push all the following ones back. Waiting is done by sleeping
+// most of the way, then spinning the rest, since sleeps tend to wake up late by anything
+// from tens of microseconds to a couple of milliseconds depending on the OS. How late they
+// wake up is measured as it goes, so it only spins for as long as it has to.
+class FramePacer
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// 0 means uncapped
+	explicit FramePacer( float targetRate = 60.0f )
+	{
+		SetTargetRate( targetRate );
+	}
+
+	void SetTargetRate( float rate )
+	{
+		targetRate = std::max( rate, 0.0f );
+		period = targetRate > 0.0f
+			? std::chrono::duration_cast<Clock::duration>( std::chrono::duration<double>( 1.0 / targetRate ) )
+			: Clock::duration::zero();
+		nextFrame = Clock::now() + period;
+	}
+
+	float GetTargetRate() const
+	{
+		return targetRate;
+	}
+
+	bool IsUncapped() const
+	{
+		return targetRate <= 0.0f;
+	}
+
+	// Waits until the next frame is due, and returns how long it's been since the last
+	// call returned, in seconds. Uncapped, it returns straight away
+	float WaitForNextFrame()
+	{
+		if ( !IsUncapped() )
+		{
+			Wait();
+		}
+
+		const Clock::time_point now = Clock::now();
+		const float deltaTime = std::chrono::duration<float>( now - lastFrame ).count();
+		lastFrame = now;
+		return deltaTime;
+	}
+
+private:
+	void Wait()
+	{
+		using namespace std::chrono;
+
+		// More than a whole frame behind, e.g. after a breakpoint or a long load,
+		// would otherwise turn into a burst of frames with no waiting at all
+		Clock::time_point now = Clock::now();
+		if ( now - nextFrame > period )
+		{
+			nextFrame = now;
+		}
+
+		while ( nextFrame - now > sleepOvershoot + SleepQuantum )
+		{
+			const Clock::time_point sleepStart = now;
+			std::this_thread::sleep_for( SleepQuantum );
+			now = Clock::now();
+
+			// Creeps down a little every time, and jumps right up if a sleep was later than
+			// expected, so the odd late wake-up gets spun through next time around
+			const Clock::duration overshoot = std::max( Clock::duration::zero(), now - sleepStart - SleepQuantum );
+			sleepOvershoot = std::max( overshoot, sleepOvershoot - sleepOvershoot / 64 );
+		}
+
+		while ( Clock::now() < nextFrame )
+		{
+			std::this_thread::yield();
+		}
+
+		nextFrame += period;
+	}
+
+	// Short sleeps measure the overshoot more often, and oversleep by less
+	static constexpr Clock::duration SleepQuantum = std::chrono::milliseconds( 1 );
+
+	float targetRate{};
+	Clock::duration period{};
+	Clock::time_point nextFrame{ Clock::now() };
+	Clock::time_point lastFrame{ Clock::now() };
+	// Starts out pessimistic, and settles on what this machine actually does
+	Clock::duration sleepOvershoot{ std::chrono::milliseconds( 2 ) };
+};
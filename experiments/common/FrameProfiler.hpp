@@ -0,0 +1,151 @@
+#pragma once
+
+#include <Precompiled.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+
+// Times every phase of a frame separately, to see which one is eating the frame
+//
+// The last NumFrames frames are kept in a ring buffer, percentiles are worked out from
+// those on demand, and the whole ring can be written out as CSV. Phases are timed back
+// to back: each EndPhase covers everything since the previous one, or since BeginFrame
+class FrameProfiler
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	enum Phase
+	{
+		Events,
+		UserCommands,
+		Update,
+		Flush,
+		Swap,
+		Pacing,
+		NumPhases,
+		// Not a phase, for GetPercentiles, the whole frame
+		Total = NumPhases
+	};
+
+	// A bit over a minute at 60 Hz
+	static constexpr size_t NumFrames = 4096;
+
+	struct Frame
+	{
+		float phases[NumPhases]{};
+		float total{};
+	};
+
+	// In milliseconds
+	struct Percentiles
+	{
+		float p50{};
+		float p95{};
+		float p99{};
+	};
+
+	FrameProfiler()
+		: frames( NumFrames )
+	{
+	}
+
+	static const char* GetPhaseName( size_t phase )
+	{
+		static const char* const names[] = { "events", "usercmd", "update", "flush", "swap", "pacing", "total" };
+		return names[std::min<size_t>( phase, Total )];
+	}
+
+	void BeginFrame()
+	{
+		current = {};
+		frameStart = Clock::now();
+		phaseStart = frameStart;
+	}
+
+	void EndPhase( Phase phase )
+	{
+		const Clock::time_point now = Clock::now();
+		current.phases[phase] += std::chrono::duration<float, std::milli>( now - phaseStart ).count();
+		phaseStart = now;
+	}
+
+	void EndFrame()
+	{
+		current.total = std::chrono::duration<float, std::milli>( phaseStart - frameStart ).count();
+		frames[numRecorded % NumFrames] = current;
+		numRecorded++;
+	}
+
+	// How many frames are in the ring right now
+	size_t GetNumFrames() const
+	{
+		return std::min<size_t>( numRecorded, NumFrames );
+	}
+
+	// Over every frame in the ring, phase can also be Total
+	// Sorts a copy of the samples, so don't call it for every phase on every frame
+	Percentiles GetPercentiles( size_t phase ) const
+	{
+		const size_t numFrames = GetNumFrames();
+		if ( numFrames == 0 )
+		{
+			return {};
+		}
+
+		scratch.resize( numFrames );
+		for ( size_t i = 0; i < numFrames; i++ )
+		{
+			scratch[i] = phase == Total ? frames[i].total : frames[i].phases[phase];
+		}
+		std::sort( scratch.begin(), scratch.end() );
+
+		const auto percentile = [&]( float fraction )
+		{
+			return scratch[std::min( numFrames - 1, size_t( fraction * float( numFrames ) ) )];
+		};
+		return { percentile( 0.5f ), percentile( 0.95f ), percentile( 0.99f ) };
+	}
+
+	// Oldest frame first, one row per frame, all in milliseconds
+	bool WriteCsv( const char* path ) const
+	{
+		std::ofstream file( path, std::ios::trunc );
+		if ( !file )
+		{
+			return false;
+		}
+
+		file << "frame";
+		for ( size_t phase = 0; phase <= Total; phase++ )
+		{
+			file << ',' << GetPhaseName( phase ) << "_ms";
+		}
+		file << '\n';
+
+		const uint64_t firstFrame = numRecorded - GetNumFrames();
+		for ( uint64_t index = firstFrame; index < numRecorded; index++ )
+		{
+			const Frame& frame = frames[index % NumFrames];
+			file << index;
+			for ( size_t phase = 0; phase < NumPhases; phase++ )
+			{
+				file << ',' << frame.phases[phase];
+			}
+			file << ',' << frame.total << '\n';
+		}
+
+		return bool( file.flush() );
+	}
+
+private:
+	adm::Vector<Frame> frames;
+	uint64_t numRecorded{};
+
+	Frame current;
+	Clock::time_point frameStart;
+	Clock::time_point phaseStart;
+
+	mutable adm::Vector<float> scratch;
+};
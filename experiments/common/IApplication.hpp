@@ -3,6 +3,10 @@
 
 #include "debug_draw.hpp"
 
+// What the launcher opens its window at, the window can be resized after that
+constexpr int DefaultWindowWidth = 1600;
+constexpr int DefaultWindowHeight = 900;
+
 struct UserCommand
 {
 	UserCommand() = default;
@@ -32,15 +36,62 @@ struct UserCommand
 	// Absolute mouse coords
 	float mouseWindowX{};
 	float mouseWindowY{};
+
+	// Size of the window they're in, for code that can't ask for it, e.g. on the simulation thread
+	int windowWidth{ DefaultWindowWidth };
+	int windowHeight{ DefaultWindowHeight };
 };
 
 class IApplication
 {
 public:
+	// The launcher deletes experiments through this interface
+	virtual ~IApplication() = default;
+
 	virtual bool Init() = 0;
 	virtual void Shutdown() = 0;
 
-	virtual void Update( const float& deltaTime, const float& time, const UserCommand& uc ) = 0;
+	// Command line options of the experiment's own, called before Init for every argument the
+	// launcher doesn't know, with argv[i] being that argument. Returns how many arguments it
+	// took, counting argv[i], or 0 if it isn't one of the experiment's
+	virtual int ParseOption( int i, int argc, char** argv )
+	{
+		return 0;
+	}
+
+	// Called on the main thread before Init, and whenever the window changes size after that
+	virtual void SetViewportSize( int width, int height )
+	{
+	}
+
+	// Added to the launcher's usage text, one "  --option  what it does\n" line per option
+	virtual const char* GetOptionsUsage() const
+	{
+		return "";
+	}
+
+	// Once a frame on the main thread: input, state and drawing all in one go
+	virtual void Update( const float& deltaTime, const float& time, const UserCommand& uc )
+	{
+	}
+
+	// Applications that return true here get Simulate and Render instead of Update.
+	// Simulate runs on a thread of its own at a fixed tick, Render on the main thread once a frame,
+	// so a slow tick never holds a frame up. The two share nothing but what Simulate publishes,
+	// e.g. through a TripleBuffer, and only Render can use debug-draw
+	virtual bool SplitsSimulation() const
+	{
+		return false;
+	}
+
+	virtual void Simulate( const float& fixedDeltaTime, const UserCommand& uc )
+	{
+	}
+
+	// alpha goes from 0 to 1 between one tick and the next, for blending the last two ticks' state
+	virtual void Render( const float& alpha )
+	{
+	}
 
 	virtual const float* GetViewProjectionMatrix() const = 0;
 };
@@ -1,17 +1,29 @@
 
 #include <SDL.h>
 #include <Precompiled.hpp>
+#include <algorithm>
+#include <atomic>
+#include <climits>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
 #include <thread>
 
 #define DEBUG_DRAW_IMPLEMENTATION
 #include "IApplication.hpp"
+#include "CountingBackend.hpp"
+#include "FramePacer.hpp"
+#include "FrameProfiler.hpp"
+#include "Zones.hpp"
 
 #include <GL/glew.h>
 #include "DebugDrawBackend.hpp"
 
-using namespace std::chrono;
-
 // Defined in the Main.cpp of each experiment
 extern ApplicationInstance GetApplication();
 
@@ -62,6 +74,8 @@ UserCommand GenerateUserCommands( SDL_Window* window )
 	uc.mouseWindowX = x;
 	uc.mouseWindowY = y;
 
+	SDL_GetWindowSize( window, &uc.windowWidth, &uc.windowHeight );
+
 	if ( mouseState & SDL_BUTTON_LMASK )
 	{
 		uc.flags |= UserCommand::Action1;
@@ -74,11 +88,139 @@ UserCommand GenerateUserCommands( SDL_Window* window )
 	return uc;
 }
 
-bool RunFrame( SDL_Window* window, IApplication* app )
+// Percentiles of every frame phase in the bottom left corner
+// Only worked out again every half a second, that's about as fast as they can be read anyway
+void DrawProfilerOverlay( const FrameProfiler& profiler, int windowHeight )
+{
+	static FrameProfiler::Percentiles percentiles[FrameProfiler::NumPhases + 1];
+	static int framesUntilRefresh = 0;
+
+	if ( --framesUntilRefresh <= 0 )
+	{
+		for ( size_t phase = 0; phase <= FrameProfiler::Total; phase++ )
+		{
+			percentiles[phase] = profiler.GetPercentiles( phase );
+		}
+		framesUntilRefresh = 30;
+	}
+
+	for ( size_t phase = 0; phase <= FrameProfiler::Total; phase++ )
+	{
+		char line[128];
+		std::snprintf( line, sizeof( line ), "%-8s p50 %6.2f  p95 %6.2f  p99 %6.2f ms", FrameProfiler::GetPhaseName( phase ),
+			percentiles[phase].p50, percentiles[phase].p95, percentiles[phase].p99 );
+
+		const ddVec3 position = { 20.0f, float( windowHeight ) - 20.0f * float( FrameProfiler::Total + 1 - phase ), 0.0f };
+		dd::screenText( line, position, dd::colors::White, 0.8f );
+	}
+}
+
+// Runs IApplication::Simulate at a fixed tick on a thread of its own, for applications that split
+// simulation from rendering. A slow tick only holds up the ticks after it, frames keep coming
+class SimulationThread
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	SimulationThread( IApplication* app, float tickRate )
+		: app( app ), tickRate( tickRate ), fixedDeltaTime( 1.0f / tickRate )
+	{
+		// So the first frame already has something to draw
+		Tick();
+		thread = std::thread( [this]() { Run(); } );
+	}
+
+	~SimulationThread()
+	{
+		running.store( false, std::memory_order_relaxed );
+		thread.join();
+	}
+
+	// Input is read on the main thread, SDL wants it that way. Mouse movement adds up until
+	// the next tick takes it, so none of it is lost or counted twice
+	void PostUserCommand( const UserCommand& uc )
+	{
+		std::lock_guard<std::mutex> lock( userCommandMutex );
+		const float mouseX = pendingUserCommand.mouseX + uc.mouseX;
+		const float mouseY = pendingUserCommand.mouseY + uc.mouseY;
+		pendingUserCommand = uc;
+		pendingUserCommand.mouseX = mouseX;
+		pendingUserCommand.mouseY = mouseY;
+	}
+
+	// How far it is from the last tick to the next one
+	float GetAlpha() const
+	{
+		const Clock::duration sinceTick = Clock::now().time_since_epoch() - Clock::duration( lastTick.load( std::memory_order_acquire ) );
+		return std::clamp( std::chrono::duration<float>( sinceTick ).count() / fixedDeltaTime, 0.0f, 1.0f );
+	}
+
+private:
+	void Tick()
+	{
+		UserCommand uc;
+		{
+			std::lock_guard<std::mutex> lock( userCommandMutex );
+			uc = pendingUserCommand;
+			pendingUserCommand.mouseX = 0.0f;
+			pendingUserCommand.mouseY = 0.0f;
+		}
+
+		{
+			ProfileZone( "Simulate" );
+			app->Simulate( fixedDeltaTime, uc );
+		}
+
+		// After Simulate has published, so alpha only goes back to 0 once there's a new tick to blend
+		// towards. Until then, it runs up to 1 and holds there, which is where the new tick starts from
+		lastTick.store( Clock::now().time_since_epoch().count(), std::memory_order_release );
+	}
+
+	void Run()
+	{
+		if ( ZoneRecorder::IsEnabled() )
+		{
+			ZoneRecorder::SetThreadName( "simulation" );
+		}
+
+		FramePacer pacer( tickRate );
+		while ( running.load( std::memory_order_relaxed ) )
+		{
+			pacer.WaitForNextFrame();
+			Tick();
+		}
+	}
+
+	IApplication* app{};
+	float tickRate{};
+	float fixedDeltaTime{};
+
+	std::mutex userCommandMutex;
+	UserCommand pendingUserCommand;
+
+	std::atomic<Clock::rep> lastTick{};
+	std::atomic<bool> running{ true };
+	std::thread thread;
+};
+
+// simulation is null for applications that don't split simulation from rendering
+// The GL viewport, screen text and the application all follow the window's size
+static void ResizeViewport( IApplication* app, DDRenderInterfaceCoreGL* renderBackend, int width, int height )
+{
+	glViewport( 0, 0, width, height );
+	renderBackend->screenWidth = width;
+	renderBackend->screenHeight = height;
+	app->SetViewportSize( width, height );
+}
+
+bool RunFrame( SDL_Window* window, IApplication* app, DDRenderInterfaceCoreGL* renderBackend, FramePacer& pacer,
+	FrameProfiler& profiler, SimulationThread* simulation )
 {
 	static float time = 0.0f;
 	static float deltaTime = 0.0f;
-	adm::Timer timer;
+
+	ProfileZone( "Frame" );
+	profiler.BeginFrame();
 
 	{
 		SDL_Event e;
@@ -88,41 +230,289 @@ bool RunFrame( SDL_Window* window, IApplication* app )
 			{
 				return false;
 			}
+
+			// Minimising shrinks it to nothing, which there's no point drawing into
+			if ( e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED
+				&& e.window.data1 > 0 && e.window.data2 > 0 )
+			{
+				ResizeViewport( app, renderBackend, e.window.data1, e.window.data2 );
+			}
 		}
 	}
+	profiler.EndPhase( FrameProfiler::Events );
 
 	const UserCommand uc = GenerateUserCommands( window );
+	if ( simulation )
+	{
+		simulation->PostUserCommand( uc );
+	}
+	profiler.EndPhase( FrameProfiler::UserCommands );
 
 	glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
 
-	app->Update( deltaTime, time, uc );
-
-	dd::flush();
+	if ( simulation )
+	{
+		ProfileZone( "Render" );
+		app->Render( simulation->GetAlpha() );
+	}
+	else
+	{
+		ProfileZone( "Update" );
+		app->Update( deltaTime, time, uc );
+	}
+	profiler.EndPhase( FrameProfiler::Update );
 
-	SDL_GL_SwapWindow( window );
+	{
+		ProfileZone( "Flush" );
+		DrawProfilerOverlay( profiler, renderBackend->screenHeight );
+		dd::flush();
+	}
+	profiler.EndPhase( FrameProfiler::Flush );
 
-	float actualDeltaTime = timer.GetElapsed( adm::Timer::Seconds );
-	// Subtract one extra millisecond otherwise it'll be capped to 55fps for some reason
-	float timeTil60Hz = (1.0f / 60.0f) - actualDeltaTime - 0.001f;
-	if ( timeTil60Hz > 0.0f )
 	{
-		int us = timeTil60Hz * 1000.0f * 1000.0f;
-		std::this_thread::sleep_for( microseconds( us ) );
+		ProfileZone( "Swap" );
+		SDL_GL_SwapWindow( window );
 	}
+	profiler.EndPhase( FrameProfiler::Swap );
 
-	deltaTime = timer.GetElapsed( adm::Timer::Seconds );
+	deltaTime = pacer.WaitForNextFrame();
 	time += deltaTime;
+	profiler.EndPhase( FrameProfiler::Pacing );
+	profiler.EndFrame();
 
 	return true;
 }
 
+// Same input every run: walking forward in a slow circle, looking around,
+// with the cursor sweeping across the window
+UserCommand GenerateSyntheticUserCommands( int frame )
+{
+	UserCommand uc;
+	const float phase = float( frame ) * 0.01f;
+
+	uc.forward = 1.0f;
+	uc.right = std::sin( phase );
+	uc.flags = UserCommand::Action1;
+	uc.mouseX = 2.0f;
+	uc.mouseY = std::sin( phase * 3.0f );
+	uc.mouseWindowX = 800.0f + 600.0f * std::sin( phase * 2.0f );
+	uc.mouseWindowY = 450.0f + 300.0f * std::cos( phase * 2.0f );
+
+	return uc;
+}
+
+// No window, no GL, debug-draw goes to a backend that just counts
+// Frames run back to back with a fixed 60 Hz timestep, and Update and dd::flush are timed
+// separately, so what they cost on the CPU can be measured on machines without a GPU.
+// Applications that split simulation from rendering get one Simulate and one Render per frame,
+// all on this thread, so runs are repeatable
+static int RunHeadless( IApplication* app, int numFrames, FrameProfiler& profiler )
+{
+	DDRenderInterfaceCounting renderBackend;
+	app->SetViewportSize( DefaultWindowWidth, DefaultWindowHeight );
+	if ( !app->Init() || !dd::initialize( &renderBackend ) )
+	{
+		std::cerr << "Couldn't initialise the experiment" << std::endl;
+		return 1;
+	}
+
+	constexpr float deltaTime = 1.0f / 60.0f;
+	float time = 0.0f;
+
+	for ( int frame = 0; frame < numFrames; frame++ )
+	{
+		ProfileZone( "Frame" );
+		profiler.BeginFrame();
+
+		const UserCommand uc = GenerateSyntheticUserCommands( frame );
+		profiler.EndPhase( FrameProfiler::UserCommands );
+
+		if ( app->SplitsSimulation() )
+		{
+			{
+				ProfileZone( "Simulate" );
+				app->Simulate( deltaTime, uc );
+			}
+
+			ProfileZone( "Render" );
+			app->Render( 1.0f );
+		}
+		else
+		{
+			ProfileZone( "Update" );
+			app->Update( deltaTime, time, uc );
+		}
+		profiler.EndPhase( FrameProfiler::Update );
+
+		{
+			ProfileZone( "Flush" );
+			dd::flush();
+		}
+		profiler.EndPhase( FrameProfiler::Flush );
+		profiler.EndFrame();
+
+		time += deltaTime;
+	}
+
+	std::cout << numFrames << " frames (of which the last " << profiler.GetNumFrames() << " are kept)\n";
+	for ( const FrameProfiler::Phase phase : { FrameProfiler::Update, FrameProfiler::Flush, FrameProfiler::Total } )
+	{
+		const FrameProfiler::Percentiles percentiles = profiler.GetPercentiles( phase );
+		std::cout << "  " << FrameProfiler::GetPhaseName( phase ) << ": p50 " << percentiles.p50 << " ms, p95 "
+			<< percentiles.p95 << " ms, p99 " << percentiles.p99 << " ms\n";
+	}
+
+	const DDRenderInterfaceCounting::Counts& counts = renderBackend.GetCounts();
+	const double frames = double( std::max( numFrames, 1 ) );
+	std::cout << "Per frame: " << double( counts.points ) / frames << " points, " << double( counts.lines ) / frames
+		<< " lines, " << double( counts.glyphs ) / frames << " glyphs in " << double( counts.drawCalls ) / frames
+		<< " draw calls" << std::endl;
+
+	dd::shutdown();
+	app->Shutdown();
+	return 0;
+}
+
+// Whole string has to be a number above 0, so typos don't quietly turn into something else
+static bool ParsePositiveRate( const char* text, float& outRate )
+{
+	char* end = nullptr;
+	const float rate = std::strtof( text, &end );
+	if ( end == text || *end != '\0' || !(rate > 0.0f) || !std::isfinite( rate ) )
+	{
+		return false;
+	}
+
+	outRate = rate;
+	return true;
+}
+
+// Same idea, for counts
+static bool ParsePositiveCount( const char* text, int& outCount )
+{
+	char* end = nullptr;
+	const long count = std::strtol( text, &end, 10 );
+	if ( end == text || *end != '\0' || count <= 0 || count > INT_MAX )
+	{
+		return false;
+	}
+
+	outCount = int( count );
+	return true;
+}
+
+static void PrintUsage( const char* program, const IApplication* app )
+{
+	std::cout << "Usage: " << program << " [options]\n"
+		<< "  --fps N      frame rate to hold, above 0 (default 60)\n"
+		<< "  --uncapped   run frames back to back, for measuring throughput\n"
+		<< "  --tick N     simulation tick rate above 0, for experiments that simulate on their own thread (default 60)\n"
+		<< "  --headless   no window or GL, run a fixed number of frames with synthetic input\n"
+		<< "               and print what Update and dd::flush cost\n"
+		<< "  --frames N   how many frames --headless runs, at least 1 (default 600)\n"
+		<< "  --profile-csv PATH  write frame phase timings to PATH on exit\n"
+		<< "  --trace PATH        record ProfileZone zones from startup, and write them to PATH on exit\n"
+		<< "                      as Chrome trace-event JSON, for chrome://tracing or ui.perfetto.dev\n"
+		<< app->GetOptionsUsage();
+}
+
 int main( int argc, char** argv )
 {
-	SDL_Init( SDL_INIT_VIDEO | SDL_INIT_EVENTS );
+	float targetRate = 60.0f;
+	float tickRate = 60.0f;
+	bool headless = false;
+	int numHeadlessFrames = 600;
+	const char* profilePath = nullptr;
+	const char* tracePath = nullptr;
+
+	// Made up front, so it can take options of its own
 	ApplicationInstance instance = GetApplication();
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( !std::strcmp( argv[i], "--fps" ) && i + 1 < argc && ParsePositiveRate( argv[i + 1], targetRate ) )
+		{
+			i++;
+		}
+		else if ( !std::strcmp( argv[i], "--uncapped" ) )
+		{
+			targetRate = 0.0f;
+		}
+		else if ( !std::strcmp( argv[i], "--tick" ) && i + 1 < argc && ParsePositiveRate( argv[i + 1], tickRate ) )
+		{
+			i++;
+		}
+		else if ( !std::strcmp( argv[i], "--headless" ) )
+		{
+			headless = true;
+		}
+		else if ( !std::strcmp( argv[i], "--frames" ) && i + 1 < argc && ParsePositiveCount( argv[i + 1], numHeadlessFrames ) )
+		{
+			i++;
+		}
+		else if ( !std::strcmp( argv[i], "--profile-csv" ) && i + 1 < argc )
+		{
+			profilePath = argv[++i];
+		}
+		else if ( !std::strcmp( argv[i], "--trace" ) && i + 1 < argc )
+		{
+			tracePath = argv[++i];
+		}
+		else if ( const int numTaken = instance.app->ParseOption( i, argc, argv ) )
+		{
+			i += numTaken - 1;
+		}
+		else
+		{
+			PrintUsage( argv[0], instance.app );
+			delete instance.app;
+			return 1;
+		}
+	}
+
+	// Kept out of the loop's way, it's a few hundred KB of samples
+	std::unique_ptr<FrameProfiler> profiler = std::make_unique<FrameProfiler>();
+	const auto writeProfile = [&]()
+	{
+		if ( profilePath && !profiler->WriteCsv( profilePath ) )
+		{
+			std::cerr << "Couldn't write " << profilePath << std::endl;
+		}
+
+		if ( tracePath )
+		{
+			ZoneRecorder::SetEnabled( false );
+
+			uint64_t numDropped = 0;
+			if ( !ZoneRecorder::WriteChromeTrace( tracePath, &numDropped ) )
+			{
+				std::cerr << "Couldn't write " << tracePath << std::endl;
+			}
+			else if ( numDropped > 0 )
+			{
+				std::cerr << "Trace buffers filled up, " << numDropped << " zones were dropped" << std::endl;
+			}
+		}
+	};
+
+	// Before Init, so it shows up too
+	if ( tracePath )
+	{
+		ZoneRecorder::SetThreadName( "main" );
+		ZoneRecorder::SetEnabled( true );
+	}
+
+	if ( headless )
+	{
+		const int result = RunHeadless( instance.app, numHeadlessFrames, *profiler );
+		writeProfile();
+		delete instance.app;
+		return result;
+	}
+
+	SDL_Init( SDL_INIT_VIDEO | SDL_INIT_EVENTS );
 
 	SDL_Window* window = SDL_CreateWindow( instance.name, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-		1600, 900, SDL_WINDOW_OPENGL );
+		DefaultWindowWidth, DefaultWindowHeight, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE );
 
 	SDL_GL_SetSwapInterval( 0 );
 	SDL_GL_SetAttribute( SDL_GL_CONTEXT_MAJOR_VERSION, 3 );
@@ -132,6 +522,7 @@ int main( int argc, char** argv )
 	glewInit();
 
 	DDRenderInterfaceCoreGL* renderBackend = new DDRenderInterfaceCoreGL();
+	ResizeViewport( instance.app, renderBackend, DefaultWindowWidth, DefaultWindowHeight );
 
 	instance.app->Init();
 
@@ -139,7 +530,16 @@ int main( int argc, char** argv )
 	
 	dd::initialize( renderBackend );
 	
-	while ( RunFrame( window, instance.app ) );
+	std::unique_ptr<SimulationThread> simulation;
+	if ( instance.app->SplitsSimulation() )
+	{
+		simulation = std::make_unique<SimulationThread>( instance.app, tickRate );
+	}
+
+	FramePacer pacer( targetRate );
+	while ( RunFrame( window, instance.app, renderBackend, pacer, *profiler, simulation.get() ) );
+	simulation.reset();
+	writeProfile();
 	
 	dd::shutdown();
 	
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Same test as spatial's Simd.hpp, kept here so common doesn't depend on spatial
+#if defined( __SSE2__ ) || defined( _M_X64 ) || (defined( _M_IX86_FP ) && _M_IX86_FP >= 2)
+#define RANDOM_SSE 1
+#include <emmintrin.h>
+#endif
+
+// Seedable random numbers with independent streams, for generating test data in parallel
+//
+// Rather than one generator that every thread has to take turns with, every stream of a seed
+// is its own generator, so chunk N of some data can be made from stream N and come out the
+// same whichever thread gets to it.
+//
+// Each stream is four xoshiro128+ generators side by side, taking turns, which only needs
+// adds, xors and shifts, so SSE2 can step all four at once. Fill() and the one-at-a-time
+// functions hand out the exact same sequence. Floats are made from the top 24 bits, the
+// low ones aren't very random with xoshiro128+.
+class Random
+{
+public:
+	static constexpr size_t NumLanes = 4;
+
+	Random()
+		: Random( 0 )
+	{
+	}
+
+	// Different streams of the same seed are independent of each other
+	explicit Random( uint64_t seed, uint64_t stream = 0 )
+	{
+		uint64_t key = seed ^ Mix64( stream + 0x9E3779B97F4A7C15ULL );
+		for ( size_t word = 0; word < 4; word++ )
+		{
+			for ( size_t lane = 0; lane < NumLanes; lane += 2 )
+			{
+				key += 0x9E3779B97F4A7C15ULL;
+				const uint64_t bits = Mix64( key );
+				state[word][lane] = uint32_t( bits );
+				state[word][lane + 1] = uint32_t( bits >> 32 );
+			}
+		}
+
+		// xoshiro can't get out of all zeroes
+		for ( size_t lane = 0; lane < NumLanes; lane++ )
+		{
+			if ( (state[0][lane] | state[1][lane] | state[2][lane] | state[3][lane]) == 0 )
+			{
+				state[0][lane] = 1;
+			}
+		}
+	}
+
+	uint32_t Next()
+	{
+		if ( numBuffered == 0 )
+		{
+			Step( buffered );
+			numBuffered = NumLanes;
+		}
+
+		return buffered[NumLanes - numBuffered--];
+	}
+
+	// Between 0 and 1, 1 excluded
+	float Float()
+	{
+		return ToFloat( Next() );
+	}
+
+	// Between -1 and 1
+	float Signed()
+	{
+		return Float() * 2.0f - 1.0f;
+	}
+
+	// Between 0 and count, count excluded
+	uint32_t Index( uint32_t count )
+	{
+		return uint32_t( (uint64_t( Next() ) * count) >> 32 );
+	}
+
+	// count numbers between 0 and 1 in one go, same as calling Float() count times
+	void Fill( float* out, size_t count )
+	{
+		size_t i = 0;
+		for ( ; i < count && numBuffered > 0; i++ )
+		{
+			out[i] = Float();
+		}
+
+#if defined( RANDOM_SSE )
+		__m128i s0 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( state[0] ) );
+		__m128i s1 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( state[1] ) );
+		__m128i s2 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( state[2] ) );
+		__m128i s3 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( state[3] ) );
+		const __m128 scale = _mm_set1_ps( 1.0f / 16777216.0f );
+		for ( ; i + NumLanes <= count; i += NumLanes )
+		{
+			const __m128i result = _mm_add_epi32( s0, s3 );
+			const __m128i t = _mm_slli_epi32( s1, 9 );
+			s2 = _mm_xor_si128( s2, s0 );
+			s3 = _mm_xor_si128( s3, s1 );
+			s1 = _mm_xor_si128( s1, s2 );
+			s0 = _mm_xor_si128( s0, s3 );
+			s2 = _mm_xor_si128( s2, t );
+			s3 = _mm_or_si128( _mm_slli_epi32( s3, 11 ), _mm_srli_epi32( s3, 21 ) );
+
+			_mm_storeu_ps( out + i, _mm_mul_ps( _mm_cvtepi32_ps( _mm_srli_epi32( result, 8 ) ), scale ) );
+		}
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( state[0] ), s0 );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( state[1] ), s1 );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( state[2] ), s2 );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( state[3] ), s3 );
+#endif
+
+		for ( ; i < count; i++ )
+		{
+			out[i] = Float();
+		}
+	}
+
+	static float ToFloat( uint32_t bits )
+	{
+		return float( bits >> 8 ) * (1.0f / 16777216.0f);
+	}
+
+private:
+	static uint64_t Mix64( uint64_t x )
+	{
+		x ^= x >> 30;
+		x *= 0xBF58476D1CE4E5B9ULL;
+		x ^= x >> 27;
+		x *= 0x94D049BB133111EBULL;
+		x ^= x >> 31;
+		return x;
+	}
+
+	// One xoshiro128+ step for every lane
+	void Step( uint32_t* out )
+	{
+		for ( size_t lane = 0; lane < NumLanes; lane++ )
+		{
+			out[lane] = state[0][lane] + state[3][lane];
+			const uint32_t t = state[1][lane] << 9;
+			state[2][lane] ^= state[0][lane];
+			state[3][lane] ^= state[1][lane];
+			state[1][lane] ^= state[2][lane];
+			state[0][lane] ^= state[3][lane];
+			state[2][lane] ^= t;
+			state[3][lane] = (state[3][lane] << 11) | (state[3][lane] >> 21);
+		}
+	}
+
+	// Word-major, so every word of all the lanes can be loaded as one vector
+	uint32_t state[4][NumLanes]{};
+	uint32_t buffered[NumLanes]{};
+	size_t numBuffered{};
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Hands values from one thread to another without either ever waiting on the other
+//
+// Three slots: the writer fills one, the reader reads another, and the third sits in the
+// middle holding the newest finished value. Publish swaps the writer's slot with the middle
+// one, Acquire swaps the reader's with it, so the reader always gets the latest value and
+// the writer can run as far ahead as it likes. The slot the writer gets back is usually two
+// values old, so write the whole thing every time rather than patching it.
+//
+// One writer thread and one reader thread
+template<typename T>
+class TripleBuffer
+{
+public:
+	// Writer only
+	T& GetWriteBuffer()
+	{
+		return slots[back].value;
+	}
+
+	// Writer only, hands over what's in the write buffer
+	void Publish()
+	{
+		back = middle.exchange( back | FreshBit, std::memory_order_acq_rel ) & IndexMask;
+	}
+
+	// Reader only, returns false and keeps the old value if nothing's been published since last time
+	bool Acquire()
+	{
+		if ( !(middle.load( std::memory_order_relaxed ) & FreshBit) )
+		{
+			return false;
+		}
+
+		front = middle.exchange( front, std::memory_order_acq_rel ) & IndexMask;
+		return true;
+	}
+
+	// Reader only, a default-made T until the first Publish
+	const T& GetReadBuffer() const
+	{
+		return slots[front].value;
+	}
+
+private:
+	static constexpr uint8_t IndexMask = 0x3;
+	static constexpr uint8_t FreshBit = 0x4;
+
+	// Own cache lines, so the two threads don't fight over them
+	struct alignas( 64 ) Slot
+	{
+		T value{};
+	};
+
+	Slot slots[3];
+	alignas( 64 ) uint8_t back{ 0 };
+	alignas( 64 ) std::atomic<uint8_t> middle{ 1 };
+	alignas( 64 ) uint8_t front{ 2 };
+};
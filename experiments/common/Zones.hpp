@@ -0,0 +1,210 @@
+#pragma once
+
+#include <Precompiled.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+
+// Scoped timing zones, for seeing inside a frame phase, written out as Chrome trace-event JSON
+// that chrome://tracing and ui.perfetto.dev can open
+//
+// Every thread records into a fixed-size buffer of its own, made the first time it records
+// anything, so recording a zone never takes a lock or shares a cache line with another thread.
+// With capture off, a zone is one load and one well-predicted branch, so they can stay in hot
+// loops. Define EXPERIMENTS_NO_ZONES to compile them out altogether
+class ZoneRecorder
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// Anything past this is dropped, and counted, so a long capture can't eat all the memory
+	static constexpr uint32_t EventsPerThread = 1 << 18;
+
+	// In nanoseconds since the program started
+	struct Event
+	{
+		const char* name;
+		int64_t begin;
+		int64_t end;
+	};
+
+	struct ThreadBuffer
+	{
+		std::unique_ptr<Event[]> events{ new Event[EventsPerThread] };
+		// Only ever written by the thread that owns the buffer, after the event itself,
+		// so a reader always sees whole events
+		std::atomic<uint32_t> numEvents{};
+		std::atomic<uint32_t> numDropped{};
+		uint32_t threadId{};
+		const char* threadName{};
+	};
+
+	static bool IsEnabled()
+	{
+		return enabled.load( std::memory_order_relaxed );
+	}
+
+	static void SetEnabled( bool enable )
+	{
+		enabled.store( enable, std::memory_order_relaxed );
+	}
+
+	static int64_t Now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now() - origin ).count();
+	}
+
+	static ThreadBuffer* GetThreadBuffer()
+	{
+		static thread_local ThreadBuffer* buffer = RegisterThread();
+		return buffer;
+	}
+
+	// Shows up as the thread's name in the trace, name has to outlive the recorder
+	static void SetThreadName( const char* name )
+	{
+		GetThreadBuffer()->threadName = name;
+	}
+
+	static void Record( ThreadBuffer* buffer, const char* name, int64_t begin, int64_t end )
+	{
+		const uint32_t index = buffer->numEvents.load( std::memory_order_relaxed );
+		if ( index >= EventsPerThread )
+		{
+			buffer->numDropped.store( buffer->numDropped.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+			return;
+		}
+
+		buffer->events[index] = { name, begin, end };
+		buffer->numEvents.store( index + 1, std::memory_order_release );
+	}
+
+	// Everything recorded so far, from every thread, as complete ("X") events
+	// Threads can keep recording while this runs, whatever they add afterwards is left out
+	static bool WriteChromeTrace( const char* path, uint64_t* outNumDropped = nullptr )
+	{
+		std::ofstream file( path, std::ios::trunc );
+		if ( !file )
+		{
+			return false;
+		}
+
+		const auto writeString = [&]( const char* string )
+		{
+			file << '"';
+			for ( ; *string; string++ )
+			{
+				if ( *string == '"' || *string == '\\' )
+				{
+					file << '\\';
+				}
+				file << *string;
+			}
+			file << '"';
+		};
+
+		uint64_t numDropped = 0;
+		bool first = true;
+		file << std::fixed << std::setprecision( 3 );
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+		std::lock_guard<std::mutex> lock( registryMutex );
+		for ( const std::unique_ptr<ThreadBuffer>& buffer : registry )
+		{
+			file << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << buffer->threadId
+				<< ",\"args\":{\"name\":";
+			if ( buffer->threadName )
+			{
+				writeString( buffer->threadName );
+			}
+			else
+			{
+				file << "\"thread " << buffer->threadId << '"';
+			}
+			file << "}}";
+			first = false;
+
+			// Timestamps are in microseconds
+			const uint32_t numEvents = buffer->numEvents.load( std::memory_order_acquire );
+			for ( uint32_t i = 0; i < numEvents; i++ )
+			{
+				const Event& event = buffer->events[i];
+				file << ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadId << ",\"name\":";
+				writeString( event.name );
+				file << ",\"ts\":" << double( event.begin ) / 1000.0 << ",\"dur\":" << double( event.end - event.begin ) / 1000.0 << '}';
+			}
+
+			numDropped += buffer->numDropped.load( std::memory_order_relaxed );
+		}
+
+		file << "\n]}\n";
+
+		if ( outNumDropped )
+		{
+			*outNumDropped = numDropped;
+		}
+
+		return bool( file.flush() );
+	}
+
+private:
+	static ThreadBuffer* RegisterThread()
+	{
+		std::lock_guard<std::mutex> lock( registryMutex );
+		registry.push_back( std::make_unique<ThreadBuffer>() );
+		registry.back()->threadId = uint32_t( registry.size() );
+		return registry.back().get();
+	}
+
+	inline static std::atomic<bool> enabled{};
+	inline static const Clock::time_point origin = Clock::now();
+
+	// Buffers are kept until the end, so threads that have finished still show up in the trace
+	inline static std::mutex registryMutex;
+	inline static adm::Vector<std::unique_ptr<ThreadBuffer>> registry;
+};
+
+// Records from construction to destruction, use ProfileZone rather than this directly
+class Zone
+{
+public:
+	explicit Zone( const char* name )
+	{
+		if ( ZoneRecorder::IsEnabled() )
+		{
+			buffer = ZoneRecorder::GetThreadBuffer();
+			zoneName = name;
+			begin = ZoneRecorder::Now();
+		}
+	}
+
+	~Zone()
+	{
+		if ( buffer )
+		{
+			ZoneRecorder::Record( buffer, zoneName, begin, ZoneRecorder::Now() );
+		}
+	}
+
+	Zone( const Zone& ) = delete;
+	Zone& operator=( const Zone& ) = delete;
+
+private:
+	ZoneRecorder::ThreadBuffer* buffer{};
+	const char* zoneName{};
+	int64_t begin{};
+};
+
+#define ZoneConcatInner( a, b ) a##b
+#define ZoneConcat( a, b ) ZoneConcatInner( a, b )
+
+// Times the rest of the enclosing scope, name has to be a string literal or otherwise outlive the capture
+#if defined( EXPERIMENTS_NO_ZONES )
+#define ProfileZone( name )
+#else
+#define ProfileZone( name ) Zone ZoneConcat( zone_, __LINE__ )( name )
+#endif
@@ -0,0 +1,1605 @@
+
+// Headless octree benchmark, no window, no GL, just the data structures
+// Sweeps point counts, distributions and subdivision heuristics, then spits out CSV/JSON
+// so results can be diffed between revisions
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <Precompiled.hpp>
+#include "experiments/octree/Scenarios.hpp"
+#include "experiments/spatial/Bvh.hpp"
+#include "experiments/spatial/FlatOctree.hpp"
+#include "experiments/spatial/LooseOctree.hpp"
+#include "experiments/spatial/Pairs.hpp"
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+using namespace std::chrono;
+
+using AdmOctree = adm::NTree<adm::Vec3, adm::AABB, 3>;
+using SpatialOctree = spatial::Octree<adm::Vec3>;
+using FlatOctree = spatial::FlatOctree<adm::Vec3>;
+using BoxOctree = spatial::Octree<adm::AABB>;
+using LooseOctree = spatial::LooseOctree<adm::AABB>;
+using PointBvh = spatial::Bvh<adm::Vec3>;
+using BoxBvh = spatial::Bvh<adm::AABB>;
+
+// Same callbacks as InitialiseOctree below, fixed at compile time
+using Threshold40Policy = spatial::FunctionPolicy<spatial::utils::IntersectsAABB, spatial::utils::OccupiesBox,
+	spatial::utils::SimpleThreshold<adm::Vec3, 40>, spatial::utils::GetAABBForChild>;
+using DensityPolicy = spatial::FunctionPolicy<spatial::utils::IntersectsAABB, spatial::utils::OccupiesBox,
+	ShouldSubdivideByDensity<SpatialOctree::NodeType>, spatial::utils::GetAABBForChild>;
+
+// Keeps the optimiser from throwing away query results
+static volatile float gSink = 0.0f;
+
+// Every heap allocation the process makes goes through the operators below, so each phase
+// can report how many it did
+static std::atomic<int64_t> gNumAllocations{ 0 };
+
+// Whether spatial::Tree build arenas ask for huge pages
+static bool gHugePages = false;
+
+static void* CountedAllocate( size_t size, size_t alignment )
+{
+	gNumAllocations.fetch_add( 1, std::memory_order_relaxed );
+	size = std::max<size_t>( size, 1 );
+#if defined( _WIN32 )
+	void* pointer = _aligned_malloc( size, alignment );
+#else
+	void* pointer = nullptr;
+	if ( posix_memalign( &pointer, std::max( alignment, sizeof( void* ) ), size ) )
+	{
+		pointer = nullptr;
+	}
+#endif
+	if ( !pointer )
+	{
+		throw std::bad_alloc();
+	}
+
+	return pointer;
+}
+
+static void CountedFree( void* pointer )
+{
+#if defined( _WIN32 )
+	_aligned_free( pointer );
+#else
+	std::free( pointer );
+#endif
+}
+
+void* operator new( size_t size )
+{
+	return CountedAllocate( size, alignof( std::max_align_t ) );
+}
+
+void* operator new( size_t size, std::align_val_t alignment )
+{
+	return CountedAllocate( size, size_t( alignment ) );
+}
+
+void operator delete( void* pointer ) noexcept
+{
+	CountedFree( pointer );
+}
+
+void operator delete( void* pointer, size_t ) noexcept
+{
+	CountedFree( pointer );
+}
+
+void operator delete( void* pointer, std::align_val_t ) noexcept
+{
+	CountedFree( pointer );
+}
+
+void operator delete( void* pointer, size_t, std::align_val_t ) noexcept
+{
+	CountedFree( pointer );
+}
+
+enum class Heuristic
+{
+	Threshold40,
+	Density
+};
+
+static const Heuristic Heuristics[] =
+{
+	Heuristic::Threshold40,
+	Heuristic::Density
+};
+
+static const char* HeuristicName( Heuristic heuristic )
+{
+	return heuristic == Heuristic::Threshold40 ? "threshold40" : "density";
+}
+
+static const Distribution Distributions[] =
+{
+	Distribution::Uniform,
+	Distribution::Shell,
+	Distribution::Clustered
+};
+
+struct Options
+{
+	int64_t minPoints = 1000;
+	int64_t maxPoints = 100'000'000;
+	int repetitions = 5;
+	// 0 means all hardware threads
+	int numThreads = 0;
+	bool hugePages = false;
+	unsigned int seed = 0x910583;
+	std::string label = "unlabelled";
+	std::string csvPath;
+	std::string jsonPath;
+	std::string onlyDistribution;
+	std::string onlyHeuristic;
+	std::string onlyStructure;
+};
+
+// Timings of one phase, all in milliseconds
+struct Stats
+{
+	int samples{};
+	double min{};
+	double median{};
+	double p90{};
+	double p99{};
+	double max{};
+	double mean{};
+	// Heap allocations during the last repetition, i.e. once everything has warmed up
+	int64_t allocations{};
+};
+
+struct Result
+{
+	std::string structure;
+	std::string distribution;
+	std::string heuristic;
+	int64_t numPoints{};
+	std::string phase;
+	size_t numNodes{};
+	size_t numLeaves{};
+	// What the structure holds on to, where it can tell
+	size_t bytes{};
+	Stats stats;
+};
+
+// Nearest-rank percentile, samples must be sorted
+static double Percentile( const adm::Vector<double>& sorted, double percentile )
+{
+	const size_t rank = size_t( std::ceil( percentile / 100.0 * sorted.size() ) );
+	return sorted[std::clamp<size_t>( rank, 1, sorted.size() ) - 1];
+}
+
+static Stats ComputeStats( adm::Vector<double> samples )
+{
+	std::sort( samples.begin(), samples.end() );
+
+	Stats stats;
+	stats.samples = int( samples.size() );
+	stats.min = samples.front();
+	stats.median = Percentile( samples, 50.0 );
+	stats.p90 = Percentile( samples, 90.0 );
+	stats.p99 = Percentile( samples, 99.0 );
+	stats.max = samples.back();
+
+	for ( const double& sample : samples )
+	{
+		stats.mean += sample;
+	}
+	stats.mean /= samples.size();
+
+	return stats;
+}
+
+// Runs setup (untimed) then work (timed) a number of times
+template<typename SetupFn, typename WorkFn>
+static Stats Measure( int repetitions, SetupFn&& setup, WorkFn&& work )
+{
+	adm::Vector<double> samples;
+	samples.reserve( repetitions );
+
+	int64_t allocations = 0;
+	for ( int i = 0; i < repetitions; i++ )
+	{
+		setup();
+
+		const int64_t allocationsBefore = gNumAllocations.load( std::memory_order_relaxed );
+		const auto start = steady_clock::now();
+		work();
+		const auto end = steady_clock::now();
+		allocations = gNumAllocations.load( std::memory_order_relaxed ) - allocationsBefore;
+
+		samples.push_back( duration<double, std::milli>( end - start ).count() );
+	}
+
+	Stats stats = ComputeStats( std::move( samples ) );
+	stats.allocations = allocations;
+	return stats;
+}
+
+// Same callbacks as OctreeExperiment, just with the heuristic swapped out
+static void InitialiseOctree( AdmOctree& octree, const adm::AABB& box, Heuristic heuristic )
+{
+	if ( heuristic == Heuristic::Threshold40 )
+	{
+		octree.Initialise( box,
+			adm::utils::IntersectsAABB,
+			adm::utils::OccupiesBox,
+			adm::utils::SimpleThreshold<adm::Vec3, 40>,
+			adm::utils::GetAABBForChild );
+	}
+	else
+	{
+		octree.Initialise( box,
+			adm::utils::IntersectsAABB,
+			adm::utils::OccupiesBox,
+			ShouldSubdivideByDensity<AdmOctree::NodeType>,
+			adm::utils::GetAABBForChild );
+	}
+}
+
+static void InitialiseOctree( SpatialOctree& octree, const adm::AABB& box, Heuristic heuristic )
+{
+	octree.GetBuildArena().SetHugePages( gHugePages );
+	if ( heuristic == Heuristic::Threshold40 )
+	{
+		octree.Initialise( box,
+			spatial::utils::IntersectsAABB,
+			spatial::utils::OccupiesBox,
+			spatial::utils::SimpleThreshold<adm::Vec3, 40>,
+			spatial::utils::GetAABBForChild );
+	}
+	else
+	{
+		octree.Initialise( box,
+			spatial::utils::IntersectsAABB,
+			spatial::utils::OccupiesBox,
+			ShouldSubdivideByDensity<SpatialOctree::NodeType>,
+			spatial::utils::GetAABBForChild );
+	}
+}
+
+// Builds the tree a few times, then runs the queries over the last build
+// Both tree types have the same GetLeaves/ForEachElement interface, so this works for either
+template<typename TreeType, typename BuildFn>
+static void BenchmarkTree( const Options& options, const char* structureName, TreeType& octree, BuildFn&& build,
+	const adm::Vector<adm::Vec3>& points, const char* distributionName, Heuristic heuristic, adm::Vector<Result>& results )
+{
+	Result result;
+	result.structure = structureName;
+	result.distribution = distributionName;
+	result.heuristic = HeuristicName( heuristic );
+	result.numPoints = int64_t( points.size() );
+
+	result.phase = "build";
+	result.stats = Measure( options.repetitions,
+		[&]()
+		{
+			octree.SetElements( adm::Vector<adm::Vec3>( points ) );
+		},
+		[&]()
+		{
+			build();
+		} );
+
+	result.numNodes = octree.GetNodes().size();
+	result.numLeaves = octree.GetLeaves().size();
+	results.push_back( result );
+
+	// What Render does every frame, minus the debug-draw calls
+	result.phase = "leaf-walk";
+	result.stats = Measure( options.repetitions, [] {},
+		[&]()
+		{
+			float sum = 0.0f;
+			for ( const auto& node : octree.GetLeaves() )
+			{
+				sum += node->GetBoundingVolume().GetCentre().x;
+			}
+			gSink = gSink + sum;
+		} );
+	results.push_back( result );
+
+	result.phase = "element-walk";
+	result.stats = Measure( options.repetitions, [] {},
+		[&]()
+		{
+			adm::Vec3 sum;
+			for ( const auto& node : octree.GetLeaves() )
+			{
+				node->ForEachElement( [&]( adm::Vec3* point )
+					{
+						sum += *point;
+					} );
+			}
+			gSink = gSink + sum.x + sum.y + sum.z;
+		} );
+	results.push_back( result );
+}
+
+static bool Overlaps( const adm::AABB& a, const adm::AABB& b )
+{
+	return a.mins.x <= b.maxs.x && a.maxs.x >= b.mins.x
+		&& a.mins.y <= b.maxs.y && a.maxs.y >= b.mins.y
+		&& a.mins.z <= b.maxs.z && a.maxs.z >= b.mins.z;
+}
+
+// Number of elements in leaves overlapping `query`, by walking down from the root
+static int64_t CountInBox( const SpatialOctree& octree, const adm::AABB& query )
+{
+	const auto& nodes = octree.GetNodes();
+
+	int64_t count = 0;
+	adm::Vector<int32_t> stack{ 0 };
+	while ( !stack.empty() )
+	{
+		const SpatialOctree::NodeType& node = nodes[stack.back()];
+		stack.pop_back();
+
+		if ( !Overlaps( node.GetBoundingVolume(), query ) )
+		{
+			continue;
+		}
+
+		if ( node.IsLeaf() )
+		{
+			count += node.GetNumElements();
+			continue;
+		}
+
+		for ( size_t c = 0; c < SpatialOctree::NumChildren; c++ )
+		{
+			stack.push_back( node.GetFirstChild() + int32_t( c ) );
+		}
+	}
+
+	return count;
+}
+
+static int64_t CountInBox( const FlatOctree& octree, const adm::AABB& query )
+{
+	const spatial::BoxArrayView& boxes = octree.GetNodeBoxes();
+	const auto links = octree.GetNodeLinks();
+	const auto offsets = octree.GetLeafOffsets();
+
+	int64_t count = 0;
+	adm::Vector<uint32_t> stack{ 0 };
+	while ( !stack.empty() )
+	{
+		const uint32_t nodeIndex = stack.back();
+		stack.pop_back();
+
+		if ( !Overlaps( boxes[nodeIndex], query ) )
+		{
+			continue;
+		}
+
+		const uint32_t link = links[nodeIndex];
+		if ( FlatOctree::IsLeafLink( link ) )
+		{
+			const uint32_t leaf = FlatOctree::GetLeafIndex( link );
+			count += offsets[leaf + 1] - offsets[leaf];
+			continue;
+		}
+
+		for ( uint32_t c = 0; c < FlatOctree::NumChildren; c++ )
+		{
+			stack.push_back( link + c );
+		}
+	}
+
+	return count;
+}
+
+// A fixed set of query boxes, an eighth of the domain's size on each axis
+static adm::Vector<adm::AABB> GenerateQueryBoxes( const adm::AABB& box, unsigned int seed )
+{
+	Random random( seed );
+
+	const adm::Vec3 size = (box.maxs - box.mins) * 0.125f;
+	adm::Vector<adm::AABB> queries( 256 );
+	for ( adm::AABB& query : queries )
+	{
+		query.mins = randVec( random, box.mins, box.maxs - size );
+		query.maxs = query.mins + size;
+	}
+
+	return queries;
+}
+
+// View-projection matrices from random spots around the box, looking at random spots in it
+// Same projection as OctreeExperiment
+static adm::Vector<spatial::Frustum> GenerateFrustums( const adm::AABB& box, unsigned int seed )
+{
+	Random random( seed );
+
+	const glm::mat4 projection = glm::perspective( glm::radians( 90.0f ), 16.0f / 9.0f, 0.01f, 1024.0f );
+	const adm::Vec3 margin = (box.maxs - box.mins) * 0.25f;
+
+	adm::Vector<spatial::Frustum> frustums( 64 );
+	for ( spatial::Frustum& frustum : frustums )
+	{
+		const adm::Vec3 eye = randVec( random, box.mins - margin, box.maxs + margin );
+		const adm::Vec3 target = randVec( random, box.mins, box.maxs );
+		const glm::mat4 view = glm::lookAt( glm::vec3( eye.x, eye.y, eye.z ), glm::vec3( target.x, target.y, target.z ), glm::vec3( 0.0f, 0.0f, 1.0f ) );
+		const glm::mat4 viewProjection = projection * view;
+
+		frustum = spatial::Frustum::FromViewProjection( &viewProjection[0][0] );
+	}
+
+	return frustums;
+}
+
+// A 64x64 grid of camera rays, from a corner outside the box towards the middle of it
+static adm::Vector<spatial::Ray> GenerateCameraRays( const adm::AABB& box )
+{
+	constexpr int resolution = 64;
+
+	const adm::Vec3 eye = box.mins - (box.maxs - box.mins) * 0.25f;
+	const adm::Vec3 forward = (box.GetCentre() - eye).Normalized();
+	const adm::Vec3 right = adm::Vec3( forward.y, -forward.x, 0.0f ).Normalized();
+	const adm::Vec3 up = adm::Vec3(
+		right.y * forward.z - right.z * forward.y,
+		right.z * forward.x - right.x * forward.z,
+		right.x * forward.y - right.y * forward.x );
+
+	adm::Vector<spatial::Ray> rays;
+	rays.reserve( resolution * resolution );
+	for ( int y = 0; y < resolution; y++ )
+	{
+		for ( int x = 0; x < resolution; x++ )
+		{
+			const float u = (x + 0.5f) / resolution * 2.0f - 1.0f;
+			const float v = (y + 0.5f) / resolution * 2.0f - 1.0f;
+
+			spatial::Ray ray;
+			ray.origin = eye;
+			ray.direction = (forward + right * (u * 0.5f) + up * (v * 0.5f)).Normalized();
+			rays.push_back( ray );
+		}
+	}
+
+	return rays;
+}
+
+// Random points in the box, in no particular order, for the nearest neighbour queries
+static adm::Vector<adm::Vec3> GenerateQueryPoints( const adm::AABB& box, unsigned int seed )
+{
+	Random random( seed );
+
+	adm::Vector<adm::Vec3> points( 4096 );
+	for ( adm::Vec3& point : points )
+	{
+		point = randVec( random, box.mins, box.maxs );
+	}
+
+	return points;
+}
+
+// Traces all the rays in packets of Width, returns how many hit something
+template<size_t Width>
+static int64_t RaycastPackets( const FlatOctree& flat, const adm::Vector<spatial::Ray>& rays )
+{
+	int64_t numHits = 0;
+	spatial::RayPacket<Width> packet;
+	spatial::RayHit hits[Width];
+	for ( size_t first = 0; first + Width <= rays.size(); first += Width )
+	{
+		for ( size_t lane = 0; lane < Width; lane++ )
+		{
+			packet.Set( lane, rays[first + lane] );
+		}
+
+		flat.RaycastPacket( packet, spatial::utils::RayHitsPoint(), hits, spatial::utils::RayHitsPoint().radius );
+		for ( const spatial::RayHit& hit : hits )
+		{
+			numHits += hit.IsHit();
+		}
+	}
+
+	return numHits;
+}
+
+// Pointer-chasing spatial::Tree vs. the flattened copy, on the same build
+static void BenchmarkFlat( const Options& options, const SpatialOctree& tree, const adm::AABB& box,
+	const char* distributionName, Heuristic heuristic, adm::Vector<Result>& results )
+{
+	const adm::Vector<adm::AABB> queries = GenerateQueryBoxes( box, options.seed );
+	const adm::Vector<spatial::Frustum> frustums = GenerateFrustums( box, options.seed );
+	const adm::Vector<spatial::Ray> rays = GenerateCameraRays( box );
+	const adm::Vector<adm::Vec3> queryPoints = GenerateQueryPoints( box, options.seed );
+
+	Result result;
+	result.distribution = distributionName;
+	result.heuristic = HeuristicName( heuristic );
+	result.numPoints = int64_t( tree.GetElements().size() );
+	result.numNodes = tree.GetNodes().size();
+	result.numLeaves = tree.GetLeaves().size();
+
+	// Same as element-walk, but going through each leaf's slice instead of a callback per element
+	result.structure = "spatial::Tree";
+	result.phase = "element-span-walk";
+	result.stats = Measure( options.repetitions, [] {},
+		[&]()
+		{
+			adm::Vec3 sum;
+			for ( const auto& node : tree.GetLeaves() )
+			{
+				for ( const adm::Vec3& point : node->GetElementSpan() )
+				{
+					sum += point;
+				}
+			}
+			gSink = gSink + sum.x + sum.y + sum.z;
+		} );
+	results.push_back( result );
+
+	result.phase = "box-query";
+	result.stats = Measure( options.repetitions, [] {},
+		[&]()
+		{
+			int64_t count = 0;
+			for ( const adm::AABB& query : queries )
+			{
+				count += CountInBox( tree, query );
+			}
+			gSink = gSink + float( count );
+		} );
+	results.push_back( result );
+
+	// What culling in Render would cost without a hierarchy: every leaf against every plane
+	result.phase = "frustum-cull";
+	result.stats = Measure( options.repetitions, [] {},
+		[&]()
+		{
+			int64_t count = 0;
+			for ( const spatial::Frustum& frustum : frustums )
+			{
+				for ( const auto& node : tree.GetLeaves() )
+				{
+					uint32_t planeMask;
+					if ( frustum.Classify( node->GetBoundingVolume(), spatial::Frustum::AllPlanes, planeMask ) != spatial::Containment::Outside )
+					{
+						count += node->GetNumElements();
+					}
+				}
+			}
+			gSink = gSink + float( count );
+		} );
+	results.push_back( result );
+
+	FlatOctree flat;
+	result.structure = "spatial::FlatOctree";
+	result.phase = "build";
+	result.stats = Measure( options.repetitions, [] {}, [&]() { flat.Build( tree ); } );
+	results.push_back( result );
+
+	result.phase = "leaf-walk";
+	result.stats = Measure( options.repetitions, [] {},
+		[&]()
+		{
+			// Centre on X, same as what the other structures compute
+			const float* mins = flat.GetLeafBoxes().mins[0].Data();
+			const float* maxs = flat.GetLeafBoxes().maxs[0].Data();
+
+			float sum = 0.0f;
+			for ( size_t i = 0; i < flat.GetNumLeaves(); i++ )
+			{
+				sum += (mins[i] + maxs[i]) * 0.5f;
+			}
+			gSink = gSink + sum;
+		} );
+	results.push_back( result );
+
+	result.phase = "element-walk";
+	result.stats = Measure( options.repetitions, [] {},
+		[&]()
+		{
+			adm::Vec3 sum;
+			for ( const adm::Vec3& point : flat.GetElements() )
+			{
+				sum += point;
+			}
+			gSink = gSink + sum.x + sum.y + sum.z;
+		} );
+	results.push_back( result );
+
+	result.phase = "box-query";
+	result.stats = Measure( options.repetitions, [] {},
+		[&]()
+		{
+			int64_t count = 0;
+			for ( const adm::AABB& query : queries )
+			{
+				count += CountInBox( flat, query );
+			}
+			gSink = gSink + float( count );
+		} );
+	results.push_back( result );
+
+	result.phase = "frustum-cull";
+	result.stats = Measure( options.repetitions, [] {},
+		[&]()
+		{
+			const auto offsets = flat.GetLeafOffsets();
+
+			int64_t count = 0;
+			for ( const spatial::Frustum& frustum : frustums )
+			{
+				flat.QueryFrustum( frustum, [&]( uint32_t firstLeaf, uint32_t endLeaf, spatial::Containment containment )
+					{
+						if ( containment != spatial::Containment::Outside )
+						{
+							count += offsets[endLeaf] - offsets[firstLeaf];
+						}
+					} );
+			}
+			gSink = gSink + float( count );
+		} );
+	results.push_back( result );
+
+	// Rays go in scanline order, so consecutive ones are neighbours and packets are coherent
+	result.phase = "raycast";
+	result.stats = Measure( options.repetitions, [] {},
+		[&]()
+		{
+			int64_t numHits = 0;
+			for ( const spatial::Ray& ray : rays )
+			{
+				numHits += flat.Raycast( ray, spatial::utils::RayHitsPoint(), spatial::utils::RayHitsPoint().radius ).IsHit();
+			}
+			gSink = gSink + float( numHits );
+		} );
+	results.push_back( result );
+
+	result.phase = "raycast-packet4";
+	result.stats = Measure( options.repetitions, [] {}, [&]() { gSink = gSink + float( RaycastPackets<4>( flat, rays ) ); } );
+	results.push_back( result );
+
+	result.phase = "raycast-packet8";
+	result.stats = Measure( options.repetitions, [] {}, [&]() { gSink = gSink + float( RaycastPackets<8>( flat, rays ) ); } );
+	results.push_back( result );
+
+	// Same queries one by one in random order, then as a batch that sorts them along a Morton curve first
+	constexpr size_t k = 8;
+	adm::Vector<spatial::Neighbour> neighbours( queryPoints.size() * k );
+	adm::Vector<uint32_t> neighbourCounts( queryPoints.size() );
+	spatial::QueryBatchScratch batchScratch;
+
+	result.phase = "knn8";
+	result.stats = Measure( options.repetitions, [] {},
+		[&]()
+		{
+			float sum = 0.0f;
+			for ( const adm::Vec3& point : queryPoints )
+			{
+				const size_t found = flat.FindKNearest( point, k, neighbours.data() );
+				sum += found ? neighbours[found - 1].distanceSquared : 0.0f;
+			}
+			gSink = gSink + sum;
+		} );
+	results.push_back( result );
+
+	result.phase = "knn8-batch";
+	result.stats = Measure( options.repetitions, [] {},
+		[&]()
+		{
+			flat.FindKNearestBatch( spatial::Span<const adm::Vec3>( queryPoints.data(), queryPoints.size() ), k,
+				neighbours.data(), neighbourCounts.data(), batchScratch );
+			gSink = gSink + float( neighbourCounts[0] );
+		} );
+	results.push_back( result );
+
+	// A fiftieth of the domain, a few dozen points in the uniform case at 1M
+	const float radius = (box.maxs.x - box.mins.x) * 0.02f;
+	result.phase = "radius";
+	result.stats = Measure( options.repetitions, [] {},
+		[&]()
+		{
+			int64_t count = 0;
+			for ( const adm::Vec3& point : queryPoints )
+			{
+				flat.ForEachWithinRadius( point, radius, [&]( uint32_t, float ) { count++; } );
+			}
+			gSink = gSink + float( count );
+		} );
+	results.push_back( result );
+
+	// Startup from a snapshot is a header check and a mapping, instead of a build
+	// Pages come in as queries touch them, so the cull afterwards pays for those
+	const std::string snapshotPath = (std::filesystem::temp_directory_path() / "octree-benchmark.snapshot").string();
+	result.phase = "snapshot-save";
+	result.stats = Measure( options.repetitions, [] {}, [&]() { flat.Save( snapshotPath.c_str() ); } );
+	results.push_back( result );
+
+	FlatOctree mapped;
+	result.phase = "snapshot-load";
+	result.stats = Measure( options.repetitions, [&]() { mapped = FlatOctree(); },
+		[&]()
+		{
+			if ( !mapped.Load( snapshotPath.c_str() ) )
+			{
+				std::cerr << "Couldn't load the snapshot back from " << snapshotPath << std::endl;
+			}
+		} );
+	results.push_back( result );
+
+	result.structure = "spatial::FlatOctree/mapped";
+	result.phase = "frustum-cull";
+	result.stats = Measure( options.repetitions, [] {},
+		[&]()
+		{
+			const auto offsets = mapped.GetLeafOffsets();
+
+			int64_t count = 0;
+			for ( const spatial::Frustum& frustum : frustums )
+			{
+				mapped.QueryFrustum( frustum, [&]( uint32_t firstLeaf, uint32_t endLeaf, spatial::Containment containment )
+					{
+						if ( containment != spatial::Containment::Outside )
+						{
+							count += offsets[endLeaf] - offsets[firstLeaf];
+						}
+					} );
+			}
+			gSink = gSink + float( count );
+		} );
+	results.push_back( result );
+
+	mapped = FlatOctree();
+	std::filesystem::remove( snapshotPath );
+}
+
+// Compares moving 1% of the points one by one, and all of them with Refit, against rebuilding everything
+// Small moves mostly stay in their leaf, big ones go through Remove and Insert
+static void BenchmarkIncremental( const Options& options, SpatialOctree& octree, const adm::Vector<adm::Vec3>& points,
+	const adm::AABB& box, const char* distributionName, Heuristic heuristic, adm::Vector<Result>& results )
+{
+	octree.SetElements( adm::Vector<adm::Vec3>( points ) );
+	octree.Rebuild();
+
+	Result result;
+	result.structure = "spatial::Tree/incremental";
+	result.distribution = distributionName;
+	result.heuristic = HeuristicName( heuristic );
+	result.numPoints = int64_t( points.size() );
+
+	const size_t numMoved = std::max<size_t>( 1, points.size() / 100 );
+	adm::Vector<uint32_t> movedIndices( numMoved );
+	adm::Vector<adm::Vec3> movedPoints( numMoved );
+
+	Random random;
+	const auto generateMoves = [&]( float distance )
+	{
+		for ( size_t i = 0; i < numMoved; i++ )
+		{
+			movedIndices[i] = random.Index( uint32_t( points.size() ) );
+
+			adm::Vec3 point = octree.GetElements()[movedIndices[i]] + adm::Vec3( random.Signed(), random.Signed(), random.Signed() ) * distance;
+			point.x = std::clamp( point.x, box.mins.x, box.maxs.x );
+			point.y = std::clamp( point.y, box.mins.y, box.maxs.y );
+			point.z = std::clamp( point.z, box.mins.z, box.maxs.z );
+			movedPoints[i] = point;
+		}
+	};
+
+	const auto applyMoves = [&]()
+	{
+		for ( size_t i = 0; i < numMoved; i++ )
+		{
+			octree.Update( movedIndices[i], movedPoints[i] );
+		}
+	};
+
+	random = Random( options.seed );
+
+	result.phase = "update-1pct-jitter";
+	result.stats = Measure( options.repetitions, [&]() { generateMoves( 0.01f ); }, applyMoves );
+	result.numNodes = octree.GetNodes().size();
+	result.numLeaves = octree.GetLeaves().size();
+	results.push_back( result );
+
+	result.phase = "update-1pct-scatter";
+	result.stats = Measure( options.repetitions, [&]() { generateMoves( box.Diagonal() ); }, applyMoves );
+	result.numNodes = octree.GetNodes().size();
+	result.numLeaves = octree.GetLeaves().size();
+	results.push_back( result );
+
+	// Removes 1% and puts them back in, so the tree ends up the same size every rep
+	result.phase = "remove-insert-1pct";
+	result.stats = Measure( options.repetitions, [&]() { generateMoves( 0.0f ); },
+		[&]()
+		{
+			std::sort( movedIndices.begin(), movedIndices.end() );
+			movedIndices.erase( std::unique( movedIndices.begin(), movedIndices.end() ), movedIndices.end() );
+
+			for ( const uint32_t& index : movedIndices )
+			{
+				octree.Remove( index );
+			}
+			// Freed slots are reused last-in first-out, so going backwards every point gets its own slot back
+			for ( auto it = movedIndices.rbegin(); it != movedIndices.rend(); ++it )
+			{
+				octree.Insert( adm::Vec3( octree.GetElements()[*it] ) );
+			}
+		} );
+	result.numNodes = octree.GetNodes().size();
+	result.numLeaves = octree.GetLeaves().size();
+	results.push_back( result );
+
+	// Every point moves a little, like a simulation step, compared to rebuilding from scratch
+	adm::Vector<adm::Vec3> refitPoints;
+	const auto generateRefit = [&]( float distance )
+	{
+		refitPoints = octree.GetElements();
+		for ( adm::Vec3& point : refitPoints )
+		{
+			point += adm::Vec3( random.Signed(), random.Signed(), random.Signed() ) * distance;
+			point.x = std::clamp( point.x, box.mins.x, box.maxs.x );
+			point.y = std::clamp( point.y, box.mins.y, box.maxs.y );
+			point.z = std::clamp( point.z, box.mins.z, box.maxs.z );
+		}
+	};
+
+	const auto measureRefit = [&]( const char* phase, float distance )
+	{
+		result.phase = phase;
+		result.stats = Measure( options.repetitions, [&]() { generateRefit( distance ); },
+			[&]() { octree.Refit( refitPoints ); } );
+		result.numNodes = octree.GetNodes().size();
+		result.numLeaves = octree.GetLeaves().size();
+		results.push_back( result );
+	};
+
+	measureRefit( "refit-all-jitter", 0.01f );
+	measureRefit( "refit-all-drift", 0.1f );
+}
+
+static bool ShouldRun( const Options& options, const char* structureName )
+{
+	return options.onlyStructure.empty() || options.onlyStructure == structureName;
+}
+
+// SAH BVH against the octrees on the same points, serial and parallel builds, then the same
+// box queries and camera rays as BenchmarkFlat. Returns false if the parallel build came out different
+static bool BenchmarkBvh( const Options& options, spatial::TaskPool& pool, const adm::Vector<adm::Vec3>& points,
+	const adm::AABB& box, const char* distributionName, adm::Vector<Result>& results )
+{
+	const adm::Vector<adm::AABB> queries = GenerateQueryBoxes( box, options.seed );
+	const adm::Vector<spatial::Ray> rays = GenerateCameraRays( box );
+
+	Result result;
+	result.structure = "spatial::Bvh";
+	result.distribution = distributionName;
+	result.heuristic = "sah";
+	result.numPoints = int64_t( points.size() );
+
+	const auto countLeaves = []( const auto& bvh )
+	{
+		return size_t( std::count_if( bvh.GetNodes().begin(), bvh.GetNodes().end(),
+			[]( const PointBvh::Node& node ) { return node.IsLeaf(); } ) );
+	};
+
+	PointBvh serial;
+	result.phase = "build";
+	result.stats = Measure( options.repetitions, [&]() { serial.SetElements( adm::Vector<adm::Vec3>( points ) ); },
+		[&]() { serial.Rebuild(); } );
+	result.numNodes = serial.GetNodes().size();
+	result.numLeaves = countLeaves( serial );
+	result.bytes = serial.GetMemoryUsage();
+	results.push_back( result );
+
+	result.phase = "box-query";
+	result.stats = Measure( options.repetitions, [] {},
+		[&]()
+		{
+			int64_t count = 0;
+			for ( const adm::AABB& query : queries )
+			{
+				serial.QueryBox( query, [&]( uint32_t ) { count++; } );
+			}
+			gSink = gSink + float( count );
+		} );
+	results.push_back( result );
+
+	result.phase = "raycast";
+	result.stats = Measure( options.repetitions, [] {},
+		[&]()
+		{
+			int64_t numHits = 0;
+			for ( const spatial::Ray& ray : rays )
+			{
+				numHits += serial.Raycast( ray, spatial::utils::RayHitsPoint(), spatial::utils::RayHitsPoint().radius ).IsHit();
+			}
+			gSink = gSink + float( numHits );
+		} );
+	results.push_back( result );
+
+	if ( !ShouldRun( options, "spatial::Bvh/parallel" ) )
+	{
+		return true;
+	}
+
+	PointBvh parallel;
+	result.structure = "spatial::Bvh/parallel";
+	result.phase = "build";
+	result.stats = Measure( options.repetitions, [&]() { parallel.SetElements( adm::Vector<adm::Vec3>( points ) ); },
+		[&]() { parallel.Rebuild( pool ); } );
+	result.numNodes = parallel.GetNodes().size();
+	result.numLeaves = countLeaves( parallel );
+	result.bytes = parallel.GetMemoryUsage();
+	results.push_back( result );
+
+	if ( !parallel.IsIdenticalTo( serial ) )
+	{
+		std::cerr << "Parallel BVH differs from the serial one! (" << distributionName << ", " << points.size() << " points)" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+// Boxes of all sizes up to a few leaves across, centred on the points
+static adm::Vector<adm::AABB> GenerateBoxes( const adm::Vector<adm::Vec3>& points, unsigned int seed )
+{
+	Random random( seed );
+	adm::Vector<adm::AABB> boxes( points.size() );
+	for ( size_t i = 0; i < points.size(); i++ )
+	{
+		const adm::Vec3 halfSize( 0.02f + random.Float() * 0.18f, 0.02f + random.Float() * 0.18f, 0.02f + random.Float() * 0.18f );
+		boxes[i] = { points[i] - halfSize, points[i] + halfSize };
+	}
+
+	return boxes;
+}
+
+// Boxes pile up wherever they overlap, so more than 40 of them can share a spot however far
+// down the tree goes, and without a depth limit those spots get split all the way down to Tree::MaxDepth
+static bool ShouldSubdivideBoxes( const BoxOctree::NodeType& node )
+{
+	return node.GetNumElements() > 40 && node.GetDepth() < 6;
+}
+
+static int64_t CountInBox( const BoxOctree& octree, const adm::AABB& query, adm::Vector<uint32_t>& lastSeen, uint32_t queryId )
+{
+	const auto& nodes = octree.GetNodes();
+
+	int64_t count = 0;
+	int32_t stack[64 * 8];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+	while ( stackSize > 0 )
+	{
+		const auto& node = nodes[stack[--stackSize]];
+		if ( !Overlaps( node.GetBoundingVolume(), query ) )
+		{
+			continue;
+		}
+
+		if ( !node.IsLeaf() )
+		{
+			for ( int32_t c = 0; c < 8; c++ )
+			{
+				stack[stackSize++] = node.GetFirstChild() + c;
+			}
+			continue;
+		}
+
+		// Boxes are in every leaf they touch, so they'd get counted once per leaf otherwise
+		const auto elements = node.GetElementSpan();
+		const auto indices = node.GetElementIndices();
+		for ( size_t i = 0; i < elements.Size(); i++ )
+		{
+			if ( lastSeen[indices[i]] != queryId && Overlaps( elements[i], query ) )
+			{
+				lastSeen[indices[i]] = queryId;
+				count++;
+			}
+		}
+	}
+
+	return count;
+}
+
+// Past this, the pairs themselves take gigabytes, clustered points especially
+static constexpr size_t MaxPairPoints = 1000000;
+
+// Every pair of points closer than a radius that gives each point about 4 neighbours
+// The density comes from the non-empty leaves, so clusters don't end up with thousands each
+// Returns false if the parallel run finds different pairs than the serial one
+static bool BenchmarkPairs( const Options& options, spatial::TaskPool& pool, const SpatialOctree& octree,
+	const char* distributionName, Heuristic heuristic, adm::Vector<Result>& results )
+{
+	float occupiedVolume = 0.0f;
+	for ( const auto& leaf : octree.GetLeaves() )
+	{
+		if ( leaf->GetNumElements() > 0 )
+		{
+			const adm::Vec3 size = leaf->GetBoundingVolume().maxs - leaf->GetBoundingVolume().mins;
+			occupiedVolume += size.x * size.y * size.z;
+		}
+	}
+
+	const float numElements = float( octree.GetNodes()[0].GetNumElements() );
+	const float radius = std::cbrt( 3.0f * 4.0f * occupiedVolume / (4.0f * 3.14159265f * numElements) );
+	const spatial::utils::PointsWithinRadius pairTest{ radius };
+
+	Result result;
+	result.structure = "spatial::Tree/pairs";
+	result.distribution = distributionName;
+	result.heuristic = HeuristicName( heuristic );
+	result.numPoints = int64_t( numElements );
+	result.numNodes = octree.GetNodes().size();
+	result.numLeaves = octree.GetLeaves().size();
+
+	spatial::PairFinder finder;
+	adm::Vector<spatial::ElementPair> serialPairs;
+	result.phase = "radius-pairs";
+	result.stats = Measure( options.repetitions, [] {}, [&]() { finder.Find( octree, pairTest, radius, serialPairs ); } );
+	result.bytes = serialPairs.capacity() * sizeof( spatial::ElementPair );
+	results.push_back( result );
+
+	adm::Vector<spatial::ElementPair> parallelPairs;
+	result.phase = "radius-pairs-parallel";
+	result.stats = Measure( options.repetitions, [] {}, [&]() { finder.Find( octree, pairTest, radius, parallelPairs, &pool ); } );
+	result.bytes = parallelPairs.capacity() * sizeof( spatial::ElementPair );
+	results.push_back( result );
+
+	std::sort( serialPairs.begin(), serialPairs.end() );
+	std::sort( parallelPairs.begin(), parallelPairs.end() );
+	if ( serialPairs != parallelPairs )
+	{
+		std::cerr << "Parallel pair finding differs from the serial one! (" << distributionName << ", "
+			<< HeuristicName( heuristic ) << ", " << numElements << " points)" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+// Boxes in a tree that copies them into every leaf they touch, against a loose octree
+// that keeps every box in exactly one node
+static void BenchmarkBoxes( const Options& options, const adm::Vector<adm::Vec3>& points, const adm::AABB& box,
+	const char* distributionName, adm::Vector<Result>& results )
+{
+	const adm::Vector<adm::AABB> boxes = GenerateBoxes( points, options.seed );
+	const adm::Vector<adm::AABB> queries = GenerateQueryBoxes( box, options.seed );
+
+	const size_t numMoved = std::max<size_t>( 1, boxes.size() / 100 );
+	adm::Vector<uint32_t> movedIndices( numMoved );
+	adm::Vector<adm::AABB> movedBoxes( numMoved );
+	Random random;
+	const auto generateMoves = [&]( const adm::Vector<adm::AABB>& current )
+	{
+		for ( size_t i = 0; i < numMoved; i++ )
+		{
+			movedIndices[i] = random.Index( uint32_t( boxes.size() ) );
+			const adm::Vec3 offset = adm::Vec3( random.Signed(), random.Signed(), random.Signed() ) * 0.05f;
+			movedBoxes[i] = { current[movedIndices[i]].mins + offset, current[movedIndices[i]].maxs + offset };
+		}
+	};
+
+	Result result;
+	result.distribution = distributionName;
+	result.numPoints = int64_t( boxes.size() );
+
+	if ( ShouldRun( options, "spatial::Tree/boxes" ) )
+	{
+		BoxOctree octree;
+		octree.Initialise( box, spatial::utils::BoxIntersectsAABB, spatial::utils::BoxOccupiesBox,
+			ShouldSubdivideBoxes, spatial::utils::GetAABBForChild );
+		octree.GetBuildArena().SetHugePages( gHugePages );
+
+		result.structure = "spatial::Tree/boxes";
+		result.heuristic = "threshold40-depth6";
+		result.phase = "build";
+		result.stats = Measure( options.repetitions, [&]() { octree.SetElements( adm::Vector<adm::AABB>( boxes ) ); },
+			[&]() { octree.Rebuild(); } );
+		result.numNodes = octree.GetNodes().size();
+		result.numLeaves = octree.GetLeaves().size();
+		result.bytes = octree.GetMemoryUsage();
+		results.push_back( result );
+
+		adm::Vector<uint32_t> lastSeen( boxes.size(), 0 );
+		uint32_t queryId = 0;
+		result.phase = "box-query";
+		result.stats = Measure( options.repetitions, [] {},
+			[&]()
+			{
+				int64_t count = 0;
+				for ( const adm::AABB& query : queries )
+				{
+					count += CountInBox( octree, query, lastSeen, ++queryId );
+				}
+				gSink = gSink + float( count );
+			} );
+		results.push_back( result );
+
+		spatial::PairFinder finder;
+		adm::Vector<spatial::ElementPair> pairs;
+		result.phase = "overlap-pairs";
+		result.stats = Measure( options.repetitions, [] {},
+			[&]()
+			{
+				finder.Find( octree, spatial::utils::BoxIntersectsAABB, 0.0f, pairs );
+				gSink = gSink + float( pairs.size() );
+			} );
+		results.push_back( result );
+
+		random = Random( options.seed );
+		result.phase = "update-1pct-jitter";
+		result.stats = Measure( options.repetitions, [&]() { generateMoves( octree.GetElements() ); },
+			[&]()
+			{
+				for ( size_t i = 0; i < numMoved; i++ )
+				{
+					octree.Update( movedIndices[i], movedBoxes[i] );
+				}
+			} );
+		result.numNodes = octree.GetNodes().size();
+		result.numLeaves = octree.GetLeaves().size();
+		result.bytes = octree.GetMemoryUsage();
+		results.push_back( result );
+	}
+
+	if ( ShouldRun( options, "spatial::Bvh/boxes" ) )
+	{
+		BoxBvh bvh;
+		result.structure = "spatial::Bvh/boxes";
+		result.heuristic = "sah";
+		result.phase = "build";
+		result.stats = Measure( options.repetitions, [&]() { bvh.SetElements( adm::Vector<adm::AABB>( boxes ) ); },
+			[&]() { bvh.Rebuild(); } );
+		result.numNodes = bvh.GetNodes().size();
+		result.numLeaves = size_t( std::count_if( bvh.GetNodes().begin(), bvh.GetNodes().end(),
+			[]( const BoxBvh::Node& node ) { return node.IsLeaf(); } ) );
+		result.bytes = bvh.GetMemoryUsage();
+		results.push_back( result );
+
+		result.phase = "box-query";
+		result.stats = Measure( options.repetitions, [] {},
+			[&]()
+			{
+				int64_t count = 0;
+				for ( const adm::AABB& query : queries )
+				{
+					bvh.QueryBox( query, [&]( uint32_t ) { count++; } );
+				}
+				gSink = gSink + float( count );
+			} );
+		results.push_back( result );
+	}
+
+	if ( ShouldRun( options, "spatial::LooseOctree" ) )
+	{
+		LooseOctree octree;
+		octree.Initialise( box, 2.0f );
+
+		const auto countLeaves = [&]()
+		{
+			return size_t( std::count_if( octree.GetNodes().begin(), octree.GetNodes().end(),
+				[]( const LooseOctree::Node& node ) { return node.IsLeaf(); } ) );
+		};
+
+		result.structure = "spatial::LooseOctree";
+		result.heuristic = "looseness2";
+		result.phase = "build";
+		result.stats = Measure( options.repetitions, [] {}, [&]() { octree.SetElements( adm::Vector<adm::AABB>( boxes ) ); } );
+		result.numNodes = octree.GetNodes().size();
+		result.numLeaves = countLeaves();
+		result.bytes = octree.GetMemoryUsage();
+		results.push_back( result );
+
+		result.phase = "box-query";
+		result.stats = Measure( options.repetitions, [] {},
+			[&]()
+			{
+				int64_t count = 0;
+				for ( const adm::AABB& query : queries )
+				{
+					octree.QueryBox( query, [&]( uint32_t ) { count++; } );
+				}
+				gSink = gSink + float( count );
+			} );
+		results.push_back( result );
+
+		random = Random( options.seed );
+		result.phase = "update-1pct-jitter";
+		result.stats = Measure( options.repetitions, [&]() { generateMoves( octree.GetElements() ); },
+			[&]()
+			{
+				for ( size_t i = 0; i < numMoved; i++ )
+				{
+					octree.Update( movedIndices[i], movedBoxes[i] );
+				}
+			} );
+		result.numNodes = octree.GetNodes().size();
+		result.numLeaves = countLeaves();
+		result.bytes = octree.GetMemoryUsage();
+		results.push_back( result );
+	}
+}
+
+// The serial build again, with the callbacks inlined instead of going through std::function
+// Returns false if it came out different from the callback version
+template<typename PolicyType>
+static bool BenchmarkPolicy( const Options& options, SpatialOctree& serial, const adm::Vector<adm::Vec3>& points, const adm::AABB& box,
+	const char* distributionName, Heuristic heuristic, adm::Vector<Result>& results )
+{
+	spatial::PolicyOctree<adm::Vec3, PolicyType> octree;
+	octree.Initialise( box );
+	octree.GetBuildArena().SetHugePages( gHugePages );
+	BenchmarkTree( options, "spatial::Tree/policy", octree, [&]() { octree.Rebuild(); },
+		points, distributionName, heuristic, results );
+
+	if ( serial.GetNodes().empty() )
+	{
+		serial.SetElements( adm::Vector<adm::Vec3>( points ) );
+		serial.Rebuild();
+	}
+
+	if ( !serial.IsIdenticalTo( octree ) )
+	{
+		std::cerr << "Policy build differs from the callback build! (" << distributionName << ", "
+			<< HeuristicName( heuristic ) << ", " << points.size() << " points)" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+// Returns false if the parallel or policy build came out different from the serial one
+static bool BenchmarkAll( const Options& options, spatial::TaskPool& pool, const adm::Vector<adm::Vec3>& points, const adm::AABB& box,
+	const char* distributionName, Heuristic heuristic, adm::Vector<Result>& results )
+{
+	if ( ShouldRun( options, "adm::NTree" ) )
+	{
+		AdmOctree octree;
+		InitialiseOctree( octree, box, heuristic );
+		BenchmarkTree( options, "adm::NTree", octree, [&]() { octree.Rebuild(); },
+			points, distributionName, heuristic, results );
+	}
+
+	const bool runSerial = ShouldRun( options, "spatial::Tree" );
+	const bool runParallel = ShouldRun( options, "spatial::Tree/parallel" );
+
+	SpatialOctree serial;
+	InitialiseOctree( serial, box, heuristic );
+	if ( runSerial )
+	{
+		BenchmarkTree( options, "spatial::Tree", serial, [&]() { serial.Rebuild(); },
+			points, distributionName, heuristic, results );
+	}
+
+	if ( runSerial || ShouldRun( options, "spatial::FlatOctree" ) )
+	{
+		if ( !runSerial )
+		{
+			serial.SetElements( adm::Vector<adm::Vec3>( points ) );
+			serial.Rebuild();
+		}
+
+		BenchmarkFlat( options, serial, box, distributionName, heuristic, results );
+	}
+
+	if ( runParallel )
+	{
+		SpatialOctree parallel;
+		InitialiseOctree( parallel, box, heuristic );
+		BenchmarkTree( options, "spatial::Tree/parallel", parallel, [&]() { parallel.Rebuild( pool ); },
+			points, distributionName, heuristic, results );
+
+		if ( serial.GetNodes().empty() )
+		{
+			serial.SetElements( adm::Vector<adm::Vec3>( points ) );
+			serial.Rebuild();
+		}
+
+		if ( !parallel.IsIdenticalTo( serial ) )
+		{
+			std::cerr << "Parallel build differs from the serial build! (" << distributionName << ", "
+				<< HeuristicName( heuristic ) << ", " << points.size() << " points)" << std::endl;
+			return false;
+		}
+	}
+
+	if ( ShouldRun( options, "spatial::Tree/policy" ) )
+	{
+		const bool identical = heuristic == Heuristic::Threshold40
+			? BenchmarkPolicy<Threshold40Policy>( options, serial, points, box, distributionName, heuristic, results )
+			: BenchmarkPolicy<DensityPolicy>( options, serial, points, box, distributionName, heuristic, results );
+		if ( !identical )
+		{
+			return false;
+		}
+	}
+
+	if ( ShouldRun( options, "spatial::Tree/pairs" ) && points.size() <= MaxPairPoints )
+	{
+		if ( serial.GetNodes().empty() )
+		{
+			serial.SetElements( adm::Vector<adm::Vec3>( points ) );
+			serial.Rebuild();
+		}
+
+		if ( !BenchmarkPairs( options, pool, serial, distributionName, heuristic, results ) )
+		{
+			return false;
+		}
+	}
+
+	if ( ShouldRun( options, "spatial::Tree/morton" ) )
+	{
+		SpatialOctree morton;
+		InitialiseOctree( morton, box, heuristic );
+		const spatial::morton::PointEncoder encoder( box );
+		BenchmarkTree( options, "spatial::Tree/morton", morton, [&]() { morton.RebuildMorton( encoder ); },
+			points, distributionName, heuristic, results );
+	}
+
+	if ( ShouldRun( options, "spatial::Tree/incremental" ) )
+	{
+		SpatialOctree incremental;
+		InitialiseOctree( incremental, box, heuristic );
+		BenchmarkIncremental( options, incremental, points, box, distributionName, heuristic, results );
+	}
+
+	// None of these have a say in subdividing by density, so they only run once per distribution
+	if ( heuristic == Heuristic::Threshold40 )
+	{
+		if ( ShouldRun( options, "spatial::Bvh" ) || ShouldRun( options, "spatial::Bvh/parallel" ) )
+		{
+			if ( !BenchmarkBvh( options, pool, points, box, distributionName, results ) )
+			{
+				return false;
+			}
+		}
+
+		BenchmarkBoxes( options, points, box, distributionName, results );
+	}
+
+	return true;
+}
+
+static void WriteCsv( std::ostream& out, const Options& options, const adm::Vector<Result>& results )
+{
+	out << "label,structure,distribution,heuristic,points,phase,nodes,leaves,samples,min_ms,median_ms,p90_ms,p99_ms,max_ms,mean_ms,allocations,bytes\n";
+	for ( const Result& r : results )
+	{
+		out << options.label << ',' << r.structure << ',' << r.distribution << ',' << r.heuristic << ','
+			<< r.numPoints << ',' << r.phase << ',' << r.numNodes << ',' << r.numLeaves << ','
+			<< r.stats.samples << ',' << r.stats.min << ',' << r.stats.median << ',' << r.stats.p90 << ','
+			<< r.stats.p99 << ',' << r.stats.max << ',' << r.stats.mean << ',' << r.stats.allocations << ',' << r.bytes << '\n';
+	}
+}
+
+static void WriteJson( std::ostream& out, const Options& options, const adm::Vector<Result>& results )
+{
+	out << "{\n  \"label\": \"" << options.label << "\",\n  \"results\": [\n";
+	for ( size_t i = 0; i < results.size(); i++ )
+	{
+		const Result& r = results[i];
+		out << "    { \"structure\": \"" << r.structure << "\", \"distribution\": \"" << r.distribution
+			<< "\", \"heuristic\": \"" << r.heuristic << "\", \"points\": " << r.numPoints
+			<< ", \"phase\": \"" << r.phase << "\", \"nodes\": " << r.numNodes << ", \"leaves\": " << r.numLeaves
+			<< ", \"samples\": " << r.stats.samples << ", \"min_ms\": " << r.stats.min
+			<< ", \"median_ms\": " << r.stats.median << ", \"p90_ms\": " << r.stats.p90
+			<< ", \"p99_ms\": " << r.stats.p99 << ", \"max_ms\": " << r.stats.max
+			<< ", \"mean_ms\": " << r.stats.mean << ", \"allocations\": " << r.stats.allocations << ", \"bytes\": " << r.bytes
+			<< " }" << (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	out << "  ]\n}\n";
+}
+
+static void PrintUsage()
+{
+	std::cout << "Usage: OctreeBenchmark [options]\n"
+		<< "  --min-points N       smallest point count (default 1000)\n"
+		<< "  --max-points N       largest point count, goes up in powers of 10 (default 100000000)\n"
+		<< "  --reps N             repetitions per phase (default 5)\n"
+		<< "  --seed N             RNG seed for the point sets\n"
+		<< "  --threads N          worker threads for parallel builds (default: all)\n"
+		<< "  --huge-pages         back spatial::Tree build arenas with transparent huge pages (Linux)\n"
+		<< "  --structure NAME     only run adm::NTree, spatial::Tree, spatial::Tree/parallel\n"
+		<< "                       spatial::Tree/policy, spatial::Tree/morton, spatial::Tree/incremental,\n"
+		<< "                       spatial::Tree/pairs, spatial::FlatOctree, spatial::Tree/boxes,\n"
+		<< "                       spatial::LooseOctree, spatial::Bvh, spatial::Bvh/parallel or spatial::Bvh/boxes\n"
+		<< "  --distribution NAME  only run uniform, shell or clustered\n"
+		<< "  --heuristic NAME     only run threshold40 or density\n"
+		<< "  --label TEXT         tag written into every row, e.g. a git revision\n"
+		<< "  --csv PATH           write CSV here (default: stdout)\n"
+		<< "  --json PATH          write JSON here\n";
+}
+
+// The whole string has to be a whole number from min to max. Exponents and hex are fine,
+// so 1e6 and 0x910583 both work
+static bool ParseWholeNumber( const char* option, const char* text, double min, double max, double& outValue )
+{
+	char* end = nullptr;
+	const double value = std::strtod( text, &end );
+	if ( end == text || *end != '\0' || !(value >= min && value <= max) || value != std::floor( value ) )
+	{
+		std::cerr << option << " has to be a whole number from " << std::fixed << std::setprecision( 0 )
+			<< min << " to " << max << ", not " << text << std::endl;
+		return false;
+	}
+
+	outValue = value;
+	return true;
+}
+
+static bool ParseOptions( int argc, char** argv, Options& options )
+{
+	for ( int i = 1; i < argc; i++ )
+	{
+		const char* arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+
+		if ( !strcmp( arg, "--help" ) || !strcmp( arg, "-h" ) )
+		{
+			return false;
+		}
+		else if ( !strcmp( arg, "--huge-pages" ) )
+		{
+			options.hugePages = true;
+			continue;
+		}
+		else if ( !hasValue )
+		{
+			std::cerr << "Missing value for " << arg << std::endl;
+			return false;
+		}
+
+		const char* value = argv[++i];
+		double number = 0.0;
+		if ( !strcmp( arg, "--min-points" ) || !strcmp( arg, "--max-points" ) )
+		{
+			// The sweep multiplies by 10 each step, it'd never get anywhere from 0,
+			// and GeneratePoints takes an int
+			if ( !ParseWholeNumber( arg, value, 1.0, double( INT_MAX ), number ) )
+			{
+				return false;
+			}
+
+			int64_t& bound = !strcmp( arg, "--min-points" ) ? options.minPoints : options.maxPoints;
+			bound = int64_t( number );
+		}
+		else if ( !strcmp( arg, "--reps" ) )
+		{
+			if ( !ParseWholeNumber( arg, value, 1.0, double( INT_MAX ), number ) )
+			{
+				return false;
+			}
+			options.repetitions = int( number );
+		}
+		else if ( !strcmp( arg, "--threads" ) )
+		{
+			if ( !ParseWholeNumber( arg, value, 0.0, double( INT_MAX ), number ) )
+			{
+				return false;
+			}
+			options.numThreads = int( number );
+		}
+		else if ( !strcmp( arg, "--structure" ) )
+		{
+			options.onlyStructure = value;
+		}
+		else if ( !strcmp( arg, "--seed" ) )
+		{
+			if ( !ParseWholeNumber( arg, value, 0.0, double( UINT_MAX ), number ) )
+			{
+				return false;
+			}
+			options.seed = unsigned( number );
+		}
+		else if ( !strcmp( arg, "--distribution" ) )
+		{
+			options.onlyDistribution = value;
+		}
+		else if ( !strcmp( arg, "--heuristic" ) )
+		{
+			options.onlyHeuristic = value;
+		}
+		else if ( !strcmp( arg, "--label" ) )
+		{
+			options.label = value;
+		}
+		else if ( !strcmp( arg, "--csv" ) )
+		{
+			options.csvPath = value;
+		}
+		else if ( !strcmp( arg, "--json" ) )
+		{
+			options.jsonPath = value;
+		}
+		else
+		{
+			std::cerr << "Unknown option " << arg << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int main( int argc, char** argv )
+{
+	Options options;
+	if ( !ParseOptions( argc, argv, options ) )
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	// Same 20x20x20 box as OctreeExperiment
+	const adm::AABB box = { adm::Vec3( 0.0f ), adm::Vec3( 20.0f ) };
+
+	gHugePages = options.hugePages;
+
+	spatial::TaskPool pool( options.numThreads );
+	std::cerr << "Using " << pool.GetNumThreads() << " worker threads" << std::endl;
+
+	bool identical = true;
+	adm::Vector<Result> results;
+	for ( int64_t numPoints = options.minPoints; numPoints <= options.maxPoints; numPoints *= 10 )
+	{
+		for ( const Distribution& distribution : Distributions )
+		{
+			const char* distributionName = DistributionName( distribution );
+			if ( !options.onlyDistribution.empty() && options.onlyDistribution != distributionName )
+			{
+				continue;
+			}
+
+			std::cerr << "Generating " << numPoints << " " << distributionName << " points..." << std::endl;
+			const auto generateStart = steady_clock::now();
+			const adm::Vector<adm::Vec3> points = GeneratePoints( distribution, int( numPoints ), box, options.seed, &pool );
+			std::cerr << "  took " << duration<double, std::milli>( steady_clock::now() - generateStart ).count() << " ms" << std::endl;
+
+			for ( const Heuristic& heuristic : Heuristics )
+			{
+				const char* heuristicName = HeuristicName( heuristic );
+				if ( !options.onlyHeuristic.empty() && options.onlyHeuristic != heuristicName )
+				{
+					continue;
+				}
+
+				std::cerr << "  " << heuristicName << std::endl;
+				identical &= BenchmarkAll( options, pool, points, box, distributionName, heuristic, results );
+			}
+		}
+	}
+
+	if ( options.csvPath.empty() )
+	{
+		WriteCsv( std::cout, options, results );
+	}
+	else
+	{
+		std::ofstream csv( options.csvPath );
+		WriteCsv( csv, options, results );
+	}
+
+	if ( !options.jsonPath.empty() )
+	{
+		std::ofstream json( options.jsonPath );
+		WriteJson( json, options, results );
+	}
+
+	return identical ? 0 : 1;
+}
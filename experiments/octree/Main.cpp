@@ -1,142 +1,276 @@
 
 #include "experiments/common/IApplication.hpp"
+#include "experiments/common/TripleBuffer.hpp"
+#include "experiments/common/Zones.hpp"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/euler_angles.hpp>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <Precompiled.hpp>
-
-// Random numbor between 0 and 1
-float frand()
-{
-	return float( rand() & 32767 ) / 32767.0f;
-};
-// Random numbor between -1 and 1
-float crand()
-{
-	return frand() * 2.0f - 1.0f;
-};
-// Random vector between min and max
-adm::Vec3 randVec( adm::Vec3 min, adm::Vec3 max )
-{
-	const adm::Vec3 centre = (min + max) * 0.5f;
-	const adm::Vec3 extent = max - centre;
-	return centre + adm::Vec3(
-		crand() * extent.x * 0.9f,
-		crand() * extent.y * 0.9f,
-		crand() * extent.z * 0.9f
-	);
-};
+#include "experiments/octree/Scenarios.hpp"
+#include "experiments/spatial/FlatOctree.hpp"
 
 class OctreeExperiment : public IApplication
 {
 public:
 	bool Init() override
 	{
+		ProfileZone( "OctreeExperiment::Init" );
 		using namespace adm;
 
-		viewMatrix = glm::identity<glm::mat4>();
-		projectionMatrix = glm::perspective( glm::radians( 90.0f ), 16.0f / 9.0f, 0.01f, 1024.0f );
-		viewProjectionMatrix = viewMatrix;
-
-		// 20x20x20 units
-		const AABB octreeBox = { Vec3( 0.0f ), Vec3( 20.0f ) };
-
-		const auto shouldSubdivide = []( const adm::Octree<adm::Vec3>::NodeType& node )
-		{	// This is our threshold. If there's more than 50 elements inside a node,
-			// it'll be subdivided
-			//return node.GetNumElements() > 50;
-			
-			// Alternative heuristic: reverse density and distance from centre
-			const int32_t& numElements = node.GetNumElements();
-			
-			const adm::Vec3 nodeCentre = node.GetBoundingVolume().GetCentre();
-			adm::Vec3 averageCentre;
-			node.ForEachElement( [&]( adm::Vec3* element )
-				{
-					averageCentre += *element;
-				} );
-			averageCentre /= float( numElements );
+		projectionMatrix = MakeProjection( viewportWidth, viewportHeight );
+		viewProjectionMatrix = glm::identity<glm::mat4>();
+
+		const AABB octreeBox = { Vec3( 0.0f ), Vec3( OctreeSize ) };
+
+		octree.Initialise( octreeBox,
+			spatial::utils::IntersectsAABB,
+			spatial::utils::OccupiesBox,
+			//ShouldSubdivideByDensity<spatial::Octree<Vec3>::NodeType>,
+			spatial::utils::SimpleThreshold<adm::Vec3, LeafThreshold>,
+			spatial::utils::GetAABBForChild );
+
+		adm::Timer timer;
+
+		// A snapshot from a previous run with the same settings skips generating and building altogether.
+		// Not when there are stats to write though, a mapped snapshot has no tree to take them from
+		if ( snapshotPath && statsPath )
+		{
+			std::cout << "--stats needs the tree built, so " << snapshotPath << " is rebuilt instead of mapped" << std::endl;
+		}
+		else if ( snapshotPath && LoadSnapshot() )
+		{
+			std::cout << "Took " << timer.GetElapsed() << " ms to map " << snapshotPath << std::endl;
+			statsLines = { std::string( "Tree stats: none, mapped from " ) + snapshotPath };
+			PickLeafColours();
+			return true;
+		}
+
+		{
+			ProfileZone( "GeneratePoints" );
+			Vector<Vec3> points = GeneratePoints( PointDistribution, NumPoints, octreeBox, Seed, &taskPool );
+
+			octree.SetElements( std::move( points ) );
+		}
+
+		float spawningMs = timer.GetElapsedAndReset();
+
+		Rebuild();
+
+		float buildingMs = timer.GetElapsedAndReset();
 
-			const float diagonal = node.GetBoundingVolume().Diagonal();
-			const float density = float( numElements ) / diagonal;
-			const float relativeDistanceFromCentre = (nodeCentre - averageCentre).Length() / (diagonal * 0.5f);
+		{
+			ProfileZone( "FlatOctree::Build" );
+			// Render only reads the tree, so it walks a flattened copy that's nicer on the cache
+			flatOctree.Build( octree );
+		}
+
+		float flatteningMs = timer.GetElapsed();
 
-			if ( numElements > 500 )
+		std::cout << "Took " << spawningMs << " ms to populate, " << buildingMs << " ms to build the octree, "
+			<< flatteningMs << " ms to flatten it" << std::endl;
+
+		// The tree doesn't change after this, so the overlay text is made once
+		const spatial::TreeStats stats = octree.GetStats();
+		if ( statsPath )
+		{
+			std::ofstream statsFile( statsPath );
+			stats.WriteJson( statsFile );
+			if ( !statsFile )
 			{
-				return true;
+				std::cout << "Couldn't write " << statsPath << std::endl;
 			}
-			if ( diagonal < 4.0f )
+		}
+		FormatStats( stats );
+
+		if ( snapshotPath && !SaveSnapshot() )
+		{
+			std::cout << "Couldn't save " << snapshotPath << std::endl;
+		}
+
+		PickLeafColours();
+		return true;
+	}
+
+	int ParseOption( int i, int argc, char** argv ) override
+	{
+		if ( !std::strcmp( argv[i], "--stats" ) && i + 1 < argc )
+		{
+			statsPath = argv[i + 1];
+			return 2;
+		}
+
+		if ( !std::strcmp( argv[i], "--snapshot" ) && i + 1 < argc )
+		{
+			snapshotPath = argv[i + 1];
+			return 2;
+		}
+
+		return 0;
+	}
+
+	// Main thread, the simulation thread gets the size through its UserCommands instead
+	void SetViewportSize( int width, int height ) override
+	{
+		viewportWidth = width;
+		viewportHeight = height;
+		projectionMatrix = MakeProjection( width, height );
+	}
+
+	const char* GetOptionsUsage() const override
+	{
+		return "  --stats PATH        write the octree's TreeStats to PATH as JSON, always builds the tree\n"
+			"  --snapshot PATH     map the flattened octree from PATH if it was saved with the same settings,\n"
+			"                      otherwise build it and save it there\n";
+	}
+
+	void Rebuild()
+	{
+		ProfileZone( "OctreeExperiment::Rebuild" );
+		octree.Rebuild( taskPool );
+		// Or sort by Morton code and build linearly, points on child boundaries won't be duplicated then
+		//octree.RebuildMorton( spatial::morton::PointEncoder( adm::AABB{ adm::Vec3( 0.0f ), adm::Vec3( OctreeSize ) } ) );
+	}
+
+	// Everything the tree is made from, hashed (FNV-1a), so changing any of it makes the snapshot stale
+	static uint64_t GetSnapshotKey()
+	{
+		const uint64_t settings[] =
+		{
+			SnapshotKeyVersion, uint64_t( NumPoints ), uint64_t( PointDistribution ), Seed,
+			uint64_t( LeafThreshold ), uint64_t( OctreeSize * 1000.0f )
+		};
+
+		uint64_t key = 0xcbf29ce484222325;
+		for ( const uint64_t& setting : settings )
+		{
+			for ( size_t byte = 0; byte < sizeof( setting ); byte++ )
 			{
-				return false;
+				key = (key ^ ((setting >> (byte * 8)) & 0xff)) * 0x100000001b3;
 			}
+		}
 
-			return relativeDistanceFromCentre > 0.3f || density < 0.6f;
-		};
+		return key;
+	}
 
-		octree.Initialise( octreeBox,
-			adm::utils::IntersectsAABB,
-			adm::utils::OccupiesBox,
-			//shouldSubdivide,
-			adm::utils::SimpleThreshold<adm::Vec3, 40>,
-			adm::utils::GetAABBForChild );
+	bool LoadSnapshot()
+	{
+		ProfileZone( "FlatOctree::Load" );
+		return flatOctree.Load( snapshotPath, GetSnapshotKey() );
+	}
 
-		srand( 0x910583 );
+	bool SaveSnapshot()
+	{
+		ProfileZone( "FlatOctree::Save" );
+		return flatOctree.Save( snapshotPath, GetSnapshotKey() );
+	}
 
-		const auto canSpawnHere = []( const Vec3& point ) -> bool
+	void FormatStats( const spatial::TreeStats& stats )
+	{
+		std::ostringstream line;
+		line << std::fixed << std::setprecision( 2 );
+		const auto nextLine = [&]()
 		{
-			// The closer the point is to 0,0,0, the less chance it'll spawn
-			const float threshold = 10.0f + frand() * 8.0f;
-			// Similarly there's another disc out there
-			const float otherThreshold = 30.0f + frand() * 5.0f;
-			const float pointDistance = point.Length();
-			
-			return pointDistance > threshold 
-				&& std::abs(otherThreshold - pointDistance) > 10.0f
-				&& point.z < 7.0f + frand() * 10.0f;
+			statsLines.push_back( line.str() );
+			line.str( "" );
 		};
 
-		adm::Timer timer;
+		line << "Nodes: " << stats.numNodes << ", leaves: " << stats.numLeaves << " ("
+			<< stats.GetEmptyLeafRatio() * 100.0f << "% empty), max depth: " << stats.maxDepth
+			<< ", elements per leaf: " << stats.GetAverageLeafElements() << " avg, " << stats.maxLeafElements << " max";
+		nextLine();
 
-		constexpr int numPoints = 2500;
-		Vector<Vec3> points;
-		points.reserve( numPoints );
-		for ( int i = 0; i < numPoints; i++ )
+		line << "Nodes per depth:";
+		for ( const uint32_t& count : stats.nodesPerDepth )
 		{
-			Vec3 point = randVec( octreeBox.mins, octreeBox.maxs );
-			if ( canSpawnHere( point ) )
+			line << " " << count;
+		}
+		nextLine();
+
+		// Buckets past the fullest leaf are all zeroes
+		size_t numBuckets = spatial::TreeStats::GetOccupancyBucket( stats.maxLeafElements ) + 1;
+		line << "Leaf occupancy:";
+		for ( size_t bucket = 0; bucket < numBuckets; bucket++ )
+		{
+			const size_t low = bucket > 0 ? size_t( 1 ) << (bucket - 1) : 0;
+			const size_t high = bucket > 0 ? (size_t( 1 ) << bucket) - 1 : 0;
+			line << " [" << low;
+			if ( bucket + 1 == spatial::TreeStats::NumOccupancyBuckets )
 			{
-				points.push_back( point );
+				line << "+";
 			}
-			else
+			else if ( high > low )
 			{
-				i--;
+				line << "-" << high;
 			}
+			line << "]: " << stats.occupancy[bucket];
 		}
+		nextLine();
 
-		octree.SetElements( std::move( points ) );
+		line << "Memory: nodes " << stats.nodeBytes / 1024.0f << " KiB, elements " << stats.elementBytes / 1024.0f
+			<< " KiB, build arena " << stats.arenaBytes / 1024.0f << " KiB";
+		nextLine();
 
-		float spawningMs = timer.GetElapsedAndReset();
+		const spatial::BuildTimings& timings = stats.timings;
+		line << "Build: gather " << timings.gather << " ms, ";
+		if ( timings.sort > 0.0f )
+		{
+			line << "sort " << timings.sort << " ms, ";
+		}
+		line << "subdivide " << timings.subdivide << " ms, finish " << timings.finish
+			<< " ms, total " << timings.total << " ms";
+		nextLine();
+	}
 
-		octree.Rebuild();
+	// Colours are picked per leaf up-front, so they don't shuffle around as leaves get culled
+	void PickLeafColours()
+	{
+		using namespace adm;
 
-		float buildingMs = timer.GetElapsed();
+		Random random( 0x24819 );
+		leafColours.resize( flatOctree.GetNumLeaves() );
+		for ( Vec3& colour : leafColours )
+		{
+			colour = Vec3(
+				(0.5f + random.Signed() * 0.4f)/* * random.Float() */,
+				(0.5f + random.Signed() * 0.4f)/* * random.Float() */,
+				(0.5f + random.Signed() * 0.4f)/* * random.Float() */
+			).Normalized();
+		}
+	}
 
-		std::cout << "Took " << spawningMs << " ms to populate, " << buildingMs << " ms to build the octree" << std::endl;
+	void Shutdown() override
+	{
 
-		return true;
 	}
 
-	void Shutdown() override
+	// A camera's axes and matrices, from where it is and where it's looking
+	struct View
 	{
+		glm::vec3 forward;
+		glm::vec3 right;
+		glm::vec3 up;
+		glm::mat4 viewProjectionMatrix;
+	};
 
+	static glm::mat4 MakeProjection( int width, int height )
+	{
+		return glm::perspective( glm::radians( 90.0f ), float( width ) / float( std::max( height, 1 ) ), 0.01f, 1024.0f );
 	}
 
-	void UpdateViewMatrix()
+	// Doesn't touch any members, so either thread can call it
+	static View MakeView( const glm::vec3& position, const glm::vec3& angles, const glm::mat4& projectionMatrix )
 	{
 		using namespace glm;
 
+		View view;
+		mat4 viewMatrix;
+
 		// Spherical coords
 		const vec3 anglesr = radians( angles );
 
@@ -147,62 +281,110 @@ public:
 		const float cosRoll = cos( anglesr.z );
 		const float sinRoll = sin( anglesr.z );
 
-		viewForward =
+		view.forward =
 		{
 			cosYaw * cosPitch,
 			-sinYaw * cosPitch,
 			-sinPitch
 		};
 
-		//std::cout << "viewForward: " << viewForward.x << " "
-		//	<< viewForward.y << " " << viewForward.z << std::endl;
+		//std::cout << "view.forward: " << view.forward.x << " "
+		//	<< view.forward.y << " " << view.forward.z << std::endl;
 
-		viewUp =
+		view.up =
 		{
 			(cosRoll * sinPitch * cosYaw) + (-sinRoll * -sinYaw),
 			(cosRoll * -sinPitch * sinYaw) + (-sinRoll * cosYaw),
 			cosPitch * cosRoll
 		};
 
-		viewRight = normalize( cross( viewForward, viewUp ) );
+		view.right = normalize( cross( view.forward, view.up ) );
 
 		// glm::lookAt does this but in a slightly more convoluted way
 		// So let's just do it ourselves
-		viewMatrix[0][0] = viewRight.x;
-		viewMatrix[1][0] = viewRight.y;
-		viewMatrix[2][0] = viewRight.z;
+		viewMatrix[0][0] = view.right.x;
+		viewMatrix[1][0] = view.right.y;
+		viewMatrix[2][0] = view.right.z;
 
-		viewMatrix[0][1] = viewUp.x;
-		viewMatrix[1][1] = viewUp.y;
-		viewMatrix[2][1] = viewUp.z;
+		viewMatrix[0][1] = view.up.x;
+		viewMatrix[1][1] = view.up.y;
+		viewMatrix[2][1] = view.up.z;
 
-		viewMatrix[0][2] = -viewForward.x;
-		viewMatrix[1][2] = -viewForward.y;
-		viewMatrix[2][2] = -viewForward.z;
+		viewMatrix[0][2] = -view.forward.x;
+		viewMatrix[1][2] = -view.forward.y;
+		viewMatrix[2][2] = -view.forward.z;
 
-		viewMatrix[3][0] = -glm::dot( viewRight, position );
-		viewMatrix[3][1] = -glm::dot( viewUp, position );
-		viewMatrix[3][2] = glm::dot( viewForward, position );
+		viewMatrix[3][0] = -glm::dot( view.right, position );
+		viewMatrix[3][1] = -glm::dot( view.up, position );
+		viewMatrix[3][2] = glm::dot( view.forward, position );
 
 		viewMatrix[0][3] = 1.0f;
 		viewMatrix[1][3] = 1.0f;
 		viewMatrix[2][3] = 1.0f;
 		viewMatrix[3][3] = 1.0f;
 
-		viewProjectionMatrix = projectionMatrix * viewMatrix;
+		view.viewProjectionMatrix = projectionMatrix * viewMatrix;
+		return view;
+	}
+
+	bool SplitsSimulation() const override
+	{
+		return true;
+	}
+
+	// Simulation thread: moves the camera and picks, the tree itself is only ever read after Init
+	void Simulate( const float& fixedDeltaTime, const UserCommand& uc ) override
+	{
+		adm::Timer timer;
+		const glm::vec3 previousPosition = position;
+		const glm::vec3 previousAngles = angles;
+
+		position += uc.forward * simulationView.forward * fixedDeltaTime * 3.0f + uc.right * simulationView.right * fixedDeltaTime * 3.0f;
+
+		if ( uc.flags & UserCommand::Action1 )
+		{
+			angles.y += uc.mouseX * 0.16f;
+			angles.x += uc.mouseY * 0.16f;
+		}
+
+		simulationView = MakeView( position, angles, MakeProjection( uc.windowWidth, uc.windowHeight ) );
+
+		Snapshot& snapshot = snapshots.GetWriteBuffer();
+		{
+			ProfileZone( "PickPoint" );
+			snapshot.pickedPoint = PickPoint( simulationView.viewProjectionMatrix, uc.mouseWindowX, uc.mouseWindowY,
+				uc.windowWidth, uc.windowHeight );
+		}
+
+		snapshot.previousPosition = previousPosition;
+		snapshot.position = position;
+		snapshot.previousAngles = previousAngles;
+		snapshot.angles = angles;
+		snapshot.simulateMs = timer.GetElapsed();
+		snapshots.Publish();
 	}
 
-	void Render( const float& deltaTime )
+	// Main thread: draws the latest tick, with the camera blended in from the one before
+	void Render( const float& alpha ) override
 	{
+		ProfileZone( "OctreeExperiment::Render" );
+		snapshots.Acquire();
+		const Snapshot& snapshot = snapshots.GetReadBuffer();
+		const spatial::RayHit& pickedPoint = snapshot.pickedPoint;
+
+		const glm::vec3 eye = glm::mix( snapshot.previousPosition, snapshot.position, alpha );
+		viewProjectionMatrix = MakeView( eye, glm::mix( snapshot.previousAngles, snapshot.angles, alpha ), projectionMatrix ).viewProjectionMatrix;
+		const float deltaTime = frameTimer.GetElapsedAndReset() / 1000.0f;
+
 		const auto renderText = [&]( adm::Vec3 textPosition, adm::StringView text )
 		{
-			float distance = std::max( 1.0f, (adm::Vec3( &position.x ) - textPosition).Length() );
+			float distance = std::max( 1.0f, (adm::Vec3( &eye.x ) - textPosition).Length() );
 			if ( distance > 10.0f )
 			{
 				return;
 			}
 
-			dd::projectedText( text.data(), textPosition, dd::colors::White, &viewProjectionMatrix[0][0], 0, 0, 1600, 900, 20.0f / (distance * distance) );
+			dd::projectedText( text.data(), textPosition, dd::colors::White, &viewProjectionMatrix[0][0], 0, 0, viewportWidth, viewportHeight, 20.0f / (distance * distance) );
 		};
 
 		const auto renderBbox = []( adm::AABB bbox, adm::Vec3 colour = { 1.0f, 1.0f, 1.0f })
@@ -213,53 +395,84 @@ public:
 			dd::box( centre, colour, extents.x, extents.y, extents.z );
 		};
 
-		const auto generateColour = []() -> adm::Vec3
-		{
-			return adm::Vec3(
-				(0.5f + crand() * 0.4f)/* * frand() */,
-				(0.5f + crand() * 0.4f)/* * frand() */,
-				(0.5f + crand() * 0.4f)/* * frand() */
-			).Normalized();
-		};
-
-		srand( 0x24819 );
-		int nodeId = 0;
 		constexpr float boxSize = 0.06f;
-		for ( auto& node : octree.GetLeaves() )
-		{
-			adm::Vec3 sectorColour = generateColour();
+		size_t numDrawnNodes = 0;
+		size_t numDrawnPoints = 0;
 
-			renderBbox( node->GetBoundingVolume(), sectorColour );
-			//renderText( node->GetBoundingBox().GetCentre(), std::to_string( nodeId ) );
-		
-			node->ForEachElement( [&]( adm::Vec3* point )
+		// Only what's in front of the camera gets sent to debug-draw, and only as much of it
+		// as the screen can show: far away nodes are drawn as their sample instead of their leaves
+		const spatial::Frustum frustum = spatial::Frustum::FromViewProjection( &viewProjectionMatrix[0][0] );
+		const float pixelsPerUnit = projectionMatrix[1][1] * float( viewportHeight ) * 0.5f;
+		{
+			ProfileZone( "QueryLevelOfDetail" );
+			flatOctree.QueryLevelOfDetail( frustum, adm::Vec3( &eye.x ), pixelsPerUnit,
+				[&]( uint32_t node, spatial::Span<const adm::Vec3> points )
 				{
-					//dd::box( *point, sectorColour, boxSize, boxSize, boxSize );
-					dd::point( *point, sectorColour, 2.0f );
+					ProfileZone( "DrawNode" );
+					// Nodes take the colour of their first leaf, so colours stay put as the cut moves
+					const adm::Vec3& sectorColour = leafColours[flatOctree.GetNodeLeafBegin()[node]];
+
+					renderBbox( flatOctree.GetNodeBoxes()[node], sectorColour );
+					//renderText( flatOctree.GetNodeBoxes()[node].GetCentre(), std::to_string( node ) );
+
+					for ( const adm::Vec3& point : points )
+					{
+						//dd::box( point, sectorColour, boxSize, boxSize, boxSize );
+						dd::point( point, sectorColour, 2.0f );
+					}
+
+					numDrawnNodes++;
+					numDrawnPoints += points.Size();
 				} );
+		}
 
-			nodeId++;
+		if ( pickedPoint.IsHit() )
+		{
+			dd::sphere( flatOctree.GetElements()[pickedPoint.flatElement], dd::colors::Yellow, 0.1f );
 		}
 
 		const ddVec3 textPosition = { 20.0f, 20.0f, 0.0f };
-		std::string framerate = "Elements: " + std::to_string( -octree.GetNodes().front().GetNumElements() ) + ", fps: ";
-		framerate += std::to_string( 1.0f / deltaTime );
+		std::string framerate = "Elements: " + std::to_string( flatOctree.GetNumUniqueElements() )
+			+ ", drawn: " + std::to_string( numDrawnPoints ) + " in " + std::to_string( numDrawnNodes ) + " nodes"
+			+ ", leaves: " + std::to_string( flatOctree.GetNumLeaves() ) + ", fps: ";
+		framerate += std::to_string( 1.0f / deltaTime ) + ", tick: " + std::to_string( snapshot.simulateMs ) + " ms";
 		
+		if ( pickedPoint.IsHit() )
+		{
+			framerate += ", picked: #" + std::to_string( pickedPoint.element );
+		}
+
 		dd::screenText( framerate.c_str(), textPosition, dd::colors::White, 1.0f );
+
+		for ( size_t i = 0; i < statsLines.size(); i++ )
+		{
+			const ddVec3 linePosition = { 20.0f, 20.0f + 20.0f * float( i + 1 ), 0.0f };
+			dd::screenText( statsLines[i].c_str(), linePosition, dd::colors::White, 0.8f );
+		}
 	}
 
-	void Update( const float& deltaTime, const float& time, const UserCommand& uc ) override
+	// Casts a ray from the camera through the cursor, and returns the first point it hits
+	spatial::RayHit PickPoint( const glm::mat4& viewProjectionMatrix, float mouseWindowX, float mouseWindowY,
+		int windowWidth, int windowHeight ) const
 	{
-		position += uc.forward * viewForward * deltaTime * 3.0f + uc.right * viewRight * deltaTime * 3.0f;
+		const float x = mouseWindowX / float( std::max( windowWidth, 1 ) ) * 2.0f - 1.0f;
+		const float y = 1.0f - mouseWindowY / float( std::max( windowHeight, 1 ) ) * 2.0f;
 
-		if ( uc.flags & UserCommand::Action1 )
-		{
-			angles.y += uc.mouseX * 0.16f;
-			angles.x += uc.mouseY * 0.16f;
-		}
+		const glm::mat4 inverseViewProjection = glm::inverse( viewProjectionMatrix );
+		glm::vec4 nearPoint = inverseViewProjection * glm::vec4( x, y, -1.0f, 1.0f );
+		glm::vec4 farPoint = inverseViewProjection * glm::vec4( x, y, 1.0f, 1.0f );
+		nearPoint /= nearPoint.w;
+		farPoint /= farPoint.w;
+
+		const glm::vec3 direction = glm::vec3( farPoint ) - glm::vec3( nearPoint );
 
-		UpdateViewMatrix();
-		Render( deltaTime );
+		spatial::Ray ray;
+		ray.origin = adm::Vec3( &nearPoint.x );
+		ray.direction = adm::Vec3( &direction.x ).Normalized();
+		ray.maxDistance = glm::length( direction );
+
+		constexpr float pickRadius = 0.1f;
+		return flatOctree.Raycast( ray, spatial::utils::RayHitsPoint{ pickRadius }, pickRadius );
 	}
 
 	const float* GetViewProjectionMatrix() const
@@ -268,18 +481,52 @@ public:
 	}
 
 private:
-	adm::NTree<adm::Vec3, adm::AABB, 3> octree;
-
+	// What the tree is generated from. Bump SnapshotKeyVersion when the way it's built changes
+	// in some way these don't cover, e.g. a different subdivision heuristic or RebuildMorton
+	static constexpr uint64_t SnapshotKeyVersion = 1;
+	static constexpr int NumPoints = 2500;
+	static constexpr Distribution PointDistribution = Distribution::Shell;
+	static constexpr uint32_t Seed = 0x910583;
+	static constexpr int32_t LeafThreshold = 40;
+	// 20x20x20 units
+	static constexpr float OctreeSize = 20.0f;
+
+	spatial::Octree<adm::Vec3> octree;
+	spatial::FlatOctree<adm::Vec3> flatOctree;
+	adm::Vector<adm::Vec3> leafColours;
+	// TreeStats get written here if it's set, see --stats
+	const char* statsPath{};
+	// The flattened octree gets mapped from or saved here if it's set, see --snapshot
+	const char* snapshotPath{};
+	// From TreeStats, drawn under the framerate
+	adm::Vector<std::string> statsLines;
+	spatial::TaskPool taskPool;
+
+	// What a tick hands over to Render, the camera from the tick before too so Render can
+	// blend between them when frames and ticks don't line up
+	struct Snapshot
+	{
+		glm::vec3 previousPosition{ 0.0f, 0.0f, 0.0f };
+		glm::vec3 position{ 0.0f, 0.0f, 0.0f };
+		glm::vec3 previousAngles{ 0.0f, 0.0f, 0.0f };
+		glm::vec3 angles{ 0.0f, 0.0f, 0.0f };
+		// Whatever's under the mouse cursor
+		spatial::RayHit pickedPoint;
+		float simulateMs{};
+	};
+	TripleBuffer<Snapshot> snapshots;
+
+	// Simulation thread only
 	glm::vec3 position{ 0.0f, 0.0f, 0.0f };
 	glm::vec3 angles{ 0.0f, 0.0f, 0.0f };
+	View simulationView{ { 1.0f, 0.0f, 0.0f }, { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, glm::mat4( 1.0f ) };
 
-	glm::vec3 viewForward{ 1.0f, 0.0f, 0.0f };
-	glm::vec3 viewRight{ 0.0f, -1.0f, 0.0f };
-	glm::vec3 viewUp{ 0.0f, 0.0f, 1.0f };
-
-	glm::mat4 viewMatrix;
-	glm::mat4 projectionMatrix;
+	// Main thread only, the render backend draws with this one
 	glm::mat4 viewProjectionMatrix;
+	adm::Timer frameTimer;
+	int viewportWidth{ DefaultWindowWidth };
+	int viewportHeight{ DefaultWindowHeight };
+	glm::mat4 projectionMatrix;
 };
 
 DeclareExperiment( OctreeExperiment );
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <Precompiled.hpp>
+#include "experiments/common/Random.hpp"
+#include "experiments/spatial/TaskPool.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Point distributions and subdivision heuristics shared between
+// OctreeExperiment and OctreeBenchmark, so both look at the same data
+
+// Random vector between min and max
+inline adm::Vec3 randVec( Random& random, adm::Vec3 min, adm::Vec3 max )
+{
+	const adm::Vec3 centre = (min + max) * 0.5f;
+	const adm::Vec3 extent = max - centre;
+	return centre + adm::Vec3(
+		random.Signed() * extent.x * 0.9f,
+		random.Signed() * extent.y * 0.9f,
+		random.Signed() * extent.z * 0.9f
+	);
+}
+
+// The closer the point is to 0,0,0, the less chance it'll spawn,
+// plus there's a second "shell" further out that's kept empty
+// `jitter` is three random numbers between 0 and 1 that wobble the thresholds
+inline bool canSpawnHere( const adm::Vec3& point, const float* jitter )
+{
+	const float threshold = 10.0f + jitter[0] * 8.0f;
+	// Similarly there's another disc out there
+	const float otherThreshold = 30.0f + jitter[1] * 5.0f;
+	const float pointDistance = point.Length();
+
+	return pointDistance > threshold
+		&& std::abs( otherThreshold - pointDistance ) > 10.0f
+		&& point.z < 7.0f + jitter[2] * 10.0f;
+}
+
+// False where canSpawnHere can't pass whatever the jitter, which is most places
+inline bool mightSpawnHere( const adm::Vec3& point )
+{
+	const float distanceSquared = point.x * point.x + point.y * point.y + point.z * point.z;
+	return distanceSquared > 10.0f * 10.0f
+		&& (distanceSquared < 25.0f * 25.0f || distanceSquared > 40.0f * 40.0f)
+		&& point.z < 17.0f;
+}
+
+enum class Distribution
+{
+	Uniform,
+	// canSpawnHere rejection sampling, what OctreeExperiment has always used
+	Shell,
+	// A handful of tight blobs with a lot of empty space between them
+	Clustered
+};
+
+inline const char* DistributionName( Distribution distribution )
+{
+	switch ( distribution )
+	{
+	case Distribution::Uniform: return "uniform";
+	case Distribution::Shell: return "shell";
+	case Distribution::Clustered: return "clustered";
+	}
+
+	return "unknown";
+}
+
+// Points are generated in chunks of this many, and every chunk has its own random stream,
+// so a seed gives the same points no matter how many threads split the chunks up
+constexpr size_t PointsPerChunk = 1 << 16;
+// Random numbers are made this many points' worth at a time
+constexpr size_t PointsPerBatch = 256;
+constexpr int NumClusters = 16;
+
+struct ScenarioParameters
+{
+	adm::AABB box;
+	uint64_t seed{};
+	adm::Vec3 clusterCentres[NumClusters];
+	float clusterRadius{};
+};
+
+// Fills in points [first, first + count), which all belong to the same chunk
+inline void GeneratePointChunk( Distribution distribution, const ScenarioParameters& parameters,
+	adm::Vec3* outPoints, size_t first, size_t count )
+{
+	using namespace adm;
+
+	Random random( parameters.seed, first / PointsPerChunk );
+	const Vec3 centre = parameters.box.GetCentre();
+	const Vec3 extent = (parameters.box.maxs - centre) * 0.9f;
+	const auto inBox = [&]( const float* numbers )
+	{
+		return centre + Vec3(
+			(numbers[0] * 2.0f - 1.0f) * extent.x,
+			(numbers[1] * 2.0f - 1.0f) * extent.y,
+			(numbers[2] * 2.0f - 1.0f) * extent.z );
+	};
+
+	float numbers[PointsPerBatch * 9];
+	adm::Vec3 candidates[PointsPerBatch];
+	switch ( distribution )
+	{
+	case Distribution::Uniform:
+		for ( size_t i = 0; i < count; i += PointsPerBatch )
+		{
+			const size_t batchSize = std::min( PointsPerBatch, count - i );
+			random.Fill( numbers, batchSize * 3 );
+			for ( size_t j = 0; j < batchSize; j++ )
+			{
+				outPoints[i + j] = inBox( numbers + j * 3 );
+			}
+		}
+		break;
+
+	// A batch of positions at a time, and only the ones that survive mightSpawnHere
+	// get the numbers for canSpawnHere, until the chunk's full
+	case Distribution::Shell:
+	{
+		size_t numAccepted = 0;
+		while ( numAccepted < count )
+		{
+			random.Fill( numbers, PointsPerBatch * 3 );
+			size_t numCandidates = 0;
+			for ( size_t j = 0; j < PointsPerBatch; j++ )
+			{
+				candidates[numCandidates] = inBox( numbers + j * 3 );
+				numCandidates += mightSpawnHere( candidates[numCandidates] );
+			}
+
+			random.Fill( numbers, numCandidates * 3 );
+			for ( size_t j = 0; j < numCandidates && numAccepted < count; j++ )
+			{
+				if ( canSpawnHere( candidates[j], numbers + j * 3 ) )
+				{
+					outPoints[numAccepted++] = candidates[j];
+				}
+			}
+		}
+		break;
+	}
+
+	case Distribution::Clustered:
+		for ( size_t i = 0; i < count; i += PointsPerBatch )
+		{
+			const size_t batchSize = std::min( PointsPerBatch, count - i );
+			random.Fill( numbers, batchSize * 9 );
+			for ( size_t j = 0; j < batchSize; j++ )
+			{
+				// Sum of three uniforms is a cheap bell curve
+				const float* n = numbers + j * 9;
+				const Vec3 offset = Vec3(
+					n[0] + n[1] + n[2] - 1.5f,
+					n[3] + n[4] + n[5] - 1.5f,
+					n[6] + n[7] + n[8] - 1.5f ) * (parameters.clusterRadius * 2.0f / 3.0f);
+
+				Vec3 point = parameters.clusterCentres[(first + i + j) % NumClusters] + offset;
+				point.x = std::clamp( point.x, parameters.box.mins.x, parameters.box.maxs.x );
+				point.y = std::clamp( point.y, parameters.box.mins.y, parameters.box.maxs.y );
+				point.z = std::clamp( point.z, parameters.box.mins.z, parameters.box.maxs.z );
+				outPoints[i + j] = point;
+			}
+		}
+		break;
+	}
+}
+
+// Chunks get spread across the pool if there is one, the points come out the same either way
+inline adm::Vector<adm::Vec3> GeneratePoints( Distribution distribution, int numPoints, const adm::AABB& box, unsigned int seed,
+	spatial::TaskPool* pool = nullptr )
+{
+	using namespace adm;
+
+	ScenarioParameters parameters;
+	parameters.box = box;
+	parameters.seed = seed;
+	parameters.clusterRadius = box.Diagonal() * 0.02f;
+
+	// The last stream is never going to be reached by a chunk
+	Random clusterRandom( seed, ~0ULL );
+	for ( Vec3& centre : parameters.clusterCentres )
+	{
+		centre = randVec( clusterRandom, box.mins, box.maxs );
+	}
+
+	Vector<Vec3> points( size_t( std::max( numPoints, 0 ) ) );
+	const size_t numChunks = (points.size() + PointsPerChunk - 1) / PointsPerChunk;
+	const auto generateChunk = [&points, &parameters, distribution]( size_t chunk )
+	{
+		const size_t first = chunk * PointsPerChunk;
+		GeneratePointChunk( distribution, parameters, points.data() + first, first,
+			std::min( PointsPerChunk, points.size() - first ) );
+	};
+
+	if ( !pool || numChunks <= 1 )
+	{
+		for ( size_t chunk = 0; chunk < numChunks; chunk++ )
+		{
+			generateChunk( chunk );
+		}
+		return points;
+	}
+
+	spatial::TaskGroup group;
+	for ( size_t chunk = 0; chunk < numChunks; chunk++ )
+	{
+		pool->Submit( group, [&generateChunk, chunk]()
+			{
+				generateChunk( chunk );
+			} );
+	}
+	pool->Wait( group );
+
+	return points;
+}
+
+// spatial::Tree nodes keep a running sum, so there's nothing to walk
+template<typename NodeType>
+auto SumOfElements( const NodeType& node, int ) -> decltype( node.GetStats(), adm::Vec3() )
+{
+	return node.GetStats().positionSum;
+}
+
+// adm::NTree nodes only hand out one element at a time
+template<typename NodeType>
+adm::Vec3 SumOfElements( const NodeType& node, long )
+{
+	adm::Vec3 sum;
+	node.ForEachElement( [&]( adm::Vec3* element )
+		{
+			sum += *element;
+		} );
+
+	return sum;
+}
+
+// Alternative heuristic: reverse density and distance from centre
+// Works with both adm::NTree and spatial::Tree nodes
+template<typename NodeType>
+bool ShouldSubdivideByDensity( const NodeType& node )
+{
+	const int32_t& numElements = node.GetNumElements();
+
+	const adm::Vec3 nodeCentre = node.GetBoundingVolume().GetCentre();
+	adm::Vec3 averageCentre = SumOfElements( node, 0 );
+	averageCentre /= float( numElements );
+
+	const float diagonal = node.GetBoundingVolume().Diagonal();
+	const float density = float( numElements ) / diagonal;
+	const float relativeDistanceFromCentre = (nodeCentre - averageCentre).Length() / (diagonal * 0.5f);
+
+	if ( numElements > 500 )
+	{
+		return true;
+	}
+	if ( diagonal < 4.0f )
+	{
+		return false;
+	}
+
+	return relativeDistanceFromCentre > 0.3f || density < 0.6f;
+}
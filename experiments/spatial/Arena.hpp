@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#if defined( __linux__ )
+#include <sys/mman.h>
+#endif
+
+namespace spatial
+{
+	// Bump allocator that hands out memory from big blocks and never gives the blocks back
+	// Reset forgets everything that was allocated, but keeps the blocks, so doing the same
+	// work again after a Reset doesn't touch the heap at all. Freed allocations go into
+	// power-of-two size classes and get reused before anything new is bumped off a block,
+	// so a vector growing and freeing its old buffers doesn't eat through the arena.
+	//
+	// It's a std::pmr::memory_resource, so it plugs into any std::pmr container
+	// Allocating and freeing take a lock, it's meant to be shared by a parallel build
+	class Arena : public std::pmr::memory_resource
+	{
+	public:
+		static constexpr size_t DefaultBlockSize = size_t( 16 ) << 20;
+		static constexpr size_t HugePageSize = size_t( 2 ) << 20;
+
+		explicit Arena( size_t blockSize = DefaultBlockSize )
+			: blockSize( blockSize )
+		{
+		}
+
+		~Arena() override
+		{
+			for ( const Block& block : blocks )
+			{
+				FreeBlock( block );
+			}
+		}
+
+		Arena( const Arena& ) = delete;
+		Arena& operator=( const Arena& ) = delete;
+
+		// Everything allocated so far becomes invalid, the blocks are kept for next time
+		void Reset()
+		{
+			std::lock_guard<std::mutex> lock( mutex );
+			currentBlock = 0;
+			offset = 0;
+			for ( FreeNode*& list : freeLists )
+			{
+				list = nullptr;
+			}
+		}
+
+		// Asks the kernel to back new blocks with transparent huge pages, which means far fewer
+		// TLB misses when a build sweeps over hundreds of megabytes. Only does anything on Linux
+		void SetHugePages( bool enable )
+		{
+			hugePages = enable;
+		}
+
+		size_t GetNumBlocks() const
+		{
+			return blocks.size();
+		}
+
+		size_t GetBytesReserved() const
+		{
+			size_t bytes = 0;
+			for ( const Block& block : blocks )
+			{
+				bytes += block.size;
+			}
+
+			return bytes;
+		}
+
+	private:
+		static constexpr size_t MinClass = 6;
+		static constexpr size_t NumClasses = 48;
+
+		struct Block
+		{
+			uint8_t* data;
+			size_t size;
+			bool mapped;
+		};
+
+		struct FreeNode
+		{
+			FreeNode* next;
+		};
+
+		// Everything is rounded up to a power of two of at least 64 bytes, which also keeps
+		// every allocation 64-byte aligned
+		static size_t GetClass( size_t bytes )
+		{
+			size_t sizeClass = MinClass;
+			while ( (size_t( 1 ) << sizeClass) < bytes )
+			{
+				sizeClass++;
+			}
+
+			return sizeClass;
+		}
+
+		void* do_allocate( size_t bytes, size_t alignment ) override
+		{
+			const size_t sizeClass = GetClass( std::max( bytes, alignment ) );
+			const size_t size = size_t( 1 ) << sizeClass;
+
+			std::lock_guard<std::mutex> lock( mutex );
+			if ( FreeNode* node = freeLists[sizeClass] )
+			{
+				freeLists[sizeClass] = node->next;
+				return node;
+			}
+
+			// Walks on through the blocks kept from before a Reset, and only grows once it runs out
+			while ( currentBlock < blocks.size() )
+			{
+				const Block& block = blocks[currentBlock];
+				const size_t start = (offset + alignment - 1) & ~(alignment - 1);
+				if ( start + size <= block.size )
+				{
+					offset = start + size;
+					return block.data + start;
+				}
+
+				currentBlock++;
+				offset = 0;
+			}
+
+			blocks.push_back( AllocateBlock( std::max( blockSize, size ) ) );
+			offset = size;
+			return blocks.back().data;
+		}
+
+		void do_deallocate( void* pointer, size_t bytes, size_t alignment ) override
+		{
+			const size_t sizeClass = GetClass( std::max( bytes, alignment ) );
+
+			std::lock_guard<std::mutex> lock( mutex );
+			FreeNode* node = static_cast<FreeNode*>( pointer );
+			node->next = freeLists[sizeClass];
+			freeLists[sizeClass] = node;
+		}
+
+		bool do_is_equal( const std::pmr::memory_resource& other ) const noexcept override
+		{
+			return this == &other;
+		}
+
+		Block AllocateBlock( size_t size ) const
+		{
+#if defined( __linux__ )
+			if ( hugePages )
+			{
+				size = (size + HugePageSize - 1) & ~(HugePageSize - 1);
+				void* data = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+				if ( data == MAP_FAILED )
+				{
+					throw std::bad_alloc();
+				}
+
+				madvise( data, size, MADV_HUGEPAGE );
+				return { static_cast<uint8_t*>( data ), size, true };
+			}
+#endif
+			return { static_cast<uint8_t*>( ::operator new( size, std::align_val_t( 64 ) ) ), size, false };
+		}
+
+		static void FreeBlock( const Block& block )
+		{
+#if defined( __linux__ )
+			if ( block.mapped )
+			{
+				munmap( block.data, block.size );
+				return;
+			}
+#endif
+			::operator delete( block.data, std::align_val_t( 64 ) );
+		}
+
+		std::mutex mutex;
+		size_t blockSize;
+		bool hugePages{};
+
+		std::vector<Block> blocks;
+		size_t currentBlock{};
+		size_t offset{};
+		FreeNode* freeLists[NumClasses]{};
+	};
+}
@@ -0,0 +1,530 @@
+#pragma once
+
+#include <Precompiled.hpp>
+#include "experiments/spatial/Ray.hpp"
+#include "experiments/spatial/Tree.hpp"
+#include <atomic>
+
+namespace spatial
+{
+	// Bounding volume hierarchy over elements with ElementBounds, built with a binned
+	// surface area heuristic
+	//
+	// Where an octree always splits space down the middle, this splits the elements, at
+	// whichever of a handful of candidate planes makes the two halves cheapest to hit by
+	// chance, judging by their surface areas. Boxes follow the elements, so clusters and
+	// shells get tight boxes and empty space costs nothing. Every element is in exactly one
+	// leaf, boxes of siblings can overlap instead.
+	//
+	// Nodes end up in depth-first order, 32 bytes each: a node's first child comes right after
+	// it, and it links to the second one. Leaves link to a run of GetOrderedElements(), which
+	// are copied over in leaf order. Building in parallel doesn't change the layout.
+	template<typename ElementType>
+	class Bvh
+	{
+	public:
+		// Past this depth, nodes become leaves whatever's in them, so traversal stacks have a bound
+		static constexpr uint32_t MaxDepth = 48;
+		static constexpr uint32_t NumBins = 16;
+		// Leaves get split if that's cheaper, until they're at most this big
+		static constexpr uint32_t MaxLeafElements = 8;
+		// Below this many elements, a subtree is built on whichever thread got to it
+		static constexpr uint32_t ParallelSubtreeThreshold = 8192;
+
+		struct Node
+		{
+			float mins[3];
+			// First element for leaves, the second child otherwise
+			uint32_t link;
+			float maxs[3];
+			// 0 for internal nodes
+			uint32_t numElements : 30;
+			// Which axis the children were split along, the first child is on the lower side
+			uint32_t axis : 2;
+
+			bool IsLeaf() const
+			{
+				return numElements != 0;
+			}
+
+			adm::AABB GetBounds() const
+			{
+				return { adm::Vec3( mins[0], mins[1], mins[2] ), adm::Vec3( maxs[0], maxs[1], maxs[2] ) };
+			}
+		};
+
+		void SetElements( adm::Vector<ElementType>&& newElements )
+		{
+			elements = std::move( newElements );
+		}
+
+		const adm::Vector<ElementType>& GetElements() const
+		{
+			return elements;
+		}
+
+		void Rebuild()
+		{
+			Build( nullptr );
+		}
+
+		// Splits big subtrees across the pool, comes out the same as Rebuild()
+		void Rebuild( TaskPool& pool )
+		{
+			Build( &pool );
+		}
+
+		// Nearest element along the ray, with the same hitTest and margin as FlatOctree::Raycast
+		// The child on the side the ray comes from is visited first
+		template<typename HitFunction>
+		RayHit Raycast( const Ray& ray, HitFunction&& hitTest, float margin = 0.0f ) const
+		{
+			RayHit hit;
+			hit.distance = ray.maxDistance;
+			if ( nodes.empty() )
+			{
+				return hit;
+			}
+
+			const adm::Vec3 inverseDirection( 1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z );
+			const bool negative[3] = { ray.direction.x < 0.0f, ray.direction.y < 0.0f, ray.direction.z < 0.0f };
+
+			uint32_t stack[MaxDepth + 2];
+			uint32_t stackSize = 0;
+			stack[stackSize++] = 0;
+
+			while ( stackSize > 0 )
+			{
+				const Node& node = nodes[stack[--stackSize]];
+				float enter;
+				if ( !RayHitsBox( ray.origin, inverseDirection, hit.distance, Grow( node, margin ), enter ) )
+				{
+					continue;
+				}
+
+				if ( node.IsLeaf() )
+				{
+					for ( uint32_t i = node.link; i < node.link + node.numElements; i++ )
+					{
+						float distance;
+						if ( hitTest( orderedElements[i], ray.origin, ray.direction, distance ) && distance < hit.distance )
+						{
+							hit.element = elementIndices[i];
+							hit.flatElement = i;
+							hit.distance = distance;
+						}
+					}
+					continue;
+				}
+
+				// Nearer child goes on the stack last, so it comes off first
+				const uint32_t first = uint32_t( &node - nodes.data() ) + 1;
+				if ( negative[node.axis] )
+				{
+					stack[stackSize++] = first;
+					stack[stackSize++] = node.link;
+				}
+				else
+				{
+					stack[stackSize++] = node.link;
+					stack[stackSize++] = first;
+				}
+			}
+
+			return hit;
+		}
+
+		// Calls function( uint32_t element ) for every element whose bounds overlap `box`
+		template<typename FunctionType>
+		void QueryBox( const adm::AABB& box, FunctionType&& function ) const
+		{
+			if ( nodes.empty() )
+			{
+				return;
+			}
+
+			uint32_t stack[MaxDepth + 2];
+			uint32_t stackSize = 0;
+			stack[stackSize++] = 0;
+
+			while ( stackSize > 0 )
+			{
+				const uint32_t nodeIndex = stack[--stackSize];
+				const Node& node = nodes[nodeIndex];
+				if ( !Overlaps( node.GetBounds(), box ) )
+				{
+					continue;
+				}
+
+				if ( node.IsLeaf() )
+				{
+					for ( uint32_t i = node.link; i < node.link + node.numElements; i++ )
+					{
+						if ( Overlaps( ElementBounds<ElementType>::Get( orderedElements[i] ), box ) )
+						{
+							function( elementIndices[i] );
+						}
+					}
+					continue;
+				}
+
+				stack[stackSize++] = node.link;
+				stack[stackSize++] = nodeIndex + 1;
+			}
+		}
+
+		// The root is node 0
+		const adm::Vector<Node>& GetNodes() const
+		{
+			return nodes;
+		}
+
+		// Every leaf's elements back to back, in leaf order
+		const adm::Vector<ElementType>& GetOrderedElements() const
+		{
+			return orderedElements;
+		}
+
+		// Where each of GetOrderedElements() is in GetElements()
+		const adm::Vector<uint32_t>& GetElementIndices() const
+		{
+			return elementIndices;
+		}
+
+		// Same nodes, same element order
+		bool IsIdenticalTo( const Bvh& other ) const
+		{
+			return nodes.size() == other.nodes.size()
+				&& std::memcmp( nodes.data(), other.nodes.data(), nodes.size() * sizeof( Node ) ) == 0
+				&& elementIndices == other.elementIndices;
+		}
+
+		// What the tree holds on to between builds, including build scratch
+		size_t GetMemoryUsage() const
+		{
+			return (elements.capacity() + orderedElements.capacity()) * sizeof( ElementType )
+				+ nodes.capacity() * sizeof( Node )
+				+ elementIndices.capacity() * sizeof( uint32_t )
+				+ buildBounds.capacity() * sizeof( adm::AABB )
+				+ buildCentres.capacity() * sizeof( adm::Vec3 )
+				+ buildNodes.capacity() * sizeof( BuildNode );
+		}
+
+	private:
+		// Nodes are handed out in pairs from one array while building, in whatever order
+		// the threads get to them, and get put in depth-first order afterwards
+		struct BuildNode
+		{
+			adm::AABB bounds;
+			uint32_t firstChild;
+			uint32_t begin;
+			uint32_t count;
+			uint32_t axis;
+		};
+
+		struct BuildContext
+		{
+			TaskPool* pool{};
+			std::atomic<uint32_t> numNodes{ 1 };
+		};
+
+		struct Bin
+		{
+			adm::AABB bounds{ adm::Vec3( FLT_MAX ), adm::Vec3( -FLT_MAX ) };
+			uint32_t count{};
+		};
+
+		static constexpr uint32_t NoChildren = ~0U;
+
+		static bool Overlaps( const adm::AABB& a, const adm::AABB& b )
+		{
+			return a.mins.x <= b.maxs.x && a.maxs.x >= b.mins.x
+				&& a.mins.y <= b.maxs.y && a.maxs.y >= b.mins.y
+				&& a.mins.z <= b.maxs.z && a.maxs.z >= b.mins.z;
+		}
+
+		static adm::AABB Grow( const Node& node, float margin )
+		{
+			adm::AABB box = node.GetBounds();
+			box.mins -= adm::Vec3( margin );
+			box.maxs += adm::Vec3( margin );
+			return box;
+		}
+
+		static void Extend( adm::AABB& box, const adm::AABB& other )
+		{
+			for ( size_t axis = 0; axis < 3; axis++ )
+			{
+				(&box.mins.x)[axis] = std::min( (&box.mins.x)[axis], (&other.mins.x)[axis] );
+				(&box.maxs.x)[axis] = std::max( (&box.maxs.x)[axis], (&other.maxs.x)[axis] );
+			}
+		}
+
+		// Half the surface area, only ever compared against other areas
+		static float GetArea( const adm::AABB& box )
+		{
+			const adm::Vec3 size = box.maxs - box.mins;
+			return size.x * size.y + size.y * size.z + size.z * size.x;
+		}
+
+		void Build( TaskPool* pool )
+		{
+			nodes.clear();
+			orderedElements.clear();
+			elementIndices.clear();
+			if ( elements.empty() )
+			{
+				return;
+			}
+
+			const uint32_t numElements = uint32_t( elements.size() );
+			buildBounds.resize( numElements );
+			buildCentres.resize( numElements );
+			elementIndices.resize( numElements );
+			for ( uint32_t i = 0; i < numElements; i++ )
+			{
+				buildBounds[i] = ElementBounds<ElementType>::Get( elements[i] );
+				buildCentres[i] = buildBounds[i].GetCentre();
+				elementIndices[i] = i;
+			}
+
+			// A binary tree with at least one element per leaf can't have more nodes than this
+			buildNodes.resize( size_t( numElements ) * 2 - 1 );
+			buildNodes[0].begin = 0;
+			buildNodes[0].count = numElements;
+			buildNodes[0].bounds = GetRangeBounds( 0, numElements );
+
+			BuildContext context;
+			context.pool = pool;
+			Subdivide( context, 0, 0 );
+
+			nodes.resize( context.numNodes.load( std::memory_order_relaxed ) );
+			orderedElements.resize( numElements );
+			for ( uint32_t i = 0; i < numElements; i++ )
+			{
+				orderedElements[i] = elements[elementIndices[i]];
+			}
+
+			Flatten();
+		}
+
+		adm::AABB GetRangeBounds( uint32_t begin, uint32_t end ) const
+		{
+			adm::AABB bounds{ adm::Vec3( FLT_MAX ), adm::Vec3( -FLT_MAX ) };
+			for ( uint32_t i = begin; i < end; i++ )
+			{
+				Extend( bounds, buildBounds[elementIndices[i]] );
+			}
+
+			return bounds;
+		}
+
+		void Subdivide( BuildContext& context, uint32_t nodeIndex, uint32_t depth )
+		{
+			BuildNode& node = buildNodes[nodeIndex];
+			node.firstChild = NoChildren;
+			node.axis = 0;
+
+			const uint32_t begin = node.begin;
+			const uint32_t end = node.begin + node.count;
+			if ( node.count <= 1 || depth >= MaxDepth )
+			{
+				return;
+			}
+
+			// Bins go across the centres' bounds, not the elements', so they all get used
+			adm::AABB centreBounds{ adm::Vec3( FLT_MAX ), adm::Vec3( -FLT_MAX ) };
+			for ( uint32_t i = begin; i < end; i++ )
+			{
+				Extend( centreBounds, { buildCentres[elementIndices[i]], buildCentres[elementIndices[i]] } );
+			}
+
+			Bin bins[3][NumBins];
+			float binScales[3];
+			for ( size_t axis = 0; axis < 3; axis++ )
+			{
+				const float extent = (&centreBounds.maxs.x)[axis] - (&centreBounds.mins.x)[axis];
+				binScales[axis] = extent > 0.0f ? float( NumBins ) * 0.9999f / extent : 0.0f;
+			}
+
+			for ( uint32_t i = begin; i < end; i++ )
+			{
+				const uint32_t element = elementIndices[i];
+				for ( size_t axis = 0; axis < 3; axis++ )
+				{
+					Bin& bin = bins[axis][GetBin( buildCentres[element], centreBounds, binScales, axis )];
+					Extend( bin.bounds, buildBounds[element] );
+					bin.count++;
+				}
+			}
+
+			// Cost is in element tests, a traversal step is taken to cost about as much as one
+			float bestCost = float( node.count );
+			uint32_t bestAxis = 0;
+			uint32_t bestSplit = 0;
+			const float inverseArea = 1.0f / std::max( GetArea( node.bounds ), FLT_MIN );
+			for ( uint32_t axis = 0; axis < 3; axis++ )
+			{
+				if ( binScales[axis] == 0.0f )
+				{
+					continue;
+				}
+
+				// Sweeping from the right first, so the left sweep can finish the costs off
+				float rightAreas[NumBins];
+				uint32_t rightCounts[NumBins];
+				adm::AABB rightBounds{ adm::Vec3( FLT_MAX ), adm::Vec3( -FLT_MAX ) };
+				uint32_t rightCount = 0;
+				for ( uint32_t b = NumBins - 1; b > 0; b-- )
+				{
+					rightCount += bins[axis][b].count;
+					Extend( rightBounds, bins[axis][b].bounds );
+					rightCounts[b] = rightCount;
+					rightAreas[b] = rightCount ? GetArea( rightBounds ) : 0.0f;
+				}
+
+				adm::AABB leftBounds{ adm::Vec3( FLT_MAX ), adm::Vec3( -FLT_MAX ) };
+				uint32_t leftCount = 0;
+				for ( uint32_t split = 1; split < NumBins; split++ )
+				{
+					leftCount += bins[axis][split - 1].count;
+					Extend( leftBounds, bins[axis][split - 1].bounds );
+					if ( leftCount == 0 || rightCounts[split] == 0 )
+					{
+						continue;
+					}
+
+					const float cost = 1.0f + (GetArea( leftBounds ) * float( leftCount ) + rightAreas[split] * float( rightCounts[split] )) * inverseArea;
+					if ( cost < bestCost )
+					{
+						bestCost = cost;
+						bestAxis = axis;
+						bestSplit = split;
+					}
+				}
+			}
+
+			uint32_t middle;
+			if ( bestSplit != 0 )
+			{
+				const uint32_t* splitEnd = std::partition( elementIndices.data() + begin, elementIndices.data() + end,
+					[&]( uint32_t element )
+					{
+						return GetBin( buildCentres[element], centreBounds, binScales, bestAxis ) < bestSplit;
+					} );
+				middle = uint32_t( splitEnd - elementIndices.data() );
+			}
+			else if ( node.count > MaxLeafElements )
+			{
+				// Splitting doesn't pay off but the leaf would be too big, so halve it along the
+				// centres' widest axis. Only if they're all in one spot does the order not matter
+				middle = begin + node.count / 2;
+				const adm::Vec3 centreExtents = centreBounds.maxs - centreBounds.mins;
+				bestAxis = centreExtents.x >= centreExtents.y && centreExtents.x >= centreExtents.z ? 0 : (centreExtents.y >= centreExtents.z ? 1 : 2);
+				if ( (&centreExtents.x)[bestAxis] > 0.0f )
+				{
+					std::nth_element( elementIndices.data() + begin, elementIndices.data() + middle, elementIndices.data() + end,
+						[&]( uint32_t a, uint32_t b )
+						{
+							return (&buildCentres[a].x)[bestAxis] < (&buildCentres[b].x)[bestAxis];
+						} );
+				}
+			}
+			else
+			{
+				return;
+			}
+
+			const uint32_t firstChild = context.numNodes.fetch_add( 2, std::memory_order_relaxed );
+			node.firstChild = firstChild;
+			node.axis = bestAxis;
+
+			BuildNode& left = buildNodes[firstChild];
+			BuildNode& right = buildNodes[firstChild + 1];
+			left.begin = begin;
+			left.count = middle - begin;
+			left.bounds = GetRangeBounds( begin, middle );
+			right.begin = middle;
+			right.count = end - middle;
+			right.bounds = GetRangeBounds( middle, end );
+
+			if ( context.pool && node.count >= ParallelSubtreeThreshold )
+			{
+				TaskGroup group;
+				context.pool->Submit( group, [this, &context, firstChild, depth]()
+					{
+						Subdivide( context, firstChild, depth + 1 );
+					} );
+				Subdivide( context, firstChild + 1, depth + 1 );
+				context.pool->Wait( group );
+				return;
+			}
+
+			Subdivide( context, firstChild, depth + 1 );
+			Subdivide( context, firstChild + 1, depth + 1 );
+		}
+
+		static uint32_t GetBin( const adm::Vec3& centre, const adm::AABB& centreBounds, const float* binScales, size_t axis )
+		{
+			const float position = ((&centre.x)[axis] - (&centreBounds.mins.x)[axis]) * binScales[axis];
+			return std::min( uint32_t( position ), NumBins - 1 );
+		}
+
+		// Build nodes into depth-first order, which is the same whatever order threads made them in
+		void Flatten()
+		{
+			struct Entry
+			{
+				uint32_t buildNode;
+				// Flat node whose link should point here, or NoChildren
+				uint32_t parent;
+			};
+
+			Entry stack[MaxDepth + 2];
+			uint32_t stackSize = 0;
+			stack[stackSize++] = { 0, NoChildren };
+
+			uint32_t numNodes = 0;
+			while ( stackSize > 0 )
+			{
+				const Entry entry = stack[--stackSize];
+				const BuildNode& buildNode = buildNodes[entry.buildNode];
+				const uint32_t flatIndex = numNodes++;
+				if ( entry.parent != NoChildren )
+				{
+					nodes[entry.parent].link = flatIndex;
+				}
+
+				Node& node = nodes[flatIndex];
+				for ( size_t axis = 0; axis < 3; axis++ )
+				{
+					node.mins[axis] = (&buildNode.bounds.mins.x)[axis];
+					node.maxs[axis] = (&buildNode.bounds.maxs.x)[axis];
+				}
+				node.axis = buildNode.axis;
+
+				if ( buildNode.firstChild == NoChildren )
+				{
+					node.link = buildNode.begin;
+					node.numElements = buildNode.count;
+					continue;
+				}
+
+				// Second child's link gets filled in once it's reached, the first one comes next
+				node.numElements = 0;
+				stack[stackSize++] = { buildNode.firstChild + 1, flatIndex };
+				stack[stackSize++] = { buildNode.firstChild, NoChildren };
+			}
+		}
+
+		adm::Vector<ElementType> elements;
+		adm::Vector<Node> nodes;
+		adm::Vector<ElementType> orderedElements;
+		adm::Vector<uint32_t> elementIndices;
+
+		// Kept around between builds, so rebuilding doesn't allocate
+		adm::Vector<adm::AABB> buildBounds;
+		adm::Vector<adm::Vec3> buildCentres;
+		adm::Vector<BuildNode> buildNodes;
+	};
+}
@@ -0,0 +1,1416 @@
+#pragma once
+
+#include "experiments/spatial/Frustum.hpp"
+#include "experiments/spatial/MappedFile.hpp"
+#include "experiments/spatial/Neighbours.hpp"
+#include "experiments/spatial/Octree.hpp"
+#include "experiments/spatial/Ray.hpp"
+#include "experiments/spatial/Simd.hpp"
+#include "experiments/spatial/Span.hpp"
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+namespace spatial
+{
+	// Axis-aligned boxes in structure-of-arrays form, one array per bound per axis
+	// A pass that only looks at, say, the X extents only pulls X extents into cache
+	struct BoxArray
+	{
+		adm::Vector<float> mins[3];
+		adm::Vector<float> maxs[3];
+
+		size_t Size() const
+		{
+			return mins[0].size();
+		}
+
+		void Clear()
+		{
+			for ( size_t axis = 0; axis < 3; axis++ )
+			{
+				mins[axis].clear();
+				maxs[axis].clear();
+			}
+		}
+
+		void Resize( size_t size )
+		{
+			for ( size_t axis = 0; axis < 3; axis++ )
+			{
+				mins[axis].resize( size );
+				maxs[axis].resize( size );
+			}
+		}
+
+		void Set( size_t index, const adm::AABB& box )
+		{
+			for ( size_t axis = 0; axis < 3; axis++ )
+			{
+				mins[axis][index] = (&box.mins.x)[axis];
+				maxs[axis][index] = (&box.maxs.x)[axis];
+			}
+		}
+
+		adm::AABB operator[]( size_t index ) const
+		{
+			return
+			{
+				adm::Vec3( mins[0][index], mins[1][index], mins[2][index] ),
+				adm::Vec3( maxs[0][index], maxs[1][index], maxs[2][index] )
+			};
+		}
+	};
+
+	// Same as a BoxArray, except it doesn't own the arrays, they might as well be in a mapped file
+	struct BoxArrayView
+	{
+		Span<const float> mins[3];
+		Span<const float> maxs[3];
+
+		BoxArrayView() = default;
+		BoxArrayView( const BoxArray& boxes )
+		{
+			for ( size_t axis = 0; axis < 3; axis++ )
+			{
+				mins[axis] = { boxes.mins[axis].data(), boxes.mins[axis].size() };
+				maxs[axis] = { boxes.maxs[axis].data(), boxes.maxs[axis].size() };
+			}
+		}
+
+		size_t Size() const
+		{
+			return mins[0].Size();
+		}
+
+		adm::AABB operator[]( size_t index ) const
+		{
+			return
+			{
+				adm::Vec3( mins[0][index], mins[1][index], mins[2][index] ),
+				adm::Vec3( maxs[0][index], maxs[1][index], maxs[2][index] )
+			};
+		}
+	};
+
+	// What a FlatOctree snapshot file starts with
+	// Everything after it is the FlatOctree's arrays, each one starting on a 64-byte boundary
+	// at the offset given in `sections`. Offsets are from the start of the file, so the file
+	// can be mapped anywhere and read in place
+	struct FlatOctreeFileHeader
+	{
+		static constexpr char Magic[8] = { 'A', 'D', 'M', 'F', 'L', 'A', 'T', '\0' };
+		// Bump this whenever the layout of the file or of the arrays changes
+		static constexpr uint32_t CurrentVersion = 3;
+		// Reads back as something else on a machine with the other byte order
+		static constexpr uint32_t ByteOrderMark = 0x01020304;
+		static constexpr size_t SectionAlignment = 64;
+
+		enum Section
+		{
+			NodeMins,
+			NodeMaxs = NodeMins + 3,
+			NodeLinks = NodeMaxs + 3,
+			NodeLeafBegin,
+			NodeLeafEnd,
+			LeafMins,
+			LeafMaxs = LeafMins + 3,
+			LeafOffsets = LeafMaxs + 3,
+			Elements,
+			ElementIndices,
+			ElementIsRepeat,
+			NodeSampleOffsets,
+			NodeSamples,
+			NumSections
+		};
+
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder;
+		// sizeof( ElementType ), the type itself is up to whoever loads the file
+		uint32_t elementSize;
+		uint32_t numNodes;
+		uint32_t numLeaves;
+		uint32_t numElements;
+		uint32_t numUniqueElements;
+		uint32_t numNodeSamples;
+		// Whatever Save was given, see FlatOctree::Save
+		uint64_t sourceKey;
+		uint64_t sections[NumSections];
+	};
+
+	// Read-only, pointer-free snapshot of a spatial::Octree, meant for walking it a lot
+	//
+	// Every node is a box and a 32-bit link: either the index of its first child (the other
+	// 7 come right after it), or LeafBit plus the leaf's index. Leaves are numbered depth-first
+	// and have their own arrays, so walking all leaves is a linear pass, and so is walking all
+	// elements, since they're copied over leaf by leaf. No pointers anywhere, so the whole
+	// thing can be written out as-is with Save, and Load maps the file and reads straight from it.
+	//
+	// Depth-first numbering also means every subtree's leaves are one contiguous range,
+	// which queries use to hand back whole subtrees at once.
+	//
+	// Every internal node also keeps a sample of what's under it, at most one element per cell
+	// of a LodCellsPerAxis³ grid over its box, so drawing can stop at nodes that are small
+	// on screen and draw their sample instead of everything below (see QueryLevelOfDetail).
+	//
+	// It doesn't follow the source tree around, call Build again after changing that.
+	template<typename ElementType>
+	class FlatOctree
+	{
+	public:
+		static constexpr uint32_t LeafBit = 1U << 31;
+		static constexpr size_t NumChildren = 8;
+		// Internal nodes' samples are picked on a grid this fine, so each child's half of it
+		// lines up with the cells of the child's own grid. With 8, samples take about half
+		// again as much room as the elements themselves for evenly spread points, 16 triples it
+		static constexpr uint32_t LodCellsPerAxis = 8;
+
+		static bool IsLeafLink( uint32_t link )
+		{
+			return link & LeafBit;
+		}
+
+		static uint32_t GetLeafIndex( uint32_t link )
+		{
+			return link & ~LeafBit;
+		}
+
+		FlatOctree() = default;
+		// The views below point into the arrays or the mapped file, so copies would point into
+		// the original. Moving keeps the same buffers, so that's fine
+		FlatOctree( const FlatOctree& ) = delete;
+		FlatOctree& operator=( const FlatOctree& ) = delete;
+		FlatOctree( FlatOctree&& ) = default;
+		FlatOctree& operator=( FlatOctree&& ) = default;
+
+		// Any octree of this ElementType, whether it runs on callbacks or on a Policy
+		template<typename Policy>
+		void Build( const Tree<ElementType, adm::AABB, 3, Policy>& tree )
+		{
+			snapshot.Close();
+			built.nodeBoxes.Clear();
+			built.nodeLinks.clear();
+			built.nodeLeafBegin.clear();
+			built.nodeLeafEnd.clear();
+			built.leafBoxes.Clear();
+			built.leafOffsets.clear();
+			built.elements.clear();
+			built.elementIndices.clear();
+			built.elementIsRepeat.clear();
+			built.numUniqueElements = 0;
+			built.nodeSampleOffsets.clear();
+			built.nodeSamples.clear();
+			ViewBuilt();
+
+			const auto& treeNodes = tree.GetNodes();
+			if ( treeNodes.empty() )
+			{
+				return;
+			}
+
+			// Nodes are visited in the same order as in the tree, minus the unused blocks
+			// incremental updates leave behind, so this is usually a straight copy
+			built.nodeBoxes.Resize( treeNodes.size() );
+			built.nodeLinks.reserve( treeNodes.size() );
+			built.leafBoxes.Resize( tree.GetLeaves().size() );
+			built.leafOffsets.reserve( tree.GetLeaves().size() + 1 );
+			built.leafOffsets.push_back( 0 );
+
+			size_t numElements = 0;
+			for ( const auto& leaf : tree.GetLeaves() )
+			{
+				numElements += size_t( leaf->GetNumElements() );
+			}
+			built.elements.reserve( numElements );
+			built.elementIndices.reserve( numElements );
+			built.elementIsRepeat.reserve( numElements );
+			seenElements.assign( tree.GetElements().size(), 0 );
+
+			built.nodeLinks.push_back( 0 );
+			built.nodeLeafBegin.push_back( 0 );
+			built.nodeLeafEnd.push_back( 0 );
+			built.nodeBoxes.Set( 0, treeNodes[0].GetBoundingVolume() );
+			built.nodeLinks[0] = AddNode( tree, 0, 0 );
+
+			built.nodeBoxes.Resize( built.nodeLinks.size() );
+			BuildNodeSamples();
+			ViewBuilt();
+		}
+
+		// Writes everything out in the FlatOctreeFileHeader format, returns false if the file couldn't be written
+		// The file is only readable by machines with the same byte order and the same ElementType layout.
+		// sourceKey is up to the caller, e.g. a hash of whatever the tree was generated from, and Load
+		// turns the file down unless it's given the same key, so a stale snapshot doesn't get used
+		bool Save( const char* path, uint64_t sourceKey = 0 ) const
+		{
+			static_assert( std::is_trivially_copyable_v<ElementType>, "Elements get written out byte for byte" );
+
+			const SectionData sectionData = GetSections();
+
+			FlatOctreeFileHeader header{};
+			std::memcpy( header.magic, FlatOctreeFileHeader::Magic, sizeof( header.magic ) );
+			header.version = FlatOctreeFileHeader::CurrentVersion;
+			header.byteOrder = FlatOctreeFileHeader::ByteOrderMark;
+			header.elementSize = uint32_t( sizeof( ElementType ) );
+			header.numNodes = uint32_t( GetNumNodes() );
+			header.numLeaves = uint32_t( GetNumLeaves() );
+			header.numElements = uint32_t( elements.Size() );
+			header.numUniqueElements = numUniqueElements;
+			header.numNodeSamples = uint32_t( nodeSamples.Size() );
+			header.sourceKey = sourceKey;
+
+			uint64_t offset = sizeof( FlatOctreeFileHeader );
+			for ( size_t i = 0; i < FlatOctreeFileHeader::NumSections; i++ )
+			{
+				offset = AlignSection( offset );
+				header.sections[i] = offset;
+				offset += sectionData.bytes[i];
+			}
+
+			std::ofstream file( path, std::ios::binary | std::ios::trunc );
+			if ( !file )
+			{
+				return false;
+			}
+
+			const char padding[FlatOctreeFileHeader::SectionAlignment]{};
+			file.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+			offset = sizeof( FlatOctreeFileHeader );
+			for ( size_t i = 0; i < FlatOctreeFileHeader::NumSections; i++ )
+			{
+				file.write( padding, std::streamsize( header.sections[i] - offset ) );
+				file.write( static_cast<const char*>( sectionData.data[i] ), std::streamsize( sectionData.bytes[i] ) );
+				offset = header.sections[i] + sectionData.bytes[i];
+			}
+
+			return bool( file.flush() );
+		}
+
+		// Maps a file written by Save and queries straight out of it, nothing gets copied
+		// and pages are only read in as queries touch them. The header and section table are
+		// checked, the contents aren't. Returns false and leaves the octree as it was if the
+		// file is missing, from a different version, doesn't match this ElementType, or was
+		// saved with a different sourceKey
+		bool Load( const char* path, uint64_t sourceKey = 0 )
+		{
+			static_assert( std::is_trivially_copyable_v<ElementType>, "Elements get read back byte for byte" );
+
+			MappedFile file;
+			if ( !file.Open( path ) || file.GetSize() < sizeof( FlatOctreeFileHeader ) )
+			{
+				return false;
+			}
+
+			FlatOctreeFileHeader header;
+			std::memcpy( &header, file.GetData(), sizeof( header ) );
+			if ( std::memcmp( header.magic, FlatOctreeFileHeader::Magic, sizeof( header.magic ) ) != 0
+				|| header.version != FlatOctreeFileHeader::CurrentVersion
+				|| header.byteOrder != FlatOctreeFileHeader::ByteOrderMark
+				|| header.elementSize != sizeof( ElementType )
+				|| header.sourceKey != sourceKey )
+			{
+				return false;
+			}
+
+			// An empty octree still has its one leaf offset
+			const bool isEmpty = header.numNodes == 0;
+			if ( isEmpty != (header.numLeaves == 0) )
+			{
+				return false;
+			}
+
+			const uint64_t counts[FlatOctreeFileHeader::NumSections] =
+			{
+				header.numNodes, header.numNodes, header.numNodes,
+				header.numNodes, header.numNodes, header.numNodes,
+				header.numNodes, header.numNodes, header.numNodes,
+				header.numLeaves, header.numLeaves, header.numLeaves,
+				header.numLeaves, header.numLeaves, header.numLeaves,
+				isEmpty ? 0U : header.numLeaves + 1U,
+				header.numElements, header.numElements, header.numElements,
+				isEmpty ? 0U : header.numNodes + 1U,
+				header.numNodeSamples
+			};
+
+			const void* pointers[FlatOctreeFileHeader::NumSections];
+			for ( size_t i = 0; i < FlatOctreeFileHeader::NumSections; i++ )
+			{
+				const uint64_t offset = header.sections[i];
+				const uint64_t bytes = counts[i] * GetSectionElementSize( i );
+				if ( offset % FlatOctreeFileHeader::SectionAlignment != 0 || offset > file.GetSize() || bytes > file.GetSize() - offset )
+				{
+					return false;
+				}
+
+				pointers[i] = file.GetData() + offset;
+			}
+
+			const auto floats = [&]( size_t section )
+			{
+				return Span<const float>( static_cast<const float*>( pointers[section] ), size_t( counts[section] ) );
+			};
+			const auto uints = [&]( size_t section )
+			{
+				return Span<const uint32_t>( static_cast<const uint32_t*>( pointers[section] ), size_t( counts[section] ) );
+			};
+
+			for ( size_t axis = 0; axis < 3; axis++ )
+			{
+				nodeBoxes.mins[axis] = floats( FlatOctreeFileHeader::NodeMins + axis );
+				nodeBoxes.maxs[axis] = floats( FlatOctreeFileHeader::NodeMaxs + axis );
+				leafBoxes.mins[axis] = floats( FlatOctreeFileHeader::LeafMins + axis );
+				leafBoxes.maxs[axis] = floats( FlatOctreeFileHeader::LeafMaxs + axis );
+			}
+			nodeLinks = uints( FlatOctreeFileHeader::NodeLinks );
+			nodeLeafBegin = uints( FlatOctreeFileHeader::NodeLeafBegin );
+			nodeLeafEnd = uints( FlatOctreeFileHeader::NodeLeafEnd );
+			leafOffsets = uints( FlatOctreeFileHeader::LeafOffsets );
+			elements = { static_cast<const ElementType*>( pointers[FlatOctreeFileHeader::Elements] ), size_t( header.numElements ) };
+			elementIndices = uints( FlatOctreeFileHeader::ElementIndices );
+			elementIsRepeat = { static_cast<const uint8_t*>( pointers[FlatOctreeFileHeader::ElementIsRepeat] ), size_t( header.numElements ) };
+			numUniqueElements = header.numUniqueElements;
+			nodeSampleOffsets = uints( FlatOctreeFileHeader::NodeSampleOffsets );
+			nodeSamples = { static_cast<const ElementType*>( pointers[FlatOctreeFileHeader::NodeSamples] ), size_t( header.numNodeSamples ) };
+
+			// Nothing of the last build is needed anymore
+			built = {};
+			seenElements = {};
+			snapshot = std::move( file );
+			return true;
+		}
+
+		// Sorts leaves by whether they're in the frustum, and calls
+		// function( uint32_t firstLeaf, uint32_t endLeaf, Containment containment )
+		// for every range of leaves [firstLeaf, endLeaf) that share a classification.
+		// Subtrees that are entirely inside or outside come back as one range without
+		// being walked, and inside a subtree, only the planes its parent straddles get tested.
+		template<typename FunctionType>
+		void QueryFrustum( const Frustum& frustum, FunctionType&& function ) const
+		{
+			if ( nodeLinks.Empty() )
+			{
+				return;
+			}
+
+			uint32_t rootPlanes = 0;
+			const Containment rootContainment = frustum.Classify( nodeBoxes[0], Frustum::AllPlanes, rootPlanes );
+			if ( rootContainment != Containment::Partial || IsLeafLink( nodeLinks[0] ) )
+			{
+				function( nodeLeafBegin[0], nodeLeafEnd[0], rootContainment );
+				return;
+			}
+
+			struct Entry
+			{
+				uint32_t firstChild;
+				uint32_t planeMask;
+			};
+
+			// Every level adds at most 7 more entries than it takes
+			Entry stack[32 * NumChildren];
+			uint32_t stackSize = 0;
+			stack[stackSize++] = { nodeLinks[0], rootPlanes };
+
+			while ( stackSize > 0 )
+			{
+				const Entry entry = stack[--stackSize];
+
+				Containment containments[NumChildren];
+				uint32_t planeMasks[NumChildren];
+				ClassifyChildren( frustum, entry.firstChild, entry.planeMask, containments, planeMasks );
+
+				for ( uint32_t c = 0; c < NumChildren; c++ )
+				{
+					const uint32_t child = entry.firstChild + c;
+					const uint32_t link = nodeLinks[child];
+					if ( containments[c] == Containment::Partial && !IsLeafLink( link ) )
+					{
+						stack[stackSize++] = { link, planeMasks[c] };
+						continue;
+					}
+
+					function( nodeLeafBegin[child], nodeLeafEnd[child], containments[c] );
+				}
+			}
+		}
+
+		// Picks a cut through the tree for drawing, where everything is about as detailed as the
+		// screen can show. Walks down from the root, skipping whatever's outside the frustum, and
+		// stops at nodes whose sample spacing (their size over LodCellsPerAxis) would be at most
+		// maxPixelSpacing pixels apart on screen, seen from the nearest spot of the node.
+		// Calls function( uint32_t node, Span<const ElementType> elements ) for each node in the
+		// cut, with the node's sample, or all of a leaf's elements if it got down to a leaf.
+		//
+		// pixelsPerUnit is how many pixels one unit covers at a distance of one unit, that's
+		// the projection's vertical scale (projection[1][1]) times half the viewport's height.
+		// Nothing small enough on screen gets drawn in more detail, so the number of elements
+		// drawn is bounded by the screen's resolution rather than by how many there are.
+		template<typename FunctionType>
+		void QueryLevelOfDetail( const Frustum& frustum, const adm::Vec3& eye, float pixelsPerUnit,
+			FunctionType&& function, float maxPixelSpacing = 1.0f ) const
+		{
+			if ( nodeLinks.Empty() )
+			{
+				return;
+			}
+
+			struct Entry
+			{
+				uint32_t node;
+				uint32_t planeMask;
+			};
+
+			Entry stack[32 * NumChildren];
+			uint32_t stackSize = 0;
+
+			uint32_t rootPlanes = 0;
+			if ( frustum.Classify( nodeBoxes[0], Frustum::AllPlanes, rootPlanes ) == Containment::Outside )
+			{
+				return;
+			}
+			stack[stackSize++] = { 0, rootPlanes };
+
+			const float maxSpacing = maxPixelSpacing * float( LodCellsPerAxis ) / pixelsPerUnit;
+			while ( stackSize > 0 )
+			{
+				const Entry entry = stack[--stackSize];
+				const uint32_t link = nodeLinks[entry.node];
+				if ( IsLeafLink( link ) )
+				{
+					function( entry.node, GetLeafElements( GetLeafIndex( link ) ) );
+					continue;
+				}
+
+				// Compared squared, the eye can be inside the node, in which case it's never small enough
+				const adm::AABB box = nodeBoxes[entry.node];
+				const adm::Vec3 size = box.maxs - box.mins;
+				const float largest = std::max( size.x, std::max( size.y, size.z ) );
+				if ( largest * largest <= maxSpacing * maxSpacing * DistanceSquaredToBox( box, eye ) )
+				{
+					function( entry.node, GetNodeSamples( entry.node ) );
+					continue;
+				}
+
+				Containment containments[NumChildren];
+				uint32_t planeMasks[NumChildren];
+				ClassifyChildren( frustum, link, entry.planeMask, containments, planeMasks );
+
+				for ( uint32_t c = 0; c < NumChildren; c++ )
+				{
+					if ( containments[c] != Containment::Outside )
+					{
+						stack[stackSize++] = { link + c, planeMasks[c] };
+					}
+				}
+			}
+		}
+
+		size_t GetNumNodes() const
+		{
+			return nodeLinks.Size();
+		}
+
+		size_t GetNumLeaves() const
+		{
+			return leafBoxes.Size();
+		}
+
+		// How many different elements there are, not counting repeats on leaf boundaries
+		size_t GetNumUniqueElements() const
+		{
+			return numUniqueElements;
+		}
+
+		// Whether this is reading from a file given to Load, rather than from a Build
+		bool IsMapped() const
+		{
+			return snapshot.IsOpen();
+		}
+
+		// The root is node 0
+		const BoxArrayView& GetNodeBoxes() const
+		{
+			return nodeBoxes;
+		}
+
+		Span<const uint32_t> GetNodeLinks() const
+		{
+			return nodeLinks;
+		}
+
+		const BoxArrayView& GetLeafBoxes() const
+		{
+			return leafBoxes;
+		}
+
+		// Nearest element along the ray, hitTest is
+		// bool( const ElementType& element, const adm::Vec3& origin, const adm::Vec3& direction, float& outDistance )
+		// e.g. utils::RayHitsPoint. Children are visited nearest-first, and anything that starts
+		// further away than the closest hit so far is skipped.
+		// Elements that are hit from a distance, like points with a radius, can be hit by rays that
+		// never enter their leaf, `margin` is how far they reach out so boxes get grown by that much
+		template<typename HitFunction>
+		RayHit Raycast( const Ray& ray, HitFunction&& hitTest, float margin = 0.0f ) const
+		{
+			RayHit hit;
+			hit.distance = ray.maxDistance;
+			if ( nodeLinks.Empty() )
+			{
+				return hit;
+			}
+
+			const adm::Vec3 inverseDirection( 1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z );
+
+			struct Entry
+			{
+				uint32_t node;
+				float enter;
+			};
+
+			Entry stack[32 * NumChildren];
+			uint32_t stackSize = 0;
+
+			float rootEnter;
+			if ( RayHitsBox( ray.origin, inverseDirection, hit.distance, Grow( nodeBoxes[0], margin ), rootEnter ) )
+			{
+				stack[stackSize++] = { 0, rootEnter };
+			}
+
+			while ( stackSize > 0 )
+			{
+				const Entry entry = stack[--stackSize];
+				if ( entry.enter > hit.distance )
+				{
+					continue;
+				}
+
+				const uint32_t link = nodeLinks[entry.node];
+				if ( IsLeafLink( link ) )
+				{
+					const uint32_t leaf = GetLeafIndex( link );
+					for ( uint32_t i = leafOffsets[leaf]; i < leafOffsets[leaf + 1]; i++ )
+					{
+						float distance;
+						if ( hitTest( elements[i], ray.origin, ray.direction, distance ) && distance < hit.distance )
+						{
+							hit.element = elementIndices[i];
+							hit.flatElement = i;
+							hit.distance = distance;
+						}
+					}
+					continue;
+				}
+
+				float enters[NumChildren];
+				uint32_t mask = ChildrenHitByRay( link, ray.origin, inverseDirection, hit.distance, margin, enters );
+
+				// Furthest goes on the stack first, so the nearest comes off first
+				Entry sorted[NumChildren];
+				uint32_t numSorted = 0;
+				for ( ; mask; mask &= mask - 1 )
+				{
+					const uint32_t c = CountTrailingZeros( mask );
+					uint32_t at = numSorted++;
+					for ( ; at > 0 && sorted[at - 1].enter < enters[c]; at-- )
+					{
+						sorted[at] = sorted[at - 1];
+					}
+					sorted[at] = { link + c, enters[c] };
+				}
+
+				for ( uint32_t i = 0; i < numSorted; i++ )
+				{
+					stack[stackSize++] = sorted[i];
+				}
+			}
+
+			return hit;
+		}
+
+		// Traces Width rays at once, one hit per ray goes into outHits
+		// The packet walks the tree as a whole: a node is visited if any of the rays still
+		// needs it, and boxes are slab-tested against all the rays in one go (SSE for 4, AVX for 8).
+		// If hitTest also has a packet version (see utils::RayHitsPoint), elements get tested
+		// against all the rays in one go too
+		template<size_t Width, typename HitFunction>
+		void RaycastPacket( const RayPacket<Width>& packet, HitFunction&& hitTest, RayHit* outHits, float margin = 0.0f ) const
+		{
+			float closest[Width];
+			for ( size_t lane = 0; lane < Width; lane++ )
+			{
+				outHits[lane] = RayHit();
+				closest[lane] = packet.maxDistances[lane];
+			}
+
+			if ( nodeLinks.Empty() )
+			{
+				return;
+			}
+
+			// Children nearest to where the rays come from go first, going by the first ray,
+			// which is as good as any other when they're coherent
+			uint32_t nearestChild = 0;
+			for ( size_t axis = 0; axis < 3; axis++ )
+			{
+				if ( packet.directions[axis][0] < 0.0f )
+				{
+					nearestChild |= 1U << axis;
+				}
+			}
+
+			uint32_t stack[32 * NumChildren];
+			uint32_t stackSize = 0;
+			stack[stackSize++] = 0;
+
+			while ( stackSize > 0 )
+			{
+				const uint32_t node = stack[--stackSize];
+				uint32_t mask = PacketHitsBox( packet, closest, Grow( nodeBoxes[node], margin ) );
+				if ( !mask )
+				{
+					continue;
+				}
+
+				const uint32_t link = nodeLinks[node];
+				if ( !IsLeafLink( link ) )
+				{
+					for ( uint32_t i = NumChildren; i > 0; i-- )
+					{
+						stack[stackSize++] = link + ((i - 1) ^ nearestChild);
+					}
+					continue;
+				}
+
+				const uint32_t leaf = GetLeafIndex( link );
+				if constexpr ( utils::HasPacketHitTest<std::decay_t<HitFunction>, ElementType, Width>::value )
+				{
+					float distances[Width];
+					for ( uint32_t i = leafOffsets[leaf]; i < leafOffsets[leaf + 1]; i++ )
+					{
+						for ( uint32_t hitMask = hitTest( elements[i], packet, mask, distances ); hitMask; hitMask &= hitMask - 1 )
+						{
+							const uint32_t lane = CountTrailingZeros( hitMask );
+							if ( distances[lane] < closest[lane] )
+							{
+								outHits[lane].element = elementIndices[i];
+								outHits[lane].flatElement = i;
+								outHits[lane].distance = distances[lane];
+								closest[lane] = distances[lane];
+							}
+						}
+					}
+					continue;
+				}
+
+				for ( ; mask; mask &= mask - 1 )
+				{
+					const uint32_t lane = CountTrailingZeros( mask );
+					const adm::Vec3 origin( packet.origins[0][lane], packet.origins[1][lane], packet.origins[2][lane] );
+					const adm::Vec3 direction( packet.directions[0][lane], packet.directions[1][lane], packet.directions[2][lane] );
+
+					for ( uint32_t i = leafOffsets[leaf]; i < leafOffsets[leaf + 1]; i++ )
+					{
+						float distance;
+						if ( hitTest( elements[i], origin, direction, distance ) && distance < closest[lane] )
+						{
+							outHits[lane].element = elementIndices[i];
+							outHits[lane].flatElement = i;
+							outHits[lane].distance = distance;
+							closest[lane] = distance;
+						}
+					}
+				}
+			}
+		}
+
+		// Up to k elements nearest to `point` and no further than `maxDistance`, written into
+		// outNeighbours nearest-first, returns how many were found. outNeighbours has room for k,
+		// and doubles as the heap during the query, so nothing gets allocated.
+		// Children are visited nearest-first, and anything further away than the k-th nearest
+		// so far is skipped. distanceSquared is float( const ElementType& element, const adm::Vec3& point ),
+		// and must never be less than the distance to the element's leaf, which holds for points
+		template<typename DistanceFunction = utils::PointDistanceSquared>
+		size_t FindKNearest( const adm::Vec3& point, size_t k, Neighbour* outNeighbours,
+			float maxDistance = FLT_MAX, DistanceFunction distanceSquared = DistanceFunction() ) const
+		{
+			const float maxDistanceSquared = maxDistance < FLT_MAX ? maxDistance * maxDistance : FLT_MAX;
+			NeighbourHeap heap( outNeighbours, k, maxDistanceSquared );
+			if ( nodeLinks.Empty() || k == 0 )
+			{
+				return 0;
+			}
+
+			struct Entry
+			{
+				uint32_t node;
+				float distanceSquared;
+			};
+
+			Entry stack[32 * NumChildren];
+			uint32_t stackSize = 0;
+			stack[stackSize++] = { 0, DistanceSquaredToBox( nodeBoxes[0], point ) };
+
+			while ( stackSize > 0 )
+			{
+				const Entry entry = stack[--stackSize];
+				if ( entry.distanceSquared > heap.GetBound() )
+				{
+					continue;
+				}
+
+				const uint32_t link = nodeLinks[entry.node];
+				if ( IsLeafLink( link ) )
+				{
+					const uint32_t leaf = GetLeafIndex( link );
+					for ( uint32_t i = leafOffsets[leaf]; i < leafOffsets[leaf + 1]; i++ )
+					{
+						if ( !elementIsRepeat[i] )
+						{
+							heap.Offer( elementIndices[i], distanceSquared( elements[i], point ) );
+						}
+					}
+					continue;
+				}
+
+				float nearest[NumChildren];
+				float furthest[NumChildren];
+				ChildDistancesSquared( link, point, nearest, furthest );
+
+				// Furthest goes on the stack first, so the nearest comes off first
+				const float bound = heap.GetBound();
+				Entry sorted[NumChildren];
+				uint32_t numSorted = 0;
+				for ( uint32_t c = 0; c < NumChildren; c++ )
+				{
+					if ( nearest[c] > bound )
+					{
+						continue;
+					}
+
+					uint32_t at = numSorted++;
+					for ( ; at > 0 && sorted[at - 1].distanceSquared < nearest[c]; at-- )
+					{
+						sorted[at] = sorted[at - 1];
+					}
+					sorted[at] = { link + c, nearest[c] };
+				}
+
+				for ( uint32_t i = 0; i < numSorted; i++ )
+				{
+					stack[stackSize++] = sorted[i];
+				}
+			}
+
+			return heap.Finish();
+		}
+
+		// FindKNearest for a whole batch of points, results for points[i] go into
+		// outNeighbours[i * k] onwards and their count into outCounts[i].
+		// Points are visited in Morton order rather than the order they come in, so consecutive
+		// queries walk mostly the same nodes and find them still in cache
+		template<typename DistanceFunction = utils::PointDistanceSquared>
+		void FindKNearestBatch( Span<const adm::Vec3> points, size_t k, Neighbour* outNeighbours, uint32_t* outCounts,
+			QueryBatchScratch& scratch, float maxDistance = FLT_MAX, DistanceFunction distanceSquared = DistanceFunction() ) const
+		{
+			if ( nodeLinks.Empty() )
+			{
+				std::fill( outCounts, outCounts + points.Size(), 0U );
+				return;
+			}
+
+			const morton::PointEncoder encoder( nodeBoxes[0] );
+			scratch.order.resize( points.Size() );
+			for ( size_t i = 0; i < points.Size(); i++ )
+			{
+				scratch.order[i] = { encoder( points[i] ), uint32_t( i ) };
+			}
+			morton::RadixSort( scratch.order, scratch.sortScratch );
+
+			for ( const morton::KeyIndex& query : scratch.order )
+			{
+				outCounts[query.index] = uint32_t( FindKNearest( points[query.index], k,
+					outNeighbours + size_t( query.index ) * k, maxDistance, distanceSquared ) );
+			}
+		}
+
+		// Calls function( uint32_t element, float distanceSquared ) for every element within
+		// `radius` of `point`, in no particular order. Subtrees entirely within the radius
+		// are handed over as one run of elements without walking down them
+		template<typename FunctionType, typename DistanceFunction = utils::PointDistanceSquared>
+		void ForEachWithinRadius( const adm::Vec3& point, float radius, FunctionType&& function,
+			DistanceFunction distanceSquared = DistanceFunction() ) const
+		{
+			if ( nodeLinks.Empty() )
+			{
+				return;
+			}
+
+			const float radiusSquared = radius * radius;
+			const auto reportElements = [&]( uint32_t first, uint32_t end, bool check )
+			{
+				for ( uint32_t i = first; i < end; i++ )
+				{
+					if ( elementIsRepeat[i] )
+					{
+						continue;
+					}
+
+					const float distance = distanceSquared( elements[i], point );
+					if ( !check || distance <= radiusSquared )
+					{
+						function( elementIndices[i], distance );
+					}
+				}
+			};
+
+			if ( DistanceSquaredToBox( nodeBoxes[0], point ) > radiusSquared )
+			{
+				return;
+			}
+
+			uint32_t stack[32 * NumChildren];
+			uint32_t stackSize = 0;
+			stack[stackSize++] = 0;
+
+			while ( stackSize > 0 )
+			{
+				const uint32_t node = stack[--stackSize];
+				const uint32_t link = nodeLinks[node];
+				if ( IsLeafLink( link ) )
+				{
+					const uint32_t leaf = GetLeafIndex( link );
+					reportElements( leafOffsets[leaf], leafOffsets[leaf + 1], true );
+					continue;
+				}
+
+				float nearest[NumChildren];
+				float furthest[NumChildren];
+				ChildDistancesSquared( link, point, nearest, furthest );
+
+				for ( uint32_t c = 0; c < NumChildren; c++ )
+				{
+					const uint32_t child = link + c;
+					if ( nearest[c] > radiusSquared )
+					{
+						continue;
+					}
+
+					if ( furthest[c] <= radiusSquared )
+					{
+						reportElements( leafOffsets[nodeLeafBegin[child]], leafOffsets[nodeLeafEnd[child]], false );
+						continue;
+					}
+
+					stack[stackSize++] = child;
+				}
+			}
+		}
+
+		// ForEachWithinRadius into an array, returns how many were found
+		// Only the first `capacity` make it into outNeighbours, if there are more than that
+		template<typename DistanceFunction = utils::PointDistanceSquared>
+		size_t FindWithinRadius( const adm::Vec3& point, float radius, Neighbour* outNeighbours, size_t capacity,
+			DistanceFunction distanceSquared = DistanceFunction() ) const
+		{
+			size_t count = 0;
+			ForEachWithinRadius( point, radius, [&]( uint32_t element, float distance )
+				{
+					if ( count < capacity )
+					{
+						outNeighbours[count] = { element, distance };
+					}
+					count++;
+				}, distanceSquared );
+
+			return count;
+		}
+
+		// Leaves of the subtree under a node are [begin[node], end[node])
+		Span<const uint32_t> GetNodeLeafBegin() const
+		{
+			return nodeLeafBegin;
+		}
+
+		Span<const uint32_t> GetNodeLeafEnd() const
+		{
+			return nodeLeafEnd;
+		}
+
+		// Leaf i holds elements [offsets[i], offsets[i + 1]), there's one more offset than there are leaves
+		Span<const uint32_t> GetLeafOffsets() const
+		{
+			return leafOffsets;
+		}
+
+		// All leaves' elements back to back, in leaf order
+		// Elements on a boundary between leaves are in there once per leaf
+		Span<const ElementType> GetElements() const
+		{
+			return elements;
+		}
+
+		// Where each of GetElements() came from in the source tree's GetElements()
+		Span<const uint32_t> GetElementIndices() const
+		{
+			return elementIndices;
+		}
+
+		Span<const ElementType> GetLeafElements( size_t leafIndex ) const
+		{
+			return { elements.Data() + leafOffsets[leafIndex], size_t( leafOffsets[leafIndex + 1] - leafOffsets[leafIndex] ) };
+		}
+
+		// What a node looks like from afar, empty for leaves
+		// Copies of elements from the leaves below, no repeats
+		Span<const ElementType> GetNodeSamples( size_t nodeIndex ) const
+		{
+			return { nodeSamples.Data() + nodeSampleOffsets[nodeIndex], size_t( nodeSampleOffsets[nodeIndex + 1] - nodeSampleOffsets[nodeIndex] ) };
+		}
+
+	private:
+		struct SectionData
+		{
+			const void* data[FlatOctreeFileHeader::NumSections];
+			uint64_t bytes[FlatOctreeFileHeader::NumSections];
+		};
+
+		template<typename T>
+		static Span<const T> View( const adm::Vector<T>& vector )
+		{
+			return { vector.data(), vector.size() };
+		}
+
+		static uint64_t AlignSection( uint64_t offset )
+		{
+			return (offset + FlatOctreeFileHeader::SectionAlignment - 1) & ~uint64_t( FlatOctreeFileHeader::SectionAlignment - 1 );
+		}
+
+		static size_t GetSectionElementSize( size_t section )
+		{
+			switch ( section )
+			{
+			case FlatOctreeFileHeader::Elements: return sizeof( ElementType );
+			case FlatOctreeFileHeader::NodeSamples: return sizeof( ElementType );
+			case FlatOctreeFileHeader::ElementIsRepeat: return sizeof( uint8_t );
+			default: return sizeof( uint32_t );
+			}
+		}
+
+		// Points the views at what Build just made
+		void ViewBuilt()
+		{
+			nodeBoxes = built.nodeBoxes;
+			nodeLinks = View( built.nodeLinks );
+			nodeLeafBegin = View( built.nodeLeafBegin );
+			nodeLeafEnd = View( built.nodeLeafEnd );
+			leafBoxes = built.leafBoxes;
+			leafOffsets = View( built.leafOffsets );
+			elements = View( built.elements );
+			elementIndices = View( built.elementIndices );
+			elementIsRepeat = View( built.elementIsRepeat );
+			numUniqueElements = built.numUniqueElements;
+			nodeSampleOffsets = View( built.nodeSampleOffsets );
+			nodeSamples = View( built.nodeSamples );
+		}
+
+		// In the same order as FlatOctreeFileHeader::Section
+		SectionData GetSections() const
+		{
+			SectionData sections{};
+			const auto set = [&]( size_t section, const auto& span )
+			{
+				sections.data[section] = span.Data();
+				sections.bytes[section] = span.Size() * sizeof( span[0] );
+			};
+
+			for ( size_t axis = 0; axis < 3; axis++ )
+			{
+				set( FlatOctreeFileHeader::NodeMins + axis, nodeBoxes.mins[axis] );
+				set( FlatOctreeFileHeader::NodeMaxs + axis, nodeBoxes.maxs[axis] );
+				set( FlatOctreeFileHeader::LeafMins + axis, leafBoxes.mins[axis] );
+				set( FlatOctreeFileHeader::LeafMaxs + axis, leafBoxes.maxs[axis] );
+			}
+			set( FlatOctreeFileHeader::NodeLinks, nodeLinks );
+			set( FlatOctreeFileHeader::NodeLeafBegin, nodeLeafBegin );
+			set( FlatOctreeFileHeader::NodeLeafEnd, nodeLeafEnd );
+			set( FlatOctreeFileHeader::LeafOffsets, leafOffsets );
+			set( FlatOctreeFileHeader::Elements, elements );
+			set( FlatOctreeFileHeader::ElementIndices, elementIndices );
+			set( FlatOctreeFileHeader::ElementIsRepeat, elementIsRepeat );
+			set( FlatOctreeFileHeader::NodeSampleOffsets, nodeSampleOffsets );
+			set( FlatOctreeFileHeader::NodeSamples, nodeSamples );
+			return sections;
+		}
+
+		// Classifies a whole sibling block against the planes in `planeMask`
+		// The block's boxes are next to each other in every SoA array, so each plane is
+		// a handful of 4-wide loads, multiplies and compares per 4 children
+		void ClassifyChildren( const Frustum& frustum, uint32_t firstChild, uint32_t planeMask,
+			Containment* outContainments, uint32_t* outPlaneMasks ) const
+		{
+#if defined( SPATIAL_SSE )
+			for ( uint32_t group = 0; group < NumChildren; group += 4 )
+			{
+				const uint32_t first = firstChild + group;
+				int outside = 0;
+				int straddling[Frustum::NumPlanes]{};
+
+				for ( size_t i = 0; i < Frustum::NumPlanes; i++ )
+				{
+					if ( !(planeMask & (1U << i)) )
+					{
+						continue;
+					}
+
+					const Plane& plane = frustum.GetPlane( i );
+					__m128 positive = _mm_set1_ps( plane.distance );
+					__m128 negative = positive;
+					for ( size_t axis = 0; axis < 3; axis++ )
+					{
+						const float normal = (&plane.normal.x)[axis];
+						const __m128 mins = _mm_loadu_ps( &nodeBoxes.mins[axis][first] );
+						const __m128 maxs = _mm_loadu_ps( &nodeBoxes.maxs[axis][first] );
+						const __m128 normals = _mm_set1_ps( normal );
+
+						positive = _mm_add_ps( positive, _mm_mul_ps( normals, normal > 0.0f ? maxs : mins ) );
+						negative = _mm_add_ps( negative, _mm_mul_ps( normals, normal > 0.0f ? mins : maxs ) );
+					}
+
+					const __m128 zero = _mm_setzero_ps();
+					outside |= _mm_movemask_ps( _mm_cmplt_ps( positive, zero ) );
+					straddling[i] = _mm_movemask_ps( _mm_cmplt_ps( negative, zero ) );
+				}
+
+				for ( uint32_t lane = 0; lane < 4; lane++ )
+				{
+					uint32_t mask = 0;
+					for ( size_t i = 0; i < Frustum::NumPlanes; i++ )
+					{
+						mask |= uint32_t( (straddling[i] >> lane) & 1 ) << i;
+					}
+
+					outPlaneMasks[group + lane] = mask;
+					outContainments[group + lane] = (outside >> lane) & 1 ? Containment::Outside
+						: mask ? Containment::Partial : Containment::Inside;
+				}
+			}
+#else
+			for ( uint32_t c = 0; c < NumChildren; c++ )
+			{
+				outContainments[c] = frustum.Classify( nodeBoxes[firstChild + c], planeMask, outPlaneMasks[c] );
+			}
+#endif
+		}
+
+		// Slab test of one ray against a whole sibling block, 4 children at a time
+		// Returns a bit per child the ray enters before `maxDistance`, and where it enters them
+		uint32_t ChildrenHitByRay( uint32_t firstChild, const adm::Vec3& origin, const adm::Vec3& inverseDirection,
+			float maxDistance, float margin, float* outEnters ) const
+		{
+			uint32_t mask = 0;
+#if defined( SPATIAL_SSE )
+			for ( uint32_t group = 0; group < NumChildren; group += 4 )
+			{
+				const uint32_t first = firstChild + group;
+				__m128 enter = _mm_setzero_ps();
+				__m128 leave = _mm_set1_ps( maxDistance );
+				for ( size_t axis = 0; axis < 3; axis++ )
+				{
+					// Shifting the origin instead of growing the boxes, same thing
+					const __m128 startMins = _mm_set1_ps( (&origin.x)[axis] + margin );
+					const __m128 startMaxs = _mm_set1_ps( (&origin.x)[axis] - margin );
+					const __m128 inverse = _mm_set1_ps( (&inverseDirection.x)[axis] );
+					const __m128 t1 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( &nodeBoxes.mins[axis][first] ), startMins ), inverse );
+					const __m128 t2 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( &nodeBoxes.maxs[axis][first] ), startMaxs ), inverse );
+					enter = _mm_max_ps( enter, _mm_min_ps( t1, t2 ) );
+					leave = _mm_min_ps( leave, _mm_max_ps( t1, t2 ) );
+				}
+
+				_mm_storeu_ps( outEnters + group, enter );
+				mask |= uint32_t( _mm_movemask_ps( _mm_cmple_ps( enter, leave ) ) ) << group;
+			}
+#else
+			for ( uint32_t c = 0; c < NumChildren; c++ )
+			{
+				if ( RayHitsBox( origin, inverseDirection, maxDistance, Grow( nodeBoxes[firstChild + c], margin ), outEnters[c] ) )
+				{
+					mask |= 1U << c;
+				}
+			}
+#endif
+			return mask;
+		}
+
+		// Squared distances from a point to the nearest and furthest spots of each box in a sibling block
+		void ChildDistancesSquared( uint32_t firstChild, const adm::Vec3& point, float* outNearest, float* outFurthest ) const
+		{
+#if defined( SPATIAL_SSE )
+			const __m128 zero = _mm_setzero_ps();
+			for ( uint32_t group = 0; group < NumChildren; group += 4 )
+			{
+				const uint32_t first = firstChild + group;
+				__m128 nearest = zero;
+				__m128 furthest = zero;
+				for ( size_t axis = 0; axis < 3; axis++ )
+				{
+					const __m128 coordinate = _mm_set1_ps( (&point.x)[axis] );
+					const __m128 toMins = _mm_sub_ps( _mm_loadu_ps( &nodeBoxes.mins[axis][first] ), coordinate );
+					const __m128 toMaxs = _mm_sub_ps( coordinate, _mm_loadu_ps( &nodeBoxes.maxs[axis][first] ) );
+					// Outside the slab on one side at most, so one of these is the gap and the other is negative
+					const __m128 gap = _mm_max_ps( zero, _mm_max_ps( toMins, toMaxs ) );
+					// Further of the two faces, both are negated so they're non-negative
+					const __m128 span = _mm_max_ps( _mm_sub_ps( zero, toMins ), _mm_sub_ps( zero, toMaxs ) );
+					nearest = _mm_add_ps( nearest, _mm_mul_ps( gap, gap ) );
+					furthest = _mm_add_ps( furthest, _mm_mul_ps( span, span ) );
+				}
+
+				_mm_storeu_ps( outNearest + group, nearest );
+				_mm_storeu_ps( outFurthest + group, furthest );
+			}
+#else
+			for ( uint32_t c = 0; c < NumChildren; c++ )
+			{
+				const adm::AABB box = nodeBoxes[firstChild + c];
+				outNearest[c] = DistanceSquaredToBox( box, point );
+
+				float furthest = 0.0f;
+				for ( size_t axis = 0; axis < 3; axis++ )
+				{
+					const float span = std::max( (&point.x)[axis] - (&box.mins.x)[axis], (&box.maxs.x)[axis] - (&point.x)[axis] );
+					furthest += span * span;
+				}
+				outFurthest[c] = furthest;
+			}
+#endif
+		}
+
+		static float DistanceSquaredToBox( const adm::AABB& box, const adm::Vec3& point )
+		{
+			float distance = 0.0f;
+			for ( size_t axis = 0; axis < 3; axis++ )
+			{
+				const float gap = std::max( 0.0f, std::max( (&box.mins.x)[axis] - (&point.x)[axis], (&point.x)[axis] - (&box.maxs.x)[axis] ) );
+				distance += gap * gap;
+			}
+
+			return distance;
+		}
+
+		static adm::AABB Grow( adm::AABB box, float margin )
+		{
+			box.mins -= adm::Vec3( margin );
+			box.maxs += adm::Vec3( margin );
+			return box;
+		}
+
+		static uint32_t CountTrailingZeros( uint32_t mask )
+		{
+			uint32_t count = 0;
+			for ( ; !(mask & 1); mask >>= 1 )
+			{
+				count++;
+			}
+
+			return count;
+		}
+
+		// Returns the link for tree node `nodeIndex`, whose box has already been written
+		// into flat node `flatIndex`
+		template<typename Policy>
+		uint32_t AddNode( const Tree<ElementType, adm::AABB, 3, Policy>& tree, int32_t nodeIndex, uint32_t flatIndex )
+		{
+			const auto& node = tree.GetNodes()[nodeIndex];
+			built.nodeLeafBegin[flatIndex] = uint32_t( built.leafOffsets.size() - 1 );
+			if ( node.IsLeaf() )
+			{
+				const uint32_t leafIndex = uint32_t( built.leafOffsets.size() - 1 );
+				built.nodeLeafEnd[flatIndex] = leafIndex + 1;
+				built.leafBoxes.Set( leafIndex, node.GetBoundingVolume() );
+
+				const Span<const ElementType> leafElements = node.GetElementSpan();
+				const Span<const uint32_t> leafIndices = node.GetElementIndices();
+				built.elements.insert( built.elements.end(), leafElements.begin(), leafElements.end() );
+				built.elementIndices.insert( built.elementIndices.end(), leafIndices.begin(), leafIndices.end() );
+				for ( const uint32_t& index : leafIndices )
+				{
+					built.elementIsRepeat.push_back( seenElements[index] );
+					built.numUniqueElements += 1U - seenElements[index];
+					seenElements[index] = 1;
+				}
+
+				built.leafOffsets.push_back( uint32_t( built.elements.size() ) );
+				return LeafBit | leafIndex;
+			}
+
+			// The whole block goes in first, so siblings stay next to each other
+			const uint32_t firstChild = uint32_t( built.nodeLinks.size() );
+			built.nodeLinks.resize( built.nodeLinks.size() + NumChildren );
+			built.nodeLeafBegin.resize( built.nodeLinks.size() );
+			built.nodeLeafEnd.resize( built.nodeLinks.size() );
+			for ( size_t c = 0; c < NumChildren; c++ )
+			{
+				built.nodeBoxes.Set( firstChild + c, tree.GetNodes()[node.GetFirstChild() + c].GetBoundingVolume() );
+			}
+
+			for ( size_t c = 0; c < NumChildren; c++ )
+			{
+				const uint32_t link = AddNode( tree, node.GetFirstChild() + int32_t( c ), firstChild + uint32_t( c ) );
+				built.nodeLinks[firstChild + c] = link;
+			}
+
+			built.nodeLeafEnd[flatIndex] = uint32_t( built.leafOffsets.size() - 1 );
+			return firstChild;
+		}
+
+		// Every internal node's sample is picked from its children's, or from the elements of the
+		// children that are leaves, keeping whichever is nearest to the middle of each grid cell.
+		// Children are always numbered after their parent, so going backwards gets every child's
+		// sample done before its parent needs it
+		void BuildNodeSamples()
+		{
+			constexpr uint32_t numCells = LodCellsPerAxis * LodCellsPerAxis * LodCellsPerAxis;
+			const size_t numNodes = built.nodeLinks.size();
+
+			// Samples are made bottom-up here, then put in node order at the end
+			adm::Vector<ElementType> samples;
+			adm::Vector<uint32_t> sampleBegin( numNodes, 0 );
+			adm::Vector<uint32_t> sampleEnd( numNodes, 0 );
+
+			adm::Vector<uint32_t> cellStamps( numCells, 0 );
+			adm::Vector<float> cellDistances( numCells );
+			adm::Vector<ElementType> cellBest( numCells );
+			adm::Vector<uint32_t> touchedCells;
+
+			for ( size_t node = numNodes; node-- > 0; )
+			{
+				const uint32_t link = built.nodeLinks[node];
+				if ( IsLeafLink( link ) )
+				{
+					continue;
+				}
+
+				const adm::AABB box = built.nodeBoxes[node];
+				const uint32_t stamp = uint32_t( node ) + 1;
+				adm::Vec3 inverseCellSize;
+				for ( size_t axis = 0; axis < 3; axis++ )
+				{
+					const float size = (&box.maxs.x)[axis] - (&box.mins.x)[axis];
+					(&inverseCellSize.x)[axis] = size > 0.0f ? float( LodCellsPerAxis ) / size : 0.0f;
+				}
+
+				touchedCells.clear();
+				const auto consider = [&]( const ElementType& element )
+				{
+					const adm::Vec3 position = ElementBounds<ElementType>::Get( element ).GetCentre();
+					uint32_t cell = 0;
+					float distance = 0.0f;
+					for ( size_t axis = 0; axis < 3; axis++ )
+					{
+						const float coordinate = ((&position.x)[axis] - (&box.mins.x)[axis]) * (&inverseCellSize.x)[axis];
+						const float clamped = std::min( std::max( coordinate, 0.0f ), float( LodCellsPerAxis - 1 ) );
+						const uint32_t index = uint32_t( clamped );
+						const float offset = coordinate - (float( index ) + 0.5f);
+						cell = cell * LodCellsPerAxis + index;
+						distance += offset * offset;
+					}
+
+					if ( cellStamps[cell] != stamp )
+					{
+						cellStamps[cell] = stamp;
+						touchedCells.push_back( cell );
+					}
+					else if ( distance >= cellDistances[cell] )
+					{
+						return;
+					}
+
+					cellDistances[cell] = distance;
+					cellBest[cell] = element;
+				};
+
+				for ( uint32_t c = 0; c < NumChildren; c++ )
+				{
+					const uint32_t child = link + c;
+					const uint32_t childLink = built.nodeLinks[child];
+					if ( !IsLeafLink( childLink ) )
+					{
+						for ( uint32_t i = sampleBegin[child]; i < sampleEnd[child]; i++ )
+						{
+							consider( samples[i] );
+						}
+						continue;
+					}
+
+					const uint32_t leaf = GetLeafIndex( childLink );
+					for ( uint32_t i = built.leafOffsets[leaf]; i < built.leafOffsets[leaf + 1]; i++ )
+					{
+						if ( !built.elementIsRepeat[i] )
+						{
+							consider( built.elements[i] );
+						}
+					}
+				}
+
+				sampleBegin[node] = uint32_t( samples.size() );
+				for ( const uint32_t& cell : touchedCells )
+				{
+					samples.push_back( cellBest[cell] );
+				}
+				sampleEnd[node] = uint32_t( samples.size() );
+			}
+
+			built.nodeSampleOffsets.reserve( numNodes + 1 );
+			built.nodeSampleOffsets.push_back( 0 );
+			built.nodeSamples.reserve( samples.size() );
+			for ( size_t node = 0; node < numNodes; node++ )
+			{
+				built.nodeSamples.insert( built.nodeSamples.end(), samples.begin() + sampleBegin[node], samples.begin() + sampleEnd[node] );
+				built.nodeSampleOffsets.push_back( uint32_t( built.nodeSamples.size() ) );
+			}
+		}
+
+		// What queries read from, pointing either into `built` or into `snapshot`
+		BoxArrayView nodeBoxes;
+		Span<const uint32_t> nodeLinks;
+		Span<const uint32_t> nodeLeafBegin;
+		Span<const uint32_t> nodeLeafEnd;
+
+		BoxArrayView leafBoxes;
+		Span<const uint32_t> leafOffsets;
+
+		Span<const ElementType> elements;
+		Span<const uint32_t> elementIndices;
+		// 1 for the 2nd, 3rd etc. copy of an element that's on a boundary between leaves,
+		// so neighbour queries can report every element once
+		Span<const uint8_t> elementIsRepeat;
+		uint32_t numUniqueElements{};
+
+		// Node i's sample is [offsets[i], offsets[i + 1])
+		Span<const uint32_t> nodeSampleOffsets;
+		Span<const ElementType> nodeSamples;
+
+		// Whatever Build makes, empty after a Load
+		struct Arrays
+		{
+			BoxArray nodeBoxes;
+			adm::Vector<uint32_t> nodeLinks;
+			adm::Vector<uint32_t> nodeLeafBegin;
+			adm::Vector<uint32_t> nodeLeafEnd;
+
+			BoxArray leafBoxes;
+			adm::Vector<uint32_t> leafOffsets;
+
+			adm::Vector<ElementType> elements;
+			adm::Vector<uint32_t> elementIndices;
+			adm::Vector<uint8_t> elementIsRepeat;
+			uint32_t numUniqueElements{};
+
+			adm::Vector<uint32_t> nodeSampleOffsets;
+			adm::Vector<ElementType> nodeSamples;
+		} built;
+		adm::Vector<uint8_t> seenElements;
+
+		MappedFile snapshot;
+	};
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <Precompiled.hpp>
+
+namespace spatial
+{
+	enum class Containment : uint8_t
+	{
+		Outside,
+		// Straddles at least one plane
+		Partial,
+		Inside
+	};
+
+	// Points where Dot( normal, point ) + distance >= 0 are on the inside
+	struct Plane
+	{
+		adm::Vec3 normal;
+		float distance{};
+
+		float DistanceTo( const adm::Vec3& point ) const
+		{
+			return normal.x * point.x + normal.y * point.y + normal.z * point.z + distance;
+		}
+	};
+
+	class Frustum
+	{
+	public:
+		static constexpr size_t NumPlanes = 6;
+		// One bit per plane, a box whose bit is clear is known to be inside that plane
+		static constexpr uint32_t AllPlanes = (1U << NumPlanes) - 1U;
+
+		// Pulls the planes out of a column-major view-projection matrix (like glm's),
+		// with OpenGL's -w..w clip space. Left, right, bottom, top, near, far
+		// The planes aren't normalised, which is fine as long as you only look at the sign
+		static Frustum FromViewProjection( const float* matrix )
+		{
+			const auto row = [&]( int index, float outRow[4] )
+			{
+				for ( int column = 0; column < 4; column++ )
+				{
+					outRow[column] = matrix[column * 4 + index];
+				}
+			};
+
+			float rows[4][4];
+			for ( int i = 0; i < 4; i++ )
+			{
+				row( i, rows[i] );
+			}
+
+			Frustum frustum;
+			for ( size_t i = 0; i < NumPlanes; i++ )
+			{
+				// Planes come in pairs: w + axis and w - axis
+				const float* axis = rows[i / 2];
+				const float sign = (i % 2) ? -1.0f : 1.0f;
+
+				Plane& plane = frustum.planes[i];
+				plane.normal = adm::Vec3(
+					rows[3][0] + sign * axis[0],
+					rows[3][1] + sign * axis[1],
+					rows[3][2] + sign * axis[2] );
+				plane.distance = rows[3][3] + sign * axis[3];
+			}
+
+			return frustum;
+		}
+
+		const Plane& GetPlane( size_t index ) const
+		{
+			return planes[index];
+		}
+
+		// Only tests the planes in `planeMask`, and writes the ones the box straddles into `outPlaneMask`,
+		// so its children only need to be tested against those
+		Containment Classify( const adm::AABB& box, uint32_t planeMask, uint32_t& outPlaneMask ) const
+		{
+			outPlaneMask = 0;
+			for ( size_t i = 0; i < NumPlanes; i++ )
+			{
+				if ( !(planeMask & (1U << i)) )
+				{
+					continue;
+				}
+
+				// The corners furthest along and furthest against the normal
+				const Plane& plane = planes[i];
+				const adm::Vec3 positive(
+					plane.normal.x > 0.0f ? box.maxs.x : box.mins.x,
+					plane.normal.y > 0.0f ? box.maxs.y : box.mins.y,
+					plane.normal.z > 0.0f ? box.maxs.z : box.mins.z );
+				const adm::Vec3 negative(
+					plane.normal.x > 0.0f ? box.mins.x : box.maxs.x,
+					plane.normal.y > 0.0f ? box.mins.y : box.maxs.y,
+					plane.normal.z > 0.0f ? box.mins.z : box.maxs.z );
+
+				if ( plane.DistanceTo( positive ) < 0.0f )
+				{
+					return Containment::Outside;
+				}
+
+				if ( plane.DistanceTo( negative ) < 0.0f )
+				{
+					outPlaneMask |= 1U << i;
+				}
+			}
+
+			return outPlaneMask ? Containment::Partial : Containment::Inside;
+		}
+
+	private:
+		Plane planes[NumPlanes];
+	};
+}
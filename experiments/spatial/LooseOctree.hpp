@@ -0,0 +1,384 @@
+#pragma once
+
+#include <Precompiled.hpp>
+#include "experiments/spatial/Morton.hpp"
+#include "experiments/spatial/Octree.hpp"
+#include <cmath>
+#include <unordered_map>
+
+namespace spatial
+{
+	template<typename ElementType>
+	class LooseOctree;
+
+	class LooseOctreeNode
+	{
+	public:
+		static constexpr int32_t NoChildren = -1;
+		static constexpr uint32_t NoElement = ~0U;
+
+		bool IsLeaf() const
+		{
+			return firstChild == NoChildren;
+		}
+
+		int32_t GetFirstChild() const
+		{
+			return firstChild;
+		}
+
+		// The cell grown by the tree's looseness around its centre
+		// Every element in this node lies inside it
+		const adm::AABB& GetLooseBounds() const
+		{
+			return looseBounds;
+		}
+
+		// Only the elements in this node, not its children's
+		uint32_t GetNumElements() const
+		{
+			return numElements;
+		}
+
+		// Head of the node's element list, see LooseOctree::GetNextElement
+		uint32_t GetFirstElement() const
+		{
+			return firstElement;
+		}
+
+		uint32_t GetDepth() const
+		{
+			return depth;
+		}
+
+	private:
+		template<typename>
+		friend class LooseOctree;
+
+		adm::AABB looseBounds;
+		int32_t firstChild{ NoChildren };
+		uint32_t firstElement{ NoElement };
+		uint32_t numElements{};
+		uint32_t depth{};
+	};
+
+	// Octree for elements with an extent, where every element lives in exactly one node
+	//
+	// spatial::Tree puts an element into every leaf it touches, so boxes that straddle child
+	// boundaries get copied around, over and over for medium-sized ones. Here, every cell is
+	// grown by a looseness factor (2 means twice as big) around its centre, and an element goes
+	// into the deepest cell that's still big enough for it, picked by its centre. Which cell
+	// that is comes straight out of the element's size and position, so an insertion is a
+	// hash lookup and a list push, with no tests against children and no subdivision.
+	//
+	// The price is that loose cells overlap, so queries visit more nodes than in a tight tree,
+	// and elements up in big cells get tested by every query that touches them.
+	//
+	// Elements are kept in per-node linked lists, so moving one around never allocates.
+	// Nodes are created as blocks of 8 siblings on the way down to the first element that
+	// needs them, and stay around after their elements leave.
+	template<typename ElementType>
+	class LooseOctree
+	{
+	public:
+		using Node = LooseOctreeNode;
+		static constexpr int32_t NoChildren = Node::NoChildren;
+		static constexpr uint32_t NoElement = Node::NoElement;
+		// Cell coordinates have to fit into Morton codes, with room for a depth marker bit
+		static constexpr uint32_t MaxDepth = 20;
+
+		// `volume` is where elements are expected to be, anything whose centre is outside of it
+		// goes into the root. Deeper than `maxDepth` and cells are just too small to bother
+		void Initialise( const adm::AABB& volume, float looseness = 2.0f, uint32_t maxDepth = 10 )
+		{
+			rootVolume = volume;
+			this->looseness = std::max( looseness, 1.0f );
+			this->maxDepth = std::min( maxDepth, MaxDepth );
+			Clear();
+		}
+
+		void Clear()
+		{
+			elements.clear();
+			elementNodes.clear();
+			nextElements.clear();
+			previousElements.clear();
+			freeElements.clear();
+			nodes.clear();
+			nodeLookup.clear();
+
+			nodes.emplace_back();
+			nodes[0].looseBounds = GetLooseBounds( rootVolume );
+			nodeLookup[1] = 0;
+		}
+
+		// Throws the current elements out, and inserts these one by one
+		void SetElements( adm::Vector<ElementType>&& newElements )
+		{
+			Clear();
+			elements = std::move( newElements );
+			elementNodes.resize( elements.size() );
+			nextElements.resize( elements.size() );
+			previousElements.resize( elements.size() );
+			for ( uint32_t i = 0; i < elements.size(); i++ )
+			{
+				Link( i, FindNode( elements[i] ) );
+			}
+		}
+
+		// Returns where the element ended up in GetElements(), slots of removed elements get reused
+		uint32_t Insert( const ElementType& element )
+		{
+			uint32_t index;
+			if ( !freeElements.empty() )
+			{
+				index = freeElements.back();
+				freeElements.pop_back();
+				elements[index] = element;
+			}
+			else
+			{
+				index = uint32_t( elements.size() );
+				elements.push_back( element );
+				elementNodes.push_back( -1 );
+				nextElements.push_back( NoElement );
+				previousElements.push_back( NoElement );
+			}
+
+			Link( index, FindNode( element ) );
+			return index;
+		}
+
+		void Remove( uint32_t index )
+		{
+			Unlink( index );
+			freeElements.push_back( index );
+		}
+
+		// Only relinks the element if it moved into a different cell, or changed size enough
+		// to need a different depth
+		void Update( uint32_t index, const ElementType& element )
+		{
+			elements[index] = element;
+			const int32_t node = FindNode( element );
+			if ( node != elementNodes[index] )
+			{
+				Unlink( index );
+				Link( index, node );
+			}
+		}
+
+		// Calls function( uint32_t element ) for every element whose bounds overlap `box`
+		template<typename FunctionType>
+		void QueryBox( const adm::AABB& box, FunctionType&& function ) const
+		{
+			int32_t stack[MaxDepth * 8 + 8];
+			uint32_t stackSize = 0;
+			// The root always gets looked at, it also has whatever's outside the volume
+			stack[stackSize++] = 0;
+
+			while ( stackSize > 0 )
+			{
+				const Node& node = nodes[stack[--stackSize]];
+				for ( uint32_t i = node.firstElement; i != NoElement; i = nextElements[i] )
+				{
+					if ( Overlaps( ElementBounds<ElementType>::Get( elements[i] ), box ) )
+					{
+						function( i );
+					}
+				}
+
+				if ( node.IsLeaf() )
+				{
+					continue;
+				}
+
+				for ( int32_t c = 0; c < 8; c++ )
+				{
+					if ( Overlaps( nodes[node.firstChild + c].looseBounds, box ) )
+					{
+						stack[stackSize++] = node.firstChild + c;
+					}
+				}
+			}
+		}
+
+		// Removed elements are still in here, their slots just aren't linked into any node
+		const adm::Vector<ElementType>& GetElements() const
+		{
+			return elements;
+		}
+
+		// Next element in the same node, or NoElement
+		uint32_t GetNextElement( uint32_t index ) const
+		{
+			return nextElements[index];
+		}
+
+		// The root is node 0
+		const adm::Vector<Node>& GetNodes() const
+		{
+			return nodes;
+		}
+
+		float GetLooseness() const
+		{
+			return looseness;
+		}
+
+		// Roughly how much memory the tree holds on to, the lookup's nodes are an estimate
+		size_t GetMemoryUsage() const
+		{
+			return elements.capacity() * sizeof( ElementType )
+				+ (elementNodes.capacity() + nextElements.capacity() + previousElements.capacity() + freeElements.capacity()) * sizeof( uint32_t )
+				+ nodes.capacity() * sizeof( Node )
+				+ nodeLookup.bucket_count() * sizeof( void* )
+				+ nodeLookup.size() * (sizeof( std::pair<const uint64_t, int32_t> ) + 2 * sizeof( void* ));
+		}
+
+	private:
+		static bool Overlaps( const adm::AABB& a, const adm::AABB& b )
+		{
+			return a.mins.x <= b.maxs.x && a.maxs.x >= b.mins.x
+				&& a.mins.y <= b.maxs.y && a.maxs.y >= b.mins.y
+				&& a.mins.z <= b.maxs.z && a.maxs.z >= b.mins.z;
+		}
+
+		adm::AABB GetLooseBounds( const adm::AABB& cell ) const
+		{
+			const adm::Vec3 centre = cell.GetCentre();
+			const adm::Vec3 halfSize = (cell.maxs - cell.mins) * (0.5f * looseness);
+			return { centre - halfSize, centre + halfSize };
+		}
+
+		// The deepest cell that holds the element wherever in the cell its centre is, as a
+		// locational code: a 1 bit to mark the depth, followed by the cell's Morton code,
+		// so the parent's code is just this one shifted down by 3
+		uint64_t GetCellCode( const adm::AABB& bounds ) const
+		{
+			const adm::Vec3 centre = bounds.GetCentre();
+			const adm::Vec3 rootSize = rootVolume.maxs - rootVolume.mins;
+
+			// The centre can be up to half a cell away from the cell's centre, so the element
+			// fits as long as it reaches no further than (looseness - 1) half cells out from its centre
+			float ratio = FLT_MAX;
+			for ( size_t axis = 0; axis < 3; axis++ )
+			{
+				const float extent = (&bounds.maxs.x)[axis] - (&bounds.mins.x)[axis];
+				if ( (&centre.x)[axis] < (&rootVolume.mins.x)[axis] || (&centre.x)[axis] > (&rootVolume.maxs.x)[axis] )
+				{
+					return 1;
+				}
+
+				if ( extent > 0.0f )
+				{
+					// A hair under, so rounding can't push an element out of its cell
+					ratio = std::min( ratio, (looseness - 1.0f) * (&rootSize.x)[axis] / extent * 0.9999f );
+				}
+			}
+
+			if ( ratio < 1.0f )
+			{
+				return 1;
+			}
+
+			const uint32_t depth = ratio >= float( 1U << maxDepth ) ? maxDepth : uint32_t( std::ilogb( ratio ) );
+			const uint32_t cellsPerAxis = 1U << depth;
+
+			uint32_t cell[3];
+			for ( size_t axis = 0; axis < 3; axis++ )
+			{
+				const float position = ((&centre.x)[axis] - (&rootVolume.mins.x)[axis]) / (&rootSize.x)[axis] * float( cellsPerAxis );
+				cell[axis] = std::min( uint32_t( std::max( position, 0.0f ) ), cellsPerAxis - 1 );
+			}
+
+			return (uint64_t( 1 ) << (depth * 3)) | morton::Encode( cell[0], cell[1], cell[2] );
+		}
+
+		int32_t FindNode( const ElementType& element )
+		{
+			return GetNode( GetCellCode( ElementBounds<ElementType>::Get( element ) ) );
+		}
+
+		// Looks the cell up, and if it isn't there yet, makes its parent (and so on) split
+		int32_t GetNode( uint64_t code )
+		{
+			const auto found = nodeLookup.find( code );
+			if ( found != nodeLookup.end() )
+			{
+				return found->second;
+			}
+
+			const int32_t parent = GetNode( code >> 3 );
+			Split( parent, code >> 3 );
+			return nodeLookup[code];
+		}
+
+		void Split( int32_t parentIndex, uint64_t parentCode )
+		{
+			const int32_t firstChild = int32_t( nodes.size() );
+			nodes.resize( nodes.size() + 8 );
+
+			Node& parent = nodes[parentIndex];
+			parent.firstChild = firstChild;
+
+			// Tight bounds of the parent, its loose ones shrunk back down
+			const adm::Vec3 centre = parent.looseBounds.GetCentre();
+			const adm::Vec3 halfSize = (parent.looseBounds.maxs - parent.looseBounds.mins) * (0.5f / looseness);
+			const adm::AABB parentCell = { centre - halfSize, centre + halfSize };
+
+			for ( size_t c = 0; c < 8; c++ )
+			{
+				Node& child = nodes[firstChild + c];
+				child.looseBounds = GetLooseBounds( utils::GetAABBForChild( parentCell, c ) );
+				child.depth = parent.depth + 1;
+				nodeLookup[(parentCode << 3) | c] = firstChild + int32_t( c );
+			}
+		}
+
+		void Link( uint32_t index, int32_t nodeIndex )
+		{
+			Node& node = nodes[nodeIndex];
+			elementNodes[index] = nodeIndex;
+			previousElements[index] = NoElement;
+			nextElements[index] = node.firstElement;
+			if ( node.firstElement != NoElement )
+			{
+				previousElements[node.firstElement] = index;
+			}
+
+			node.firstElement = index;
+			node.numElements++;
+		}
+
+		void Unlink( uint32_t index )
+		{
+			Node& node = nodes[elementNodes[index]];
+			const uint32_t previous = previousElements[index];
+			const uint32_t next = nextElements[index];
+			(previous != NoElement ? nextElements[previous] : node.firstElement) = next;
+			if ( next != NoElement )
+			{
+				previousElements[next] = previous;
+			}
+
+			node.numElements--;
+			elementNodes[index] = -1;
+		}
+
+		adm::AABB rootVolume{};
+		float looseness{ 2.0f };
+		uint32_t maxDepth{ 10 };
+
+		adm::Vector<ElementType> elements;
+		// Which node each element is in, -1 for removed ones
+		adm::Vector<int32_t> elementNodes;
+		adm::Vector<uint32_t> nextElements;
+		adm::Vector<uint32_t> previousElements;
+		adm::Vector<uint32_t> freeElements;
+
+		adm::Vector<Node> nodes;
+		// Locational code to node index, for every node there is
+		std::unordered_map<uint64_t, int32_t> nodeLookup;
+	};
+}
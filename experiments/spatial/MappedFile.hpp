@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#if defined( _WIN32 )
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace spatial
+{
+	// A whole file mapped read-only into memory
+	// Nothing is read up-front, pages get faulted in as they're touched
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+
+		~MappedFile()
+		{
+			Close();
+		}
+
+		MappedFile( const MappedFile& ) = delete;
+		MappedFile& operator=( const MappedFile& ) = delete;
+
+		MappedFile( MappedFile&& other ) noexcept
+		{
+			*this = std::move( other );
+		}
+
+		MappedFile& operator=( MappedFile&& other ) noexcept
+		{
+			if ( this != &other )
+			{
+				Close();
+				std::swap( data, other.data );
+				std::swap( size, other.size );
+			}
+
+			return *this;
+		}
+
+		bool Open( const char* path )
+		{
+			Close();
+
+#if defined( _WIN32 )
+			HANDLE file = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+			if ( file == INVALID_HANDLE_VALUE )
+			{
+				return false;
+			}
+
+			LARGE_INTEGER fileSize;
+			if ( !GetFileSizeEx( file, &fileSize ) || fileSize.QuadPart == 0 )
+			{
+				CloseHandle( file );
+				return false;
+			}
+
+			// The view keeps the mapping alive, so both handles can go right away
+			HANDLE mapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+			CloseHandle( file );
+			if ( !mapping )
+			{
+				return false;
+			}
+
+			void* view = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+			CloseHandle( mapping );
+			if ( !view )
+			{
+				return false;
+			}
+
+			data = static_cast<const uint8_t*>( view );
+			size = size_t( fileSize.QuadPart );
+#else
+			const int file = open( path, O_RDONLY );
+			if ( file < 0 )
+			{
+				return false;
+			}
+
+			struct stat status;
+			if ( fstat( file, &status ) != 0 || status.st_size == 0 )
+			{
+				close( file );
+				return false;
+			}
+
+			void* view = mmap( nullptr, size_t( status.st_size ), PROT_READ, MAP_PRIVATE, file, 0 );
+			close( file );
+			if ( view == MAP_FAILED )
+			{
+				return false;
+			}
+
+			data = static_cast<const uint8_t*>( view );
+			size = size_t( status.st_size );
+#endif
+			return true;
+		}
+
+		void Close()
+		{
+			if ( !data )
+			{
+				return;
+			}
+
+#if defined( _WIN32 )
+			UnmapViewOfFile( data );
+#else
+			munmap( const_cast<uint8_t*>( data ), size );
+#endif
+			data = nullptr;
+			size = 0;
+		}
+
+		bool IsOpen() const
+		{
+			return data != nullptr;
+		}
+
+		// Page-aligned
+		const uint8_t* GetData() const
+		{
+			return data;
+		}
+
+		size_t GetSize() const
+		{
+			return size;
+		}
+
+	private:
+		const uint8_t* data{};
+		size_t size{};
+	};
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <Precompiled.hpp>
+#include <algorithm>
+#include <cstdint>
+
+// Morton codes (Z-order curve) and a radix sort to go with them
+namespace spatial::morton
+{
+	// 21 bits per axis, 63 bits in total
+	constexpr uint32_t BitsPerAxis = 21;
+	constexpr uint32_t MaxCoordinate = (1U << BitsPerAxis) - 1U;
+
+	struct KeyIndex
+	{
+		uint64_t code;
+		uint32_t index;
+	};
+
+	// Spreads the lower 21 bits out so there are two zero bits between each of them
+	inline uint64_t SpreadBits( uint32_t value )
+	{
+		uint64_t x = value & MaxCoordinate;
+		x = (x | x << 32) & 0x001f00000000ffffULL;
+		x = (x | x << 16) & 0x001f0000ff0000ffULL;
+		x = (x | x << 8) & 0x100f00f00f00f00fULL;
+		x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+		x = (x | x << 2) & 0x1249249249249249ULL;
+		return x;
+	}
+
+	// X ends up in the lowest bit of every 3-bit group, Z in the highest, which is
+	// the same order spatial::utils::GetAABBForChild uses for its child indices
+	inline uint64_t Encode( uint32_t x, uint32_t y, uint32_t z )
+	{
+		return SpreadBits( x ) | (SpreadBits( y ) << 1) | (SpreadBits( z ) << 2);
+	}
+
+	// Maps points inside a box onto the 2^21 grid, anything outside gets clamped to the edge
+	class PointEncoder
+	{
+	public:
+		explicit PointEncoder( const adm::AABB& box )
+			: mins( box.mins )
+		{
+			const adm::Vec3 size = box.maxs - box.mins;
+			scale = adm::Vec3(
+				float( 1U << BitsPerAxis ) / size.x,
+				float( 1U << BitsPerAxis ) / size.y,
+				float( 1U << BitsPerAxis ) / size.z );
+		}
+
+		uint64_t operator()( const adm::Vec3& point ) const
+		{
+			return Encode(
+				Quantise( (point.x - mins.x) * scale.x ),
+				Quantise( (point.y - mins.y) * scale.y ),
+				Quantise( (point.z - mins.z) * scale.z ) );
+		}
+
+	private:
+		static uint32_t Quantise( float value )
+		{
+			return uint32_t( std::clamp( value, 0.0f, float( MaxCoordinate ) ) );
+		}
+
+		adm::Vec3 mins;
+		adm::Vec3 scale;
+	};
+
+	// LSD radix sort of a range, 8 bits per pass, from the lowest byte up to (not including) `endPass`
+	// All histograms are gathered in one go up front, and passes where every key has the same
+	// digit are skipped. The result ends up back in `keys`
+	inline void RadixSortRange( KeyIndex* keys, KeyIndex* scratch, size_t count, size_t endPass )
+	{
+		constexpr size_t NumBuckets = 256;
+		size_t histograms[8][NumBuckets]{};
+
+		for ( size_t i = 0; i < count; i++ )
+		{
+			for ( size_t pass = 0; pass < endPass; pass++ )
+			{
+				histograms[pass][(keys[i].code >> (pass * 8)) & 0xff]++;
+			}
+		}
+
+		KeyIndex* from = keys;
+		KeyIndex* to = scratch;
+		for ( size_t pass = 0; pass < endPass; pass++ )
+		{
+			size_t* histogram = histograms[pass];
+			const uint32_t shift = uint32_t( pass * 8 );
+
+			if ( histogram[(from[0].code >> shift) & 0xff] == count )
+			{
+				continue;
+			}
+
+			size_t offset = 0;
+			for ( size_t bucket = 0; bucket < NumBuckets; bucket++ )
+			{
+				const size_t bucketCount = histogram[bucket];
+				histogram[bucket] = offset;
+				offset += bucketCount;
+			}
+
+			for ( size_t i = 0; i < count; i++ )
+			{
+				to[histogram[(from[i].code >> shift) & 0xff]++] = from[i];
+			}
+
+			std::swap( from, to );
+		}
+
+		if ( from != keys )
+		{
+			std::copy( from, from + count, keys );
+		}
+	}
+
+	// One MSD pass on the top byte, then an LSD sort of each bucket
+	// Doing all 8 passes LSD-style over the whole array is bound by memory bandwidth
+	// at millions of keys, whereas the buckets are small enough to stay in cache
+	// Works with any vector of KeyIndex, std::pmr ones included
+	template<typename VectorType>
+	void RadixSort( VectorType& keys, VectorType& scratch )
+	{
+		constexpr size_t NumBuckets = 256;
+		constexpr uint32_t TopShift = 56;
+
+		const size_t count = keys.size();
+		if ( count == 0 )
+		{
+			return;
+		}
+
+		scratch.resize( count );
+
+		size_t bucketBegin[NumBuckets + 1]{};
+		for ( const KeyIndex& key : keys )
+		{
+			bucketBegin[(key.code >> TopShift) + 1]++;
+		}
+		for ( size_t bucket = 0; bucket < NumBuckets; bucket++ )
+		{
+			bucketBegin[bucket + 1] += bucketBegin[bucket];
+		}
+
+		size_t cursors[NumBuckets];
+		std::copy( bucketBegin, bucketBegin + NumBuckets, cursors );
+		for ( const KeyIndex& key : keys )
+		{
+			scratch[cursors[key.code >> TopShift]++] = key;
+		}
+
+		// Buckets are sorted in scratch and land back in keys
+		keys.swap( scratch );
+		for ( size_t bucket = 0; bucket < NumBuckets; bucket++ )
+		{
+			const size_t begin = bucketBegin[bucket];
+			const size_t bucketCount = bucketBegin[bucket + 1] - begin;
+			if ( bucketCount > 1 )
+			{
+				RadixSortRange( &keys[begin], &scratch[begin], bucketCount, 7 );
+			}
+		}
+	}
+}
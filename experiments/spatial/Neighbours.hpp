@@ -0,0 +1,94 @@
+#pragma once
+
+#include <Precompiled.hpp>
+#include "experiments/spatial/Morton.hpp"
+#include <algorithm>
+#include <cfloat>
+
+namespace spatial
+{
+	struct Neighbour
+	{
+		// Index into the source tree's GetElements()
+		uint32_t element;
+		float distanceSquared;
+	};
+
+	// The k nearest neighbours seen so far, as a max-heap on distance so the worst one is
+	// always on top and gets kicked out first. Lives in storage the caller hands over, so
+	// a query doesn't allocate anything
+	class NeighbourHeap
+	{
+	public:
+		NeighbourHeap( Neighbour* storage, size_t capacity, float maxDistanceSquared = FLT_MAX )
+			: storage( storage ), capacity( capacity ), maxDistanceSquared( maxDistanceSquared )
+		{
+		}
+
+		// Anything further away than this can't get in anymore
+		float GetBound() const
+		{
+			return size < capacity ? maxDistanceSquared : storage[0].distanceSquared;
+		}
+
+		void Offer( uint32_t element, float distanceSquared )
+		{
+			if ( size < capacity )
+			{
+				if ( distanceSquared <= maxDistanceSquared )
+				{
+					storage[size++] = { element, distanceSquared };
+					std::push_heap( storage, storage + size, IsCloser );
+				}
+				return;
+			}
+
+			if ( capacity > 0 && distanceSquared < storage[0].distanceSquared )
+			{
+				std::pop_heap( storage, storage + size, IsCloser );
+				storage[size - 1] = { element, distanceSquared };
+				std::push_heap( storage, storage + size, IsCloser );
+			}
+		}
+
+		// Sorts the storage nearest-first, after which it's no longer a heap
+		// Returns how many neighbours were found
+		size_t Finish()
+		{
+			std::sort_heap( storage, storage + size, IsCloser );
+			return size;
+		}
+
+	private:
+		static bool IsCloser( const Neighbour& a, const Neighbour& b )
+		{
+			return a.distanceSquared < b.distanceSquared;
+		}
+
+		Neighbour* storage;
+		size_t capacity;
+		size_t size{};
+		float maxDistanceSquared;
+	};
+
+	// Whatever a batch of queries needs to sort itself, kept around by the caller
+	// so only the first batch (or a bigger one) has to allocate
+	struct QueryBatchScratch
+	{
+		adm::Vector<morton::KeyIndex> order;
+		adm::Vector<morton::KeyIndex> sortScratch;
+	};
+
+	namespace utils
+	{
+		// Distance function for FlatOctree's nearest neighbour queries, when the elements are points
+		struct PointDistanceSquared
+		{
+			float operator()( const adm::Vec3& element, const adm::Vec3& point ) const
+			{
+				const adm::Vec3 delta = element - point;
+				return delta.x * delta.x + delta.y * delta.y + delta.z * delta.z;
+			}
+		};
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "experiments/spatial/Tree.hpp"
+
+namespace spatial
+{
+	template<typename ElementType>
+	using Octree = Tree<ElementType, adm::AABB, 3>;
+
+	// Octree whose callbacks are fixed at compile time, see FunctionPolicy
+	template<typename ElementType, typename Policy>
+	using PolicyOctree = Tree<ElementType, adm::AABB, 3, Policy>;
+
+	// Callbacks for octrees of points, same idea as the ones in adm::utils
+	namespace utils
+	{
+		// Inside or on the surface of the box
+		inline bool IntersectsAABB( const adm::Vec3& point, const adm::AABB& box )
+		{
+			return point.x >= box.mins.x && point.x <= box.maxs.x
+				&& point.y >= box.mins.y && point.y <= box.maxs.y
+				&& point.z >= box.mins.z && point.z <= box.maxs.z;
+		}
+
+		// Strictly inside the box, so none of its neighbours can have it
+		inline bool OccupiesBox( const adm::Vec3& point, const adm::AABB& box )
+		{
+			return point.x > box.mins.x && point.x < box.maxs.x
+				&& point.y > box.mins.y && point.y < box.maxs.y
+				&& point.z > box.mins.z && point.z < box.maxs.z;
+		}
+
+		// Same as the two above, for octrees of boxes, where an element goes into every child it touches
+		inline bool BoxIntersectsAABB( const adm::AABB& element, const adm::AABB& box )
+		{
+			return element.mins.x <= box.maxs.x && element.maxs.x >= box.mins.x
+				&& element.mins.y <= box.maxs.y && element.maxs.y >= box.mins.y
+				&& element.mins.z <= box.maxs.z && element.maxs.z >= box.mins.z;
+		}
+
+		inline bool BoxOccupiesBox( const adm::AABB& element, const adm::AABB& box )
+		{
+			return element.mins.x > box.mins.x && element.maxs.x < box.maxs.x
+				&& element.mins.y > box.mins.y && element.maxs.y < box.maxs.y
+				&& element.mins.z > box.mins.z && element.maxs.z < box.maxs.z;
+		}
+
+		template<typename ElementType, int32_t Threshold>
+		bool SimpleThreshold( const typename Octree<ElementType>::NodeType& node )
+		{
+			return node.GetNumElements() > Threshold;
+		}
+
+		// Bit 0 of the child index picks the upper half on X, bit 1 on Y, bit 2 on Z
+		inline adm::AABB GetAABBForChild( const adm::AABB& box, size_t childIndex )
+		{
+			const adm::Vec3 centre = box.GetCentre();
+			adm::AABB child = box;
+
+			(childIndex & 1 ? child.mins.x : child.maxs.x) = centre.x;
+			(childIndex & 2 ? child.mins.y : child.maxs.y) = centre.y;
+			(childIndex & 4 ? child.mins.z : child.maxs.z) = centre.z;
+
+			return child;
+		}
+	}
+}
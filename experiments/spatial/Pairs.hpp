@@ -0,0 +1,328 @@
+#pragma once
+
+#include <Precompiled.hpp>
+#include "experiments/spatial/Octree.hpp"
+#include "experiments/spatial/TaskPool.hpp"
+#include <algorithm>
+#include <type_traits>
+
+namespace spatial
+{
+	// Two elements that touch, as indices into the tree's GetElements(), lower index first
+	struct ElementPair
+	{
+		uint32_t first;
+		uint32_t second;
+
+		bool operator==( const ElementPair& other ) const
+		{
+			return first == other.first && second == other.second;
+		}
+
+		bool operator<( const ElementPair& other ) const
+		{
+			return first != other.first ? first < other.first : second < other.second;
+		}
+	};
+
+	// Broad phase over an octree: every pair of elements that a pair test says touch
+	//
+	// Walks the tree against itself. A node is paired with itself and with its neighbours, and a
+	// pair of nodes is split into its children until both sides are leaves, at which point every
+	// element of one is tested against every element of the other. Node pairs further apart than
+	// the margin are dropped along with everything under them, so only nearby elements ever get
+	// tested, rather than all n² of them.
+	//
+	// Elements go into every leaf they touch, so two elements that overlap always share a leaf.
+	// With a margin of 0 it's only ever leaves against themselves, no neighbours needed.
+	//
+	// Keeps its buffers between calls, so a broad phase that runs every frame stops allocating
+	// once they're big enough. One finder per thread, if several threads need one.
+	class PairFinder
+	{
+	public:
+		// Node pairs are handed out to the pool in this many chunks per thread, so a few dense
+		// spots don't hold everyone else up
+		static constexpr size_t ChunksPerThread = 8;
+		// The node pairs are split up until there are about this many per chunk
+		static constexpr size_t NodePairsPerChunk = 4;
+
+		// Fills outPairs with every pair for which pairTest( const ElementType& a, const ElementType& b )
+		// is true, among elements whose leaves are at most `margin` apart, in no particular order.
+		// pairTest is utils::BoxIntersectsAABB for overlapping boxes with a margin of 0, or
+		// utils::PointsWithinRadius{ r } for points with a margin of r.
+		// With a pool, the pair test is called from worker threads, so keep it free of side-effects
+		template<typename TreeType, typename PairTestType>
+		void Find( const TreeType& tree, PairTestType&& pairTest, float margin, adm::Vector<ElementPair>& outPairs,
+			TaskPool* pool = nullptr )
+		{
+			outPairs.clear();
+			const auto& nodes = tree.GetNodes();
+			if ( nodes.empty() || nodes[0].GetNumElements() == 0 )
+			{
+				return;
+			}
+
+			const float marginSquared = margin * margin;
+			const bool pairNeighbours = margin > 0.0f;
+			const size_t numChunks = pool ? pool->GetNumThreads() * ChunksPerThread : 1;
+
+			// Split the work up front, breadth-first, until there's enough to go around
+			work.clear();
+			frontier.clear();
+			frontier.push_back( { 0, 0 } );
+			size_t next = 0;
+			while ( next < frontier.size() && work.size() + frontier.size() - next < numChunks * NodePairsPerChunk )
+			{
+				const NodePair pair = frontier[next++];
+				if ( nodes[pair.a].IsLeaf() && nodes[pair.b].IsLeaf() )
+				{
+					work.push_back( pair );
+					continue;
+				}
+
+				Split( nodes, pair, pairNeighbours, marginSquared, frontier );
+			}
+			work.insert( work.end(), frontier.begin() + next, frontier.end() );
+
+			if ( buffers.size() < numChunks )
+			{
+				buffers.resize( numChunks );
+				stacks.resize( numChunks );
+				nearbyScratch.resize( numChunks );
+			}
+
+			const size_t pairsPerChunk = (work.size() + numChunks - 1) / numChunks;
+			const auto findInChunk = [&]( size_t chunk )
+			{
+				adm::Vector<ElementPair>& found = buffers[chunk];
+				adm::Vector<NodePair>& stack = stacks[chunk];
+				adm::Vector<uint32_t>& nearby = nearbyScratch[chunk];
+				found.clear();
+
+				const size_t end = std::min( work.size(), (chunk + 1) * pairsPerChunk );
+				for ( size_t i = chunk * pairsPerChunk; i < end; i++ )
+				{
+					stack.clear();
+					stack.push_back( work[i] );
+					while ( !stack.empty() )
+					{
+						const NodePair pair = stack.back();
+						stack.pop_back();
+
+						const auto& a = nodes[pair.a];
+						const auto& b = nodes[pair.b];
+						if ( !a.IsLeaf() || !b.IsLeaf() )
+						{
+							Split( nodes, pair, pairNeighbours, marginSquared, stack );
+						}
+						else if ( pair.a == pair.b )
+						{
+							PairWithin( a, pairTest, found );
+						}
+						else
+						{
+							PairBetween( a, b, pairTest, marginSquared, nearby, found );
+						}
+					}
+				}
+			};
+
+			if ( pool && numChunks > 1 )
+			{
+				TaskGroup group;
+				for ( size_t chunk = 0; chunk < numChunks; chunk++ )
+				{
+					pool->Submit( group, [&findInChunk, chunk]() { findInChunk( chunk ); } );
+				}
+				pool->Wait( group );
+			}
+			else
+			{
+				findInChunk( 0 );
+			}
+
+			size_t numFound = 0;
+			for ( size_t chunk = 0; chunk < numChunks; chunk++ )
+			{
+				numFound += buffers[chunk].size();
+			}
+
+			outPairs.reserve( numFound );
+			for ( size_t chunk = 0; chunk < numChunks; chunk++ )
+			{
+				outPairs.insert( outPairs.end(), buffers[chunk].begin(), buffers[chunk].end() );
+			}
+
+			// Two elements that are both in more than one leaf get found once per leaf they share
+			size_t numLeafElements = 0;
+			for ( const auto& leaf : tree.GetLeaves() )
+			{
+				numLeafElements += size_t( leaf->GetNumElements() );
+			}
+
+			if ( numLeafElements > size_t( nodes[0].GetNumElements() ) )
+			{
+				std::sort( outPairs.begin(), outPairs.end() );
+				outPairs.erase( std::unique( outPairs.begin(), outPairs.end() ), outPairs.end() );
+			}
+		}
+
+	private:
+		// The same node twice means pairs within that node
+		struct NodePair
+		{
+			int32_t a;
+			int32_t b;
+		};
+
+		static float GapSquared( const adm::AABB& a, const adm::AABB& b )
+		{
+			float gap = 0.0f;
+			for ( size_t axis = 0; axis < 3; axis++ )
+			{
+				const float axisGap = std::max( 0.0f, std::max( (&a.mins.x)[axis] - (&b.maxs.x)[axis], (&b.mins.x)[axis] - (&a.maxs.x)[axis] ) );
+				gap += axisGap * axisGap;
+			}
+
+			return gap;
+		}
+
+		// Pushes whatever a node pair turns into one level down, leaving out empty nodes and
+		// nodes too far apart. A node against itself turns into each child against itself,
+		// plus each two children against each other. Otherwise the side that isn't a leaf gets
+		// split, or the shallower one if neither is
+		template<typename NodeVector>
+		static void Split( const NodeVector& nodes, NodePair pair, bool pairNeighbours, float marginSquared, adm::Vector<NodePair>& out )
+		{
+			const auto& a = nodes[pair.a];
+			const auto& b = nodes[pair.b];
+			constexpr int32_t numChildren = 8;
+
+			if ( pair.a == pair.b )
+			{
+				const int32_t firstChild = a.GetFirstChild();
+				for ( int32_t i = 0; i < numChildren; i++ )
+				{
+					const auto& child = nodes[firstChild + i];
+					if ( child.GetNumElements() == 0 )
+					{
+						continue;
+					}
+
+					out.push_back( { firstChild + i, firstChild + i } );
+					for ( int32_t j = i + 1; pairNeighbours && j < numChildren; j++ )
+					{
+						const auto& other = nodes[firstChild + j];
+						if ( other.GetNumElements() > 0
+							&& GapSquared( child.GetBoundingVolume(), other.GetBoundingVolume() ) <= marginSquared )
+						{
+							out.push_back( { firstChild + i, firstChild + j } );
+						}
+					}
+				}
+				return;
+			}
+
+			const bool splitA = !a.IsLeaf() && (b.IsLeaf() || a.GetDepth() <= b.GetDepth());
+			const auto& split = splitA ? a : b;
+			const auto& kept = splitA ? b : a;
+			const int32_t keptIndex = splitA ? pair.b : pair.a;
+			const int32_t firstChild = split.GetFirstChild();
+			for ( int32_t i = 0; i < numChildren; i++ )
+			{
+				const auto& child = nodes[firstChild + i];
+				if ( child.GetNumElements() > 0
+					&& GapSquared( child.GetBoundingVolume(), kept.GetBoundingVolume() ) <= marginSquared )
+				{
+					out.push_back( { firstChild + i, keptIndex } );
+				}
+			}
+		}
+
+		static ElementPair MakePair( uint32_t a, uint32_t b )
+		{
+			return a < b ? ElementPair{ a, b } : ElementPair{ b, a };
+		}
+
+		template<typename NodeType, typename PairTestType>
+		static void PairWithin( const NodeType& leaf, PairTestType& pairTest, adm::Vector<ElementPair>& out )
+		{
+			const auto elements = leaf.GetElementSpan();
+			const auto indices = leaf.GetElementIndices();
+			for ( size_t i = 0; i < elements.Size(); i++ )
+			{
+				for ( size_t j = i + 1; j < elements.Size(); j++ )
+				{
+					if ( pairTest( elements[i], elements[j] ) )
+					{
+						out.push_back( MakePair( indices[i], indices[j] ) );
+					}
+				}
+			}
+		}
+
+		// Neighbouring leaves mostly face each other with a thin slice of their elements, so
+		// only the elements within the margin of the other leaf get tested against each other
+		template<typename NodeType, typename PairTestType>
+		static void PairBetween( const NodeType& a, const NodeType& b, PairTestType& pairTest, float marginSquared,
+			adm::Vector<uint32_t>& nearby, adm::Vector<ElementPair>& out )
+		{
+			using ElementType = std::decay_t<decltype( a.GetElementSpan()[0] )>;
+
+			const auto elementsA = a.GetElementSpan();
+			const auto indicesA = a.GetElementIndices();
+			const auto elementsB = b.GetElementSpan();
+			const auto indicesB = b.GetElementIndices();
+
+			nearby.clear();
+			for ( size_t j = 0; j < elementsB.Size(); j++ )
+			{
+				if ( GapSquared( ElementBounds<ElementType>::Get( elementsB[j] ), a.GetBoundingVolume() ) <= marginSquared )
+				{
+					nearby.push_back( uint32_t( j ) );
+				}
+			}
+
+			for ( size_t i = 0; i < elementsA.Size() && !nearby.empty(); i++ )
+			{
+				if ( GapSquared( ElementBounds<ElementType>::Get( elementsA[i] ), b.GetBoundingVolume() ) > marginSquared )
+				{
+					continue;
+				}
+
+				for ( const uint32_t& j : nearby )
+				{
+					// The same element, sitting in both leaves
+					if ( indicesA[i] != indicesB[j] && pairTest( elementsA[i], elementsB[j] ) )
+					{
+						out.push_back( MakePair( indicesA[i], indicesB[j] ) );
+					}
+				}
+			}
+		}
+
+		// Node pairs for the chunks, and the ones still being split
+		adm::Vector<NodePair> work;
+		adm::Vector<NodePair> frontier;
+		// One per chunk, merged at the end
+		adm::Vector<adm::Vector<ElementPair>> buffers;
+		adm::Vector<adm::Vector<NodePair>> stacks;
+		adm::Vector<adm::Vector<uint32_t>> nearbyScratch;
+	};
+
+	namespace utils
+	{
+		// Pair test for PairFinder over octrees of points, give it the radius as the margin too
+		struct PointsWithinRadius
+		{
+			float radius;
+
+			bool operator()( const adm::Vec3& a, const adm::Vec3& b ) const
+			{
+				const adm::Vec3 delta = a - b;
+				return delta.x * delta.x + delta.y * delta.y + delta.z * delta.z <= radius * radius;
+			}
+		};
+	}
+}
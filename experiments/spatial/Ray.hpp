@@ -0,0 +1,242 @@
+#pragma once
+
+#include <Precompiled.hpp>
+#include "experiments/spatial/Simd.hpp"
+#include <cfloat>
+#include <cmath>
+#include <type_traits>
+
+namespace spatial
+{
+	struct Ray
+	{
+		adm::Vec3 origin;
+		// Expected to be normalised, hit distances are measured along it
+		adm::Vec3 direction{ 1.0f, 0.0f, 0.0f };
+		float maxDistance{ FLT_MAX };
+	};
+
+	struct RayHit
+	{
+		static constexpr uint32_t NoHit = ~0U;
+
+		// Index into the source tree's GetElements()
+		uint32_t element{ NoHit };
+		// Index into the structure's own copy of the elements (FlatOctree::GetElements(),
+		// Bvh::GetOrderedElements()), which is there even when the source isn't
+		uint32_t flatElement{ NoHit };
+		float distance{ FLT_MAX };
+
+		bool IsHit() const
+		{
+			return element != NoHit;
+		}
+	};
+
+	// Width rays in structure-of-arrays form, one lane per ray
+	// Traced together, they share one traversal, which pays off when they're coherent,
+	// e.g. neighbouring pixels of a camera
+	template<size_t Width>
+	struct RayPacket
+	{
+		float origins[3][Width]{};
+		float directions[3][Width]{};
+		float inverseDirections[3][Width]{};
+		float maxDistances[Width]{};
+
+		void Set( size_t lane, const Ray& ray )
+		{
+			for ( size_t axis = 0; axis < 3; axis++ )
+			{
+				origins[axis][lane] = (&ray.origin.x)[axis];
+				directions[axis][lane] = (&ray.direction.x)[axis];
+				inverseDirections[axis][lane] = 1.0f / (&ray.direction.x)[axis];
+			}
+
+			maxDistances[lane] = ray.maxDistance;
+		}
+
+		Ray Get( size_t lane ) const
+		{
+			Ray ray;
+			ray.origin = adm::Vec3( origins[0][lane], origins[1][lane], origins[2][lane] );
+			ray.direction = adm::Vec3( directions[0][lane], directions[1][lane], directions[2][lane] );
+			ray.maxDistance = maxDistances[lane];
+			return ray;
+		}
+	};
+
+	// Slab test of one ray against one box, `outEnter` is how far along the ray enters it (0 if it starts inside)
+	inline bool RayHitsBox( const adm::Vec3& origin, const adm::Vec3& inverseDirection, float maxDistance,
+		const adm::AABB& box, float& outEnter )
+	{
+		float enter = 0.0f;
+		float leave = maxDistance;
+		for ( size_t axis = 0; axis < 3; axis++ )
+		{
+			const float t1 = ((&box.mins.x)[axis] - (&origin.x)[axis]) * (&inverseDirection.x)[axis];
+			const float t2 = ((&box.maxs.x)[axis] - (&origin.x)[axis]) * (&inverseDirection.x)[axis];
+			enter = std::max( enter, std::min( t1, t2 ) );
+			leave = std::min( leave, std::max( t1, t2 ) );
+		}
+
+		outEnter = enter;
+		return enter <= leave;
+	}
+
+	// Slab test of every ray in a packet against one box
+	// Returns a bit per lane that hits it closer than that lane's `maxDistances`
+	template<size_t Width>
+	uint32_t PacketHitsBox( const RayPacket<Width>& packet, const float* maxDistances, const adm::AABB& box )
+	{
+		uint32_t mask = 0;
+
+#if defined( SPATIAL_AVX )
+		if constexpr ( Width % 8 == 0 )
+		{
+			for ( size_t base = 0; base < Width; base += 8 )
+			{
+				__m256 enter = _mm256_setzero_ps();
+				__m256 leave = _mm256_loadu_ps( maxDistances + base );
+				for ( size_t axis = 0; axis < 3; axis++ )
+				{
+					const __m256 origin = _mm256_loadu_ps( &packet.origins[axis][base] );
+					const __m256 inverse = _mm256_loadu_ps( &packet.inverseDirections[axis][base] );
+					const __m256 t1 = _mm256_mul_ps( _mm256_sub_ps( _mm256_set1_ps( (&box.mins.x)[axis] ), origin ), inverse );
+					const __m256 t2 = _mm256_mul_ps( _mm256_sub_ps( _mm256_set1_ps( (&box.maxs.x)[axis] ), origin ), inverse );
+					enter = _mm256_max_ps( enter, _mm256_min_ps( t1, t2 ) );
+					leave = _mm256_min_ps( leave, _mm256_max_ps( t1, t2 ) );
+				}
+
+				mask |= uint32_t( _mm256_movemask_ps( _mm256_cmp_ps( enter, leave, _CMP_LE_OQ ) ) ) << base;
+			}
+
+			return mask;
+		}
+#endif
+
+#if defined( SPATIAL_SSE )
+		if constexpr ( Width % 4 == 0 )
+		{
+			for ( size_t base = 0; base < Width; base += 4 )
+			{
+				__m128 enter = _mm_setzero_ps();
+				__m128 leave = _mm_loadu_ps( maxDistances + base );
+				for ( size_t axis = 0; axis < 3; axis++ )
+				{
+					const __m128 origin = _mm_loadu_ps( &packet.origins[axis][base] );
+					const __m128 inverse = _mm_loadu_ps( &packet.inverseDirections[axis][base] );
+					const __m128 t1 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( (&box.mins.x)[axis] ), origin ), inverse );
+					const __m128 t2 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( (&box.maxs.x)[axis] ), origin ), inverse );
+					enter = _mm_max_ps( enter, _mm_min_ps( t1, t2 ) );
+					leave = _mm_min_ps( leave, _mm_max_ps( t1, t2 ) );
+				}
+
+				mask |= uint32_t( _mm_movemask_ps( _mm_cmple_ps( enter, leave ) ) ) << base;
+			}
+
+			return mask;
+		}
+#endif
+
+		for ( size_t lane = 0; lane < Width; lane++ )
+		{
+			const adm::Vec3 origin( packet.origins[0][lane], packet.origins[1][lane], packet.origins[2][lane] );
+			const adm::Vec3 inverse( packet.inverseDirections[0][lane], packet.inverseDirections[1][lane], packet.inverseDirections[2][lane] );
+
+			float enter;
+			if ( RayHitsBox( origin, inverse, maxDistances[lane], box, enter ) )
+			{
+				mask |= 1U << lane;
+			}
+		}
+
+		return mask;
+	}
+
+	namespace utils
+	{
+		// Treats a point as a little sphere, handy for picking points with the mouse
+		// Use as the hit test for FlatOctree::Raycast and RaycastPacket
+		struct RayHitsPoint
+		{
+			float radius{ 0.05f };
+
+			bool operator()( const adm::Vec3& point, const adm::Vec3& origin, const adm::Vec3& direction, float& outDistance ) const
+			{
+				const adm::Vec3 toPoint = point - origin;
+				const float along = toPoint.x * direction.x + toPoint.y * direction.y + toPoint.z * direction.z;
+				const float distanceSquared = toPoint.x * toPoint.x + toPoint.y * toPoint.y + toPoint.z * toPoint.z - along * along;
+				if ( along < 0.0f || distanceSquared > radius * radius )
+				{
+					return false;
+				}
+
+				outDistance = along - std::sqrt( radius * radius - distanceSquared );
+				return true;
+			}
+
+			// Same thing for every lane in `mask` at once, returns the lanes that hit
+			template<size_t Width>
+			uint32_t operator()( const adm::Vec3& point, const RayPacket<Width>& packet, uint32_t mask, float* outDistances ) const
+			{
+				uint32_t hitMask = 0;
+#if defined( SPATIAL_SSE )
+				if constexpr ( Width % 4 == 0 )
+				{
+					const __m128 radiusSquared = _mm_set1_ps( radius * radius );
+					const __m128 zero = _mm_setzero_ps();
+					for ( size_t base = 0; base < Width; base += 4 )
+					{
+						if ( !((mask >> base) & 0xf) )
+						{
+							continue;
+						}
+
+						__m128 along = zero;
+						__m128 lengthSquared = zero;
+						for ( size_t axis = 0; axis < 3; axis++ )
+						{
+							const __m128 toPoint = _mm_sub_ps( _mm_set1_ps( (&point.x)[axis] ), _mm_loadu_ps( &packet.origins[axis][base] ) );
+							along = _mm_add_ps( along, _mm_mul_ps( toPoint, _mm_loadu_ps( &packet.directions[axis][base] ) ) );
+							lengthSquared = _mm_add_ps( lengthSquared, _mm_mul_ps( toPoint, toPoint ) );
+						}
+
+						const __m128 distanceSquared = _mm_sub_ps( lengthSquared, _mm_mul_ps( along, along ) );
+						const __m128 hits = _mm_and_ps( _mm_cmpge_ps( along, zero ), _mm_cmple_ps( distanceSquared, radiusSquared ) );
+						const __m128 distances = _mm_sub_ps( along, _mm_sqrt_ps( _mm_max_ps( zero, _mm_sub_ps( radiusSquared, distanceSquared ) ) ) );
+
+						_mm_storeu_ps( outDistances + base, distances );
+						hitMask |= uint32_t( _mm_movemask_ps( hits ) ) << base;
+					}
+
+					return hitMask & mask;
+				}
+#endif
+				for ( size_t lane = 0; lane < Width; lane++ )
+				{
+					if ( (mask & (1U << lane))
+						&& (*this)( point, packet.Get( lane ).origin, packet.Get( lane ).direction, outDistances[lane] ) )
+					{
+						hitMask |= 1U << lane;
+					}
+				}
+
+				return hitMask;
+			}
+		};
+
+		// Whether a hit test has the packet version above, RaycastPacket falls back to testing lane by lane otherwise
+		template<typename HitFunction, typename ElementType, size_t Width, typename = void>
+		struct HasPacketHitTest : std::false_type
+		{
+		};
+
+		template<typename HitFunction, typename ElementType, size_t Width>
+		struct HasPacketHitTest<HitFunction, ElementType, Width, std::void_t<decltype( std::declval<const HitFunction&>()(
+			std::declval<const ElementType&>(), std::declval<const RayPacket<Width>&>(), uint32_t(), static_cast<float*>( nullptr ) ) )>>
+			: std::true_type
+		{
+		};
+	}
+}
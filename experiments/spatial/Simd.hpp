@@ -0,0 +1,15 @@
+#pragma once
+
+// Which SIMD instruction sets the compiler lets us use
+// Everything that uses these has a plain scalar loop for when they're not there
+#if defined( __AVX__ )
+#define SPATIAL_AVX 1
+#endif
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || (defined( _M_IX86_FP ) && _M_IX86_FP >= 2)
+#define SPATIAL_SSE 1
+#endif
+
+#if defined( SPATIAL_SSE ) || defined( SPATIAL_AVX )
+#include <immintrin.h>
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+
+namespace spatial
+{
+	// Pointer plus count, until we move to C++20 and get std::span
+	template<typename T>
+	class Span
+	{
+	public:
+		Span() = default;
+		Span( T* data, size_t size )
+			: data( data ), size( size )
+		{
+		}
+
+		T* Data() const
+		{
+			return data;
+		}
+
+		size_t Size() const
+		{
+			return size;
+		}
+
+		bool Empty() const
+		{
+			return size == 0;
+		}
+
+		T& operator[]( size_t index ) const
+		{
+			return data[index];
+		}
+
+		T* begin() const
+		{
+			return data;
+		}
+
+		T* end() const
+		{
+			return data + size;
+		}
+
+	private:
+		T* data{};
+		size_t size{};
+	};
+}
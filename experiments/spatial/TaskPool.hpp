@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace spatial
+{
+	// Counts the tasks that haven't finished yet, so you can wait on a bunch of them at once
+	class TaskGroup
+	{
+	public:
+		bool IsDone() const
+		{
+			return pending.load( std::memory_order_acquire ) == 0;
+		}
+
+	private:
+		friend class TaskPool;
+		std::atomic<int> pending{ 0 };
+	};
+
+	// Work-stealing thread pool
+	// Every worker has its own deque: it pushes and pops at the back (LIFO, so recursive
+	// work stays hot in cache), while idle workers steal from the front of everyone else's.
+	// Threads that wait on a group help out by running tasks in the meantime, which is
+	// what makes it safe to submit tasks from inside tasks and wait on them.
+	class TaskPool
+	{
+	public:
+		// 0 means one worker per hardware thread
+		explicit TaskPool( size_t numThreads = 0 )
+		{
+			if ( numThreads == 0 )
+			{
+				numThreads = std::max( 1U, std::thread::hardware_concurrency() );
+			}
+
+			numWorkers = numThreads;
+
+			// The last queue is for tasks submitted from threads outside the pool
+			for ( size_t i = 0; i <= numThreads; i++ )
+			{
+				queues.push_back( std::make_unique<Queue>() );
+			}
+
+			for ( size_t i = 0; i < numThreads; i++ )
+			{
+				workers.emplace_back( [this, i]() { WorkerLoop( int( i ) ); } );
+			}
+		}
+
+		~TaskPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock( sleepMutex );
+				stopping = true;
+			}
+			wakeUp.notify_all();
+
+			for ( std::thread& worker : workers )
+			{
+				worker.join();
+			}
+		}
+
+		TaskPool( const TaskPool& ) = delete;
+		TaskPool& operator=( const TaskPool& ) = delete;
+
+		size_t GetNumThreads() const
+		{
+			return numWorkers;
+		}
+
+		void Submit( TaskGroup& group, std::function<void()> function )
+		{
+			group.pending.fetch_add( 1, std::memory_order_relaxed );
+
+			Queue& queue = *queues[GetLocalQueueIndex()];
+			{
+				std::lock_guard<std::mutex> lock( queue.mutex );
+				queue.tasks.push_back( { std::move( function ), &group } );
+			}
+			numQueued.fetch_add( 1, std::memory_order_release );
+
+			// Taking the lock here means a worker can't miss this between checking
+			// numQueued and going to sleep
+			{
+				std::lock_guard<std::mutex> lock( sleepMutex );
+			}
+			wakeUp.notify_one();
+		}
+
+		// Runs queued tasks on the calling thread until everything in the group is done
+		void Wait( TaskGroup& group )
+		{
+			while ( !group.IsDone() )
+			{
+				if ( !TryRunTask() )
+				{
+					std::this_thread::yield();
+				}
+			}
+		}
+
+	private:
+		struct Task
+		{
+			std::function<void()> function;
+			TaskGroup* group{};
+		};
+
+		struct Queue
+		{
+			std::mutex mutex;
+			std::deque<Task> tasks;
+		};
+
+		size_t GetLocalQueueIndex() const
+		{
+			return ThisWorker().pool == this ? ThisWorker().index : numWorkers;
+		}
+
+		bool TryRunTask()
+		{
+			Task task;
+
+			const size_t self = GetLocalQueueIndex();
+			if ( !PopBack( *queues[self], task ) )
+			{
+				// Go around everyone else, starting from the neighbour, so thieves spread out a bit
+				bool stolen = false;
+				for ( size_t i = 1; i < queues.size() && !stolen; i++ )
+				{
+					stolen = PopFront( *queues[(self + i) % queues.size()], task );
+				}
+
+				if ( !stolen )
+				{
+					return false;
+				}
+			}
+
+			numQueued.fetch_sub( 1, std::memory_order_relaxed );
+			task.function();
+			task.group->pending.fetch_sub( 1, std::memory_order_release );
+			return true;
+		}
+
+		static bool PopBack( Queue& queue, Task& outTask )
+		{
+			std::lock_guard<std::mutex> lock( queue.mutex );
+			if ( queue.tasks.empty() )
+			{
+				return false;
+			}
+
+			outTask = std::move( queue.tasks.back() );
+			queue.tasks.pop_back();
+			return true;
+		}
+
+		static bool PopFront( Queue& queue, Task& outTask )
+		{
+			std::lock_guard<std::mutex> lock( queue.mutex );
+			if ( queue.tasks.empty() )
+			{
+				return false;
+			}
+
+			outTask = std::move( queue.tasks.front() );
+			queue.tasks.pop_front();
+			return true;
+		}
+
+		void WorkerLoop( int index )
+		{
+			ThisWorker() = { this, size_t( index ) };
+
+			while ( true )
+			{
+				if ( TryRunTask() )
+				{
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lock( sleepMutex );
+				wakeUp.wait( lock, [this]()
+					{
+						return stopping || numQueued.load( std::memory_order_acquire ) > 0;
+					} );
+
+				if ( stopping )
+				{
+					return;
+				}
+			}
+		}
+
+		struct WorkerIdentity
+		{
+			const TaskPool* pool{};
+			size_t index{};
+		};
+
+		static WorkerIdentity& ThisWorker()
+		{
+			static thread_local WorkerIdentity identity;
+			return identity;
+		}
+
+		std::vector<std::unique_ptr<Queue>> queues;
+		std::vector<std::thread> workers;
+		size_t numWorkers{};
+		std::atomic<int> numQueued{ 0 };
+
+		std::mutex sleepMutex;
+		std::condition_variable wakeUp;
+		bool stopping{ false };
+	};
+}
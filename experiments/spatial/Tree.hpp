@@ -0,0 +1,1787 @@
+#pragma once
+
+#include <Precompiled.hpp>
+#include "experiments/spatial/Arena.hpp"
+#include "experiments/spatial/Morton.hpp"
+#include "experiments/spatial/Span.hpp"
+#include "experiments/spatial/TaskPool.hpp"
+#include "experiments/spatial/TreeStats.hpp"
+#include <cassert>
+#include <cfloat>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <type_traits>
+
+namespace spatial
+{
+	// Where an element is, for the per-node statistics
+	// Elements without a specialisation here just don't get any
+	template<typename ElementType>
+	struct ElementPosition
+	{
+		static constexpr bool HasPosition = false;
+	};
+
+	template<>
+	struct ElementPosition<adm::Vec3>
+	{
+		static constexpr bool HasPosition = true;
+
+		static const adm::Vec3& Get( const adm::Vec3& element )
+		{
+			return element;
+		}
+	};
+
+	// The box an element takes up, for structures that care about elements' extents
+	// like LooseOctree and Bvh
+	template<typename ElementType>
+	struct ElementBounds;
+
+	template<>
+	struct ElementBounds<adm::AABB>
+	{
+		static const adm::AABB& Get( const adm::AABB& element )
+		{
+			return element;
+		}
+	};
+
+	template<>
+	struct ElementBounds<adm::Vec3>
+	{
+		static adm::AABB Get( const adm::Vec3& element )
+		{
+			return { element, element };
+		}
+	};
+
+	// Running totals over a node's elements, kept up to date by the builds and the incremental
+	// updates, so subdivision heuristics can look at a node's contents without walking them.
+	// The count is the node's GetNumElements()
+	struct NodeStats
+	{
+		adm::Vec3 positionSum;
+		// Sums of x², y² and z², only tracked if the tree is asked to (see SetTrackSecondMoments)
+		adm::Vec3 squaredSum;
+		// Bounds of the elements' positions, inverted while there are none.
+		// Removing elements doesn't shrink these, so they can be loose until the next rebuild
+		adm::AABB bounds{ adm::Vec3( FLT_MAX ), adm::Vec3( -FLT_MAX ) };
+
+		void Add( const adm::Vec3& position, bool secondMoments )
+		{
+			positionSum += position;
+			if ( secondMoments )
+			{
+				squaredSum += adm::Vec3( position.x * position.x, position.y * position.y, position.z * position.z );
+			}
+
+			bounds.mins = adm::Vec3( std::min( bounds.mins.x, position.x ), std::min( bounds.mins.y, position.y ), std::min( bounds.mins.z, position.z ) );
+			bounds.maxs = adm::Vec3( std::max( bounds.maxs.x, position.x ), std::max( bounds.maxs.y, position.y ), std::max( bounds.maxs.z, position.z ) );
+		}
+
+		void Remove( const adm::Vec3& position, bool secondMoments )
+		{
+			positionSum -= position;
+			if ( secondMoments )
+			{
+				squaredSum -= adm::Vec3( position.x * position.x, position.y * position.y, position.z * position.z );
+			}
+		}
+
+		// Adds another node's totals, or the difference some moves made to them
+		void Add( const NodeStats& other )
+		{
+			positionSum += other.positionSum;
+			squaredSum += other.squaredSum;
+			bounds.mins = adm::Vec3( std::min( bounds.mins.x, other.bounds.mins.x ), std::min( bounds.mins.y, other.bounds.mins.y ), std::min( bounds.mins.z, other.bounds.mins.z ) );
+			bounds.maxs = adm::Vec3( std::max( bounds.maxs.x, other.bounds.maxs.x ), std::max( bounds.maxs.y, other.bounds.maxs.y ), std::max( bounds.maxs.z, other.bounds.maxs.z ) );
+		}
+
+		adm::Vec3 GetMean( int32_t count ) const
+		{
+			return count > 0 ? positionSum / float( count ) : adm::Vec3();
+		}
+
+		// Per axis, needs second moments
+		adm::Vec3 GetVariance( int32_t count ) const
+		{
+			if ( count <= 0 )
+			{
+				return adm::Vec3();
+			}
+
+			const adm::Vec3 mean = GetMean( count );
+			return adm::Vec3(
+				std::max( 0.0f, squaredSum.x / float( count ) - mean.x * mean.x ),
+				std::max( 0.0f, squaredSum.y / float( count ) - mean.y * mean.y ),
+				std::max( 0.0f, squaredSum.z / float( count ) - mean.z * mean.z ) );
+		}
+	};
+
+	template<typename ElementType, typename VolumeType, size_t Dimensions, typename Policy>
+	class Tree;
+
+	// A node of spatial::Tree, the same type whatever the tree's policy is,
+	// so subdivision predicates written for one tree work with all of them
+	template<typename ElementType, typename VolumeType>
+	class TreeNode
+	{
+	public:
+		static constexpr int32_t NoChildren = -1;
+		// Nodes of a collapsed block, waiting to be reused by the next split
+		static constexpr int32_t Unused = -2;
+
+		// Leaves return how many elements they hold,
+		// internal nodes return how many there are in their subtree
+		int32_t GetNumElements() const
+		{
+			return numElements;
+		}
+
+		const VolumeType& GetBoundingVolume() const
+		{
+			return volume;
+		}
+
+		bool IsLeaf() const
+		{
+			return firstChild == NoChildren;
+		}
+
+		// Left behind by incremental updates, skip these when walking GetNodes()
+		bool IsUnused() const
+		{
+			return firstChild == Unused;
+		}
+
+		// Index of the first child in GetNodes(), the other children come right after it
+		int32_t GetFirstChild() const
+		{
+			return firstChild;
+		}
+
+		int32_t GetParent() const
+		{
+			return parent;
+		}
+
+		uint32_t GetDepth() const
+		{
+			return depth;
+		}
+
+		// O(1), for leaves and internal nodes alike, all zeroes if elements have no ElementPosition
+		const NodeStats& GetStats() const
+		{
+			return stats;
+		}
+
+		// Only leaves hold elements, this does nothing for internal nodes
+		// These point into the leaf's slice, not into the tree's GetElements()
+		template<typename FunctionType>
+		void ForEachElement( FunctionType&& function ) const
+		{
+			if ( !IsLeaf() )
+			{
+				return;
+			}
+
+			for ( int32_t i = 0; i < numElements; i++ )
+			{
+				function( &elementSlice[i] );
+			}
+		}
+
+		// The leaf's elements back to back, empty for internal nodes
+		Span<const ElementType> GetElementSpan() const
+		{
+			if ( !IsLeaf() )
+			{
+				return {};
+			}
+
+			return { elementSlice, size_t( numElements ) };
+		}
+
+		// Where each element of GetElementSpan() is in the tree's GetElements()
+		Span<const uint32_t> GetElementIndices() const
+		{
+			if ( !IsLeaf() )
+			{
+				return {};
+			}
+
+			return { elementIndices, size_t( numElements ) };
+		}
+
+	private:
+		template<typename, typename, size_t, typename>
+		friend class Tree;
+
+		VolumeType volume{};
+		int32_t firstChild{ NoChildren };
+		int32_t parent{ -1 };
+		int32_t numElements{};
+		uint32_t depth{};
+		// Where this leaf is in GetLeaves(), -1 for internal nodes
+		int32_t leafSlot{ -1 };
+		// Leaves can have some room to grow before their run has to move
+		uint32_t elementCapacity{};
+		// GetNumElements() as of when this node was last built, Refit compares against it
+		int32_t builtNumElements{};
+		// Into the tree's leaf arrays, or into build scratch while building
+		uint32_t* elementIndices{};
+		ElementType* elementSlice{};
+		NodeStats stats;
+	};
+
+	// The same four callbacks Initialise takes, as a Tree policy, e.g.
+	// Tree<adm::Vec3, adm::AABB, 3, FunctionPolicy<utils::IntersectsAABB, utils::OccupiesBox,
+	//	utils::SimpleThreshold<adm::Vec3, 40>, utils::GetAABBForChild>>
+	// They're template arguments, so every call is a direct call the compiler can inline
+	template<auto IntersectsFunction, auto OccupiesFunction, auto ShouldSubdivideFunction, auto ChildVolumeFunction>
+	struct FunctionPolicy
+	{
+		template<typename ElementType, typename VolumeType>
+		static bool Intersects( const ElementType& element, const VolumeType& volume )
+		{
+			return IntersectsFunction( element, volume );
+		}
+
+		template<typename ElementType, typename VolumeType>
+		static bool Occupies( const ElementType& element, const VolumeType& volume )
+		{
+			return OccupiesFunction( element, volume );
+		}
+
+		template<typename NodeType>
+		static bool ShouldSubdivide( const NodeType& node )
+		{
+			return ShouldSubdivideFunction( node );
+		}
+
+		template<typename VolumeType>
+		static VolumeType GetChildVolume( const VolumeType& parentVolume, size_t childIndex )
+		{
+			return ChildVolumeFunction( parentVolume, childIndex );
+		}
+	};
+
+	// N-dimensional spatial tree, same interface as adm::NTree (Initialise, SetElements,
+	// Rebuild, GetNodes, GetLeaves), but it lives in this repo so we can actually mess with it
+	//
+	// Nodes are stored in one array. When a node subdivides, its children are appended as
+	// one block, then the children are subdivided one after another, depth-first. That
+	// order is what lets the parallel build produce exactly the same array as the serial one.
+	// Leaves reference a contiguous run of element indices, all leaves share one index array,
+	// and next to that index array is a copy of the elements themselves in the same order,
+	// so a leaf's elements are one contiguous slice that can be looped over directly.
+	//
+	// After a build, elements can be inserted, removed and moved one by one. That only touches
+	// the leaves the element is in, splitting them when the subdivision predicate says so,
+	// and collapsing a set of sibling leaves back into their parent once it says otherwise.
+	// Or they can all be moved at once with Refit, which keeps the tree's shape and only
+	// rebuilds the subtrees that have drifted too far from what they were built with.
+	//
+	// Everything a rebuild needs temporarily comes out of an Arena that's reset at the start of
+	// the next one, so once it has grown to fit, rebuilding makes no heap allocations at all
+	// (other than the task pool's own bookkeeping in a parallel build).
+	//
+	// What the tree does with elements and volumes comes from a policy. By default that's
+	// whatever callbacks are handed to Initialise, which is the easiest to experiment with.
+	// Alternatively, Policy is a type with Intersects, Occupies, ShouldSubdivide and
+	// GetChildVolume, which are then known at compile time and get inlined into the
+	// partition loop, see FunctionPolicy
+	template<typename ElementType, typename VolumeType, size_t Dimensions, typename Policy = void>
+	class Tree
+	{
+	public:
+		static constexpr size_t NumChildren = size_t( 1 ) << Dimensions;
+		// Safety net against piles of coincident elements that'd subdivide forever
+		static constexpr uint32_t MaxDepth = 20;
+
+		// Refit measures drift against at least this many elements, so nearly empty nodes
+		// don't get rebuilt every time a couple of elements wander in
+		static constexpr int32_t RefitMinElements = 32;
+
+		// Below this many elements, a subtree is built on whichever thread got to it
+		static constexpr int32_t ParallelSubtreeThreshold = 4096;
+		// Above this many elements, the partitioning itself is split across threads
+		static constexpr int32_t ParallelPartitionThreshold = 1 << 16;
+
+		using Node = TreeNode<ElementType, VolumeType>;
+		using NodeType = Node;
+		static constexpr int32_t NoChildren = Node::NoChildren;
+		static constexpr int32_t Unused = Node::Unused;
+
+		// What a Refit ended up doing
+		struct RefitResult
+		{
+			// Elements that left their leaf, or were in more than one, and went through Remove and Insert
+			uint32_t numMigrated{};
+			uint32_t numRebuiltSubtrees{};
+		};
+
+		// Whether an element touches a volume at all
+		using IntersectsFn = std::function<bool( const ElementType& element, const VolumeType& volume )>;
+		// Whether an element is entirely inside a volume, meaning no sibling can have it
+		using OccupiesFn = std::function<bool( const ElementType& element, const VolumeType& volume )>;
+		// Called from worker threads during a parallel rebuild, so keep it free of side-effects
+		using ShouldSubdivideFn = std::function<bool( const Node& node )>;
+		using ChildVolumeFn = std::function<VolumeType( const VolumeType& parentVolume, size_t childIndex )>;
+
+		// Only for trees without a Policy
+		void Initialise( const VolumeType& rootVolume, IntersectsFn intersectsFunction, OccupiesFn occupiesFunction,
+			ShouldSubdivideFn shouldSubdivideFunction, ChildVolumeFn childVolumeFunction )
+		{
+			static_assert( std::is_void_v<Policy>, "This tree's behaviour comes from its Policy, use Initialise( rootVolume )" );
+
+			volume = rootVolume;
+			policy.intersects = std::move( intersectsFunction );
+			policy.occupies = std::move( occupiesFunction );
+			policy.shouldSubdivide = std::move( shouldSubdivideFunction );
+			policy.getChildVolume = std::move( childVolumeFunction );
+		}
+
+		// Only for trees with a Policy
+		void Initialise( const VolumeType& rootVolume )
+		{
+			static_assert( !std::is_void_v<Policy>, "This tree needs callbacks, use the other Initialise" );
+
+			volume = rootVolume;
+		}
+
+		// Sums of squared positions in every node's stats, for heuristics that want a variance
+		// Costs a few multiplies per element per level, takes effect on the next build
+		void SetTrackSecondMoments( bool track )
+		{
+			trackSecondMoments = track;
+		}
+
+		// How far a node's element count can get from what it was built with, as a fraction of
+		// that, before Refit rebuilds the node's subtree. 0.5 by default
+		void SetRefitThreshold( float threshold )
+		{
+			refitThreshold = threshold;
+		}
+
+		// Where rebuilds get their scratch memory from, nullptr goes back to the tree's own arena
+		// The tree won't reset someone else's resource, that's up to whoever owns it
+		void SetBuildAllocator( std::pmr::memory_resource* resource )
+		{
+			buildResource = resource;
+		}
+
+		// e.g. to turn on huge pages
+		Arena& GetBuildArena()
+		{
+			return *buildArena;
+		}
+
+		void SetElements( adm::Vector<ElementType>&& newElements )
+		{
+			elements = std::move( newElements );
+			freeElements.clear();
+			ResetNodes();
+		}
+
+		// Serial build
+		void Rebuild()
+		{
+			Build( nullptr );
+		}
+
+		// Parallel build, subtrees are handed out to the pool as tasks
+		// The resulting tree is identical to what Rebuild() gives you
+		void Rebuild( TaskPool& pool )
+		{
+			Build( &pool );
+		}
+
+		// Linear build for point-like elements
+		// getCode maps an element to its Morton code (Dimensions bits per level, highest level
+		// in the highest bits), e.g. morton::PointEncoder for octrees of Vec3s. The codes are
+		// radix-sorted, after which every node is just a contiguous range of the sorted array,
+		// and its children are found by binary-searching that range, so elements are never
+		// touched again after sorting, unless the subdivision predicate itself looks at them.
+		//
+		// Unlike Rebuild, every element ends up in exactly one leaf (the one its code points
+		// to), so points sitting right on a child boundary aren't duplicated into neighbours.
+		//
+		// That leaf isn't always one the element's volume touches (quantising can round a point
+		// over a boundary), and Insert, Remove, Update and Refit find elements by their volume.
+		// So the first of those on a tree built this way rebuilds it with Rebuild() beforehand,
+		// and from then on it's an ordinary tree. Call RebuildMorton again to go back
+		template<typename CodeFunctionType>
+		void RebuildMorton( CodeFunctionType&& getCode )
+		{
+			adm::Timer totalTimer;
+			adm::Timer timer;
+			buildTimings = {};
+
+			ResetNodes();
+			builtByMorton = true;
+			std::pmr::memory_resource* resource = BeginScratch();
+
+			const ScratchVector<uint32_t> liveElements = GatherLiveElements( resource );
+			ScratchVector<morton::KeyIndex> keys( liveElements.size(), resource );
+			for ( size_t i = 0; i < liveElements.size(); i++ )
+			{
+				keys[i] = { getCode( elements[liveElements[i]] ), liveElements[i] };
+			}
+
+			buildTimings.gather = timer.GetElapsedAndReset();
+
+			ScratchVector<morton::KeyIndex> scratch( resource );
+			morton::RadixSort( keys, scratch );
+
+			// The only random access to the elements, after this they're in leaf order
+			leafElements.resize( keys.size() );
+			leafElementData.resize( keys.size() );
+			for ( size_t i = 0; i < keys.size(); i++ )
+			{
+				leafElements[i] = keys[i].index;
+				leafElementData[i] = elements[keys[i].index];
+			}
+
+			buildTimings.sort = timer.GetElapsedAndReset();
+
+			Node root;
+			root.volume = volume;
+			root.numElements = int32_t( keys.size() );
+			root.elementIndices = leafElements.data();
+			root.elementSlice = leafElementData.data();
+			root.stats = GatherStats( root.elementSlice, keys.size() );
+
+			nodes.emplace_back();
+			SubdivideMorton( root, keys.data() );
+			nodes[0] = root;
+
+			buildTimings.subdivide = timer.GetElapsedAndReset();
+
+			FinishBuild();
+
+			buildTimings.finish = timer.GetElapsed();
+			buildTimings.total = totalTimer.GetElapsed();
+		}
+
+		// Adds an element to every leaf it touches and returns its index in GetElements()
+		// Needs a built tree. Indices of removed elements get reused
+		uint32_t Insert( const ElementType& element )
+		{
+			LeaveMortonLayout();
+
+			uint32_t index;
+			if ( !freeElements.empty() )
+			{
+				index = freeElements.back();
+				freeElements.pop_back();
+				elements[index] = element;
+			}
+			else
+			{
+				index = uint32_t( elements.size() );
+				elements.push_back( element );
+			}
+
+			InsertIntoTree( index );
+			return index;
+		}
+
+		// Takes an element out of every leaf it's in, collapsing leaves where possible
+		// Its slot in GetElements() stays there, but nothing references it anymore
+		void Remove( uint32_t index )
+		{
+			LeaveMortonLayout();
+			RemoveFromTree( index );
+			freeElements.push_back( index );
+		}
+
+		// Moves an element. If it's still inside its one and only leaf, this is just a write,
+		// otherwise it gets removed and inserted again
+		void Update( uint32_t index, const ElementType& newElement )
+		{
+			LeaveMortonLayout();
+
+			int32_t onlyLeaf = -1;
+			int32_t numLeaves = 0;
+			VisitNodesTouching( elements[index], [&]( int32_t nodeIndex )
+				{
+					if ( nodes[nodeIndex].IsLeaf() )
+					{
+						onlyLeaf = nodeIndex;
+						numLeaves++;
+					}
+				} );
+
+			if ( numLeaves == 1 && policy.Occupies( newElement, nodes[onlyLeaf].volume ) )
+			{
+				const Node& leaf = nodes[onlyLeaf];
+				const uint32_t* found = std::find( leaf.elementIndices, leaf.elementIndices + leaf.numElements, index );
+				leaf.elementSlice[found - leaf.elementIndices] = newElement;
+
+				// Same path down as before, since it's still inside the same leaf
+				for ( int32_t nodeIndex = onlyLeaf; nodeIndex >= 0; nodeIndex = nodes[nodeIndex].parent )
+				{
+					RemoveFromStats( nodes[nodeIndex].stats, elements[index] );
+					AddToStats( nodes[nodeIndex].stats, newElement );
+				}
+
+				elements[index] = newElement;
+				return;
+			}
+
+			RemoveFromTree( index );
+			elements[index] = newElement;
+			InsertIntoTree( index );
+		}
+
+		// Moves every element at once, e.g. after a simulation step. `newElements` lines up with
+		// GetElements(), the slots of removed elements are ignored. Needs a built tree.
+		// It has to be exactly as long as GetElements(), anything else is refused and nothing moves
+		//
+		// Leaves are walked in place: elements that stay inside their one leaf are just written
+		// over, with the change to the stats summed per leaf and passed up once. The rest are
+		// taken out and put back in like Update does, except leaves aren't split or collapsed.
+		// After that, for every leaf that got or lost elements, the highest node on its path
+		// that's drifted past the refit threshold gets its whole subtree rebuilt.
+		RefitResult Refit( const adm::Vector<ElementType>& newElements )
+		{
+			RefitResult result;
+			assert( newElements.size() == elements.size() && "Refit needs a new value for every slot in GetElements()" );
+			if ( newElements.size() != elements.size() )
+			{
+				return result;
+			}
+
+			LeaveMortonLayout();
+
+			// Old values come from the leaves' slices, which are in leaf order, so the only
+			// random access per element is reading its new value
+			adm::Vector<Migrant>& migrants = scratchMigrants;
+			adm::Vector<int32_t>& dirtyLeaves = scratchDirtyLeaves;
+			migrants.clear();
+			dirtyLeaves.clear();
+			refitEpoch++;
+			refitMarks.resize( elements.size() );
+			size_t numSeen = 0;
+			for ( Node* leaf : leaves )
+			{
+				NodeStats delta;
+				bool moved = false;
+				for ( int32_t i = 0; i < leaf->numElements; i++ )
+				{
+					const uint32_t index = leaf->elementIndices[i];
+					const ElementType& oldElement = leaf->elementSlice[i];
+
+					// Elements on a boundary can be in more than one leaf, those go the slow way,
+					// and they're marked so they only do it once
+					if ( !policy.Occupies( oldElement, leaf->volume ) )
+					{
+						if ( refitMarks[index] != refitEpoch )
+						{
+							refitMarks[index] = refitEpoch;
+							migrants.push_back( { index, oldElement, -1 } );
+							numSeen++;
+						}
+						continue;
+					}
+
+					numSeen++;
+					const ElementType& newElement = newElements[index];
+					// A lone root leaf keeps everything, like it does for Insert
+					if ( !policy.Occupies( newElement, leaf->volume ) && leaf->parent >= 0 )
+					{
+						migrants.push_back( { index, oldElement, TakeOutOfLeaf( *leaf, i, newElement ) } );
+						dirtyLeaves.push_back( int32_t( leaf - nodes.data() ) );
+						// The last element was swapped into this slot
+						i--;
+						continue;
+					}
+
+					RemoveFromStats( delta, oldElement );
+					AddToStats( delta, newElement );
+					leaf->elementSlice[i] = newElement;
+					moved = true;
+				}
+
+				if constexpr ( ElementPosition<ElementType>::HasPosition )
+				{
+					for ( int32_t nodeIndex = int32_t( leaf - nodes.data() ); moved && nodeIndex >= 0; nodeIndex = nodes[nodeIndex].parent )
+					{
+						nodes[nodeIndex].stats.Add( delta );
+					}
+				}
+			}
+
+			// Some elements aren't in any leaf, e.g. ones outside the root volume, which
+			// is rare enough to just go looking for them when the numbers don't add up
+			if ( numSeen < elements.size() - freeElements.size() )
+			{
+				for ( const Node* leaf : leaves )
+				{
+					for ( int32_t i = 0; i < leaf->numElements; i++ )
+					{
+						refitMarks[leaf->elementIndices[i]] = refitEpoch;
+					}
+				}
+
+				for ( const uint32_t& index : freeElements )
+				{
+					refitMarks[index] = refitEpoch;
+				}
+
+				for ( uint32_t index = 0; index < uint32_t( elements.size() ); index++ )
+				{
+					if ( refitMarks[index] != refitEpoch )
+					{
+						migrants.push_back( { index, elements[index], -1 } );
+					}
+				}
+			}
+
+			// Removed slots get whatever's in newElements, nothing looks at them anyway
+			std::copy( newElements.begin(), newElements.end(), elements.begin() );
+
+			for ( const Migrant& migrant : migrants )
+			{
+				if ( migrant.fromNode < 0 )
+				{
+					RemoveFromLeaves( migrant.index, migrant.oldElement );
+					dirtyLeaves.insert( dirtyLeaves.end(), scratchLeaves.begin(), scratchLeaves.end() );
+					InsertIntoLeaves( migrant.index );
+				}
+				else
+				{
+					InsertIntoLeaves( migrant.index, migrant.fromNode );
+				}
+				dirtyLeaves.insert( dirtyLeaves.end(), scratchLeaves.begin(), scratchLeaves.end() );
+			}
+			result.numMigrated = uint32_t( migrants.size() );
+
+			std::sort( dirtyLeaves.begin(), dirtyLeaves.end() );
+			dirtyLeaves.erase( std::unique( dirtyLeaves.begin(), dirtyLeaves.end() ), dirtyLeaves.end() );
+
+			// Taking the highest one per path means no subtree on the list is inside another one
+			adm::Vector<int32_t>& subtrees = scratchSubtrees;
+			subtrees.clear();
+			for ( const int32_t& leafIndex : dirtyLeaves )
+			{
+				int32_t highest = -1;
+				for ( int32_t nodeIndex = leafIndex; nodeIndex >= 0; nodeIndex = nodes[nodeIndex].parent )
+				{
+					if ( HasDrifted( nodes[nodeIndex] ) )
+					{
+						highest = nodeIndex;
+					}
+				}
+
+				if ( highest >= 0 )
+				{
+					subtrees.push_back( highest );
+				}
+			}
+
+			std::sort( subtrees.begin(), subtrees.end() );
+			subtrees.erase( std::unique( subtrees.begin(), subtrees.end() ), subtrees.end() );
+			for ( const int32_t& nodeIndex : subtrees )
+			{
+				RebuildSubtree( nodeIndex );
+			}
+			result.numRebuiltSubtrees = uint32_t( subtrees.size() );
+
+			return result;
+		}
+
+		const adm::Vector<Node>& GetNodes() const
+		{
+			return nodes;
+		}
+
+		const adm::Vector<Node*>& GetLeaves() const
+		{
+			return leaves;
+		}
+
+		// Includes the slots of removed elements
+		const adm::Vector<ElementType>& GetElements() const
+		{
+			return elements;
+		}
+
+		// What the tree holds on to between builds, not counting the build arena
+		size_t GetMemoryUsage() const
+		{
+			return (elements.capacity() + leafElementData.capacity()) * sizeof( ElementType )
+				+ (freeElements.capacity() + leafElements.capacity()) * sizeof( uint32_t )
+				+ nodes.capacity() * sizeof( Node )
+				+ leaves.capacity() * sizeof( Node* )
+				+ freeBlocks.capacity() * sizeof( int32_t );
+		}
+
+		// Shape, occupancy and memory of the tree as it is now, with the timings of the last full build
+		// Walks every node, so it's meant for tuning and overlays, not for every frame of a big tree
+		TreeStats GetStats() const
+		{
+			TreeStats stats;
+			stats.timings = buildTimings;
+			stats.nodeBytes = nodes.capacity() * sizeof( Node ) + leaves.capacity() * sizeof( Node* )
+				+ freeBlocks.capacity() * sizeof( int32_t );
+			stats.elementBytes = (elements.capacity() + leafElementData.capacity()) * sizeof( ElementType )
+				+ (freeElements.capacity() + leafElements.capacity()) * sizeof( uint32_t );
+			stats.arenaBytes = buildArena->GetBytesReserved();
+
+			for ( const Node& node : nodes )
+			{
+				// Collapsed child blocks waiting to be reused
+				if ( node.IsUnused() )
+				{
+					continue;
+				}
+
+				if ( node.depth >= stats.nodesPerDepth.size() )
+				{
+					stats.nodesPerDepth.resize( node.depth + 1 );
+					stats.leavesPerDepth.resize( node.depth + 1 );
+				}
+
+				stats.numNodes++;
+				stats.nodesPerDepth[node.depth]++;
+				stats.maxDepth = std::max( stats.maxDepth, node.depth );
+				if ( !node.IsLeaf() )
+				{
+					continue;
+				}
+
+				const size_t numElements = size_t( node.numElements );
+				stats.numLeaves++;
+				stats.leavesPerDepth[node.depth]++;
+				stats.numEmptyLeaves += numElements == 0;
+				stats.occupancy[TreeStats::GetOccupancyBucket( numElements )]++;
+				stats.numLeafElements += numElements;
+				stats.maxLeafElements = std::max( stats.maxLeafElements, numElements );
+			}
+
+			return stats;
+		}
+
+		// Same node layout, same volumes, same elements in the same order
+		// The other tree's policy can differ, e.g. to check it does the same thing
+		template<typename OtherPolicy>
+		bool IsIdenticalTo( const Tree<ElementType, VolumeType, Dimensions, OtherPolicy>& other ) const
+		{
+			const auto& otherNodes = other.GetNodes();
+			if ( nodes.size() != otherNodes.size() )
+			{
+				return false;
+			}
+
+			for ( size_t i = 0; i < nodes.size(); i++ )
+			{
+				const Node& a = nodes[i];
+				const Node& b = otherNodes[i];
+
+				if ( a.firstChild != b.firstChild
+					|| a.numElements != b.numElements
+					|| a.depth != b.depth
+					|| std::memcmp( &a.volume, &b.volume, sizeof( VolumeType ) ) )
+				{
+					return false;
+				}
+
+				if ( a.IsLeaf() && a.numElements > 0
+					&& std::memcmp( a.elementIndices, b.elementIndices, a.numElements * sizeof( uint32_t ) ) )
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+	private:
+		// Forwards to the callbacks given to Initialise
+		struct CallbackPolicy
+		{
+			IntersectsFn intersects;
+			OccupiesFn occupies;
+			ShouldSubdivideFn shouldSubdivide;
+			ChildVolumeFn getChildVolume;
+
+			bool Intersects( const ElementType& element, const VolumeType& volume ) const
+			{
+				return intersects( element, volume );
+			}
+
+			bool Occupies( const ElementType& element, const VolumeType& volume ) const
+			{
+				return occupies( element, volume );
+			}
+
+			bool ShouldSubdivide( const Node& node ) const
+			{
+				return shouldSubdivide( node );
+			}
+
+			VolumeType GetChildVolume( const VolumeType& parentVolume, size_t childIndex ) const
+			{
+				return getChildVolume( parentVolume, childIndex );
+			}
+		};
+
+		using PolicyType = std::conditional_t<std::is_void_v<Policy>, CallbackPolicy, Policy>;
+
+		// An element Refit has to put back in somewhere else
+		struct Migrant
+		{
+			uint32_t index;
+			// Where the tree had it, if it still has to be taken out
+			ElementType oldElement;
+			// Already taken out, and has to go somewhere below this node, or -1 for the root
+			int32_t fromNode;
+		};
+
+		template<typename T>
+		using ScratchVector = std::pmr::vector<T>;
+
+		// A node plus the elements it owns while the top-down build is running
+		// The elements are carried along by value, so partitioning them is a linear pass
+		// It's allocator-aware, so ScratchVectors of these hand their resource down to the lists
+		struct BuildNode
+		{
+			using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+			explicit BuildNode( const allocator_type& allocator )
+				: indices( allocator ), values( allocator )
+			{
+			}
+
+			BuildNode( BuildNode&& other ) = default;
+			BuildNode( BuildNode&& other, const allocator_type& allocator )
+				: node( other.node ), indices( std::move( other.indices ), allocator ), values( std::move( other.values ), allocator )
+			{
+			}
+
+			BuildNode& operator=( BuildNode&& other ) = default;
+
+			Node node;
+			ScratchVector<uint32_t> indices;
+			ScratchVector<ElementType> values;
+
+			void AttachElements( ScratchVector<uint32_t>&& newIndices, ScratchVector<ElementType>&& newValues )
+			{
+				indices = std::move( newIndices );
+				values = std::move( newValues );
+				node.numElements = int32_t( indices.size() );
+				node.elementIndices = indices.data();
+				node.elementSlice = values.data();
+			}
+		};
+
+		void ResetNodes()
+		{
+			builtByMorton = false;
+			nodes.clear();
+			leaves.clear();
+			leafElements.clear();
+			leafElementData.clear();
+			freeBlocks.clear();
+			leafElementsGarbage = 0;
+		}
+
+		// Resets the tree's own arena if that's what the build is using
+		std::pmr::memory_resource* BeginScratch()
+		{
+			if ( !buildResource )
+			{
+				buildArena->Reset();
+				return buildArena.get();
+			}
+
+			return buildResource;
+		}
+
+		// Every element index except the removed ones
+		ScratchVector<uint32_t> GatherLiveElements( std::pmr::memory_resource* resource ) const
+		{
+			ScratchVector<bool> removed( elements.size(), false, resource );
+			for ( const uint32_t& index : freeElements )
+			{
+				removed[index] = true;
+			}
+
+			ScratchVector<uint32_t> live( resource );
+			live.reserve( elements.size() - freeElements.size() );
+			for ( size_t i = 0; i < elements.size(); i++ )
+			{
+				if ( !removed[i] )
+				{
+					live.push_back( uint32_t( i ) );
+				}
+			}
+
+			return live;
+		}
+
+		void Build( TaskPool* pool )
+		{
+			adm::Timer totalTimer;
+			adm::Timer timer;
+			buildTimings = {};
+
+			ResetNodes();
+			std::pmr::memory_resource* resource = BeginScratch();
+
+			ScratchVector<uint32_t> liveElements = GatherLiveElements( resource );
+			ScratchVector<ElementType> liveValues( resource );
+			liveValues.reserve( liveElements.size() );
+			for ( const uint32_t& index : liveElements )
+			{
+				liveValues.push_back( elements[index] );
+			}
+
+			buildTimings.gather = timer.GetElapsedAndReset();
+
+			BuildNode root( resource );
+			root.node.volume = volume;
+			root.node.stats = GatherStats( liveValues.data(), liveValues.size() );
+			root.AttachElements( std::move( liveElements ), std::move( liveValues ) );
+
+			// Placeholder so the root's children start at 1
+			ScratchVector<BuildNode> buildNodes( resource );
+			buildNodes.emplace_back();
+			Subdivide( root, buildNodes, pool );
+			buildNodes[0] = std::move( root );
+
+			buildTimings.subdivide = timer.GetElapsedAndReset();
+
+			// Flatten the leaves' element lists into one array
+			size_t totalElements = 0;
+			for ( const BuildNode& buildNode : buildNodes )
+			{
+				totalElements += buildNode.indices.size();
+			}
+
+			leafElements.reserve( totalElements );
+			leafElementData.reserve( totalElements );
+			nodes.resize( buildNodes.size() );
+			for ( size_t i = 0; i < buildNodes.size(); i++ )
+			{
+				nodes[i] = buildNodes[i].node;
+				nodes[i].elementIndices = leafElements.data() + leafElements.size();
+				nodes[i].elementSlice = leafElementData.data() + leafElementData.size();
+				leafElements.insert( leafElements.end(), buildNodes[i].indices.begin(), buildNodes[i].indices.end() );
+				leafElementData.insert( leafElementData.end(), buildNodes[i].values.begin(), buildNodes[i].values.end() );
+			}
+
+			FinishBuild();
+
+			buildTimings.finish = timer.GetElapsed();
+			buildTimings.total = totalTimer.GetElapsed();
+		}
+
+		// Parent links, leaf slots and tight run capacities, shared by both builders
+		void FinishBuild()
+		{
+			for ( size_t i = 0; i < nodes.size(); i++ )
+			{
+				Node& node = nodes[i];
+				node.builtNumElements = node.numElements;
+				if ( node.IsLeaf() )
+				{
+					node.elementCapacity = uint32_t( node.numElements );
+					node.leafSlot = int32_t( leaves.size() );
+					leaves.push_back( &node );
+					continue;
+				}
+
+				for ( size_t c = 0; c < NumChildren; c++ )
+				{
+					nodes[node.firstChild + c].parent = int32_t( i );
+				}
+			}
+		}
+
+		// Appends everything below `node` to `out`. Child indices are relative to the start
+		// of `out`, and `node` itself must not live in `out`, since `out` grows in here
+		void Subdivide( BuildNode& node, ScratchVector<BuildNode>& out, TaskPool* pool )
+		{
+			if ( node.node.depth >= MaxDepth || !policy.ShouldSubdivide( node.node ) )
+			{
+				return;
+			}
+
+			const size_t firstChild = out.size();
+			node.node.firstChild = int32_t( firstChild );
+
+			VolumeType childVolumes[NumChildren];
+			out.resize( firstChild + NumChildren );
+			BuildNode* children = &out[firstChild];
+			for ( size_t c = 0; c < NumChildren; c++ )
+			{
+				childVolumes[c] = policy.GetChildVolume( node.node.volume, c );
+				children[c].node.volume = childVolumes[c];
+				children[c].node.depth = node.node.depth + 1;
+			}
+
+			std::pmr::memory_resource* resource = out.get_allocator().resource();
+			ScratchVector<ScratchVector<uint32_t>> indexLists( NumChildren, resource );
+			ScratchVector<ScratchVector<ElementType>> valueLists( NumChildren, resource );
+			NodeStats childStats[NumChildren];
+			Partition( node.indices.data(), node.values.data(), node.indices.size(), childVolumes,
+				indexLists.data(), valueLists.data(), childStats, pool );
+			for ( size_t c = 0; c < NumChildren; c++ )
+			{
+				children[c].node.stats = childStats[c];
+				children[c].AttachElements( std::move( indexLists[c] ), std::move( valueLists[c] ) );
+			}
+
+			// Hands them back to the arena for the children to reuse
+			node.indices.clear();
+			node.indices.shrink_to_fit();
+			node.values.clear();
+			node.values.shrink_to_fit();
+			node.node.elementIndices = nullptr;
+			node.node.elementSlice = nullptr;
+
+			if ( pool && node.node.numElements >= ParallelSubtreeThreshold )
+			{
+				// Each child builds its subtree into its own array, then they're stitched
+				// back together in child order, which is the order the serial build uses
+				ScratchVector<BuildNode> localChildren( resource );
+				ScratchVector<ScratchVector<BuildNode>> localNodes( NumChildren, resource );
+				localChildren.reserve( NumChildren );
+
+				TaskGroup group;
+				for ( size_t c = 0; c < NumChildren; c++ )
+				{
+					localChildren.push_back( std::move( out[firstChild + c] ) );
+					pool->Submit( group, [&, c]()
+						{
+							Subdivide( localChildren[c], localNodes[c], pool );
+						} );
+				}
+				pool->Wait( group );
+
+				for ( size_t c = 0; c < NumChildren; c++ )
+				{
+					const int32_t offset = int32_t( out.size() );
+					Relocate( localChildren[c].node, offset );
+					for ( BuildNode& local : localNodes[c] )
+					{
+						Relocate( local.node, offset );
+						out.push_back( std::move( local ) );
+					}
+
+					out[firstChild + c] = std::move( localChildren[c] );
+				}
+			}
+			else
+			{
+				for ( size_t c = 0; c < NumChildren; c++ )
+				{
+					BuildNode child = std::move( out[firstChild + c] );
+					Subdivide( child, out, pool );
+					out[firstChild + c] = std::move( child );
+				}
+			}
+		}
+
+		static void Relocate( Node& node, int32_t offset )
+		{
+			if ( !node.IsLeaf() )
+			{
+				node.firstChild += offset;
+			}
+		}
+
+		// Elements strictly inside a child only go there, ones on the boundary go to every child they touch
+		// `values` are the elements belonging to `indices`, which saves a trip through the element array
+		// Each child's stats are gathered along the way if `outStats` is given
+		void PartitionRange( const uint32_t* indices, const ElementType* values, size_t count, const VolumeType* childVolumes,
+			ScratchVector<uint32_t>* outIndices, ScratchVector<ElementType>* outValues, NodeStats* outStats ) const
+		{
+			for ( size_t i = 0; i < count; i++ )
+			{
+				const ElementType& element = values[i];
+				for ( size_t c = 0; c < NumChildren; c++ )
+				{
+					if ( policy.Occupies( element, childVolumes[c] ) )
+					{
+						outIndices[c].push_back( indices[i] );
+						outValues[c].push_back( element );
+						if ( outStats )
+						{
+							AddToStats( outStats[c], element );
+						}
+						break;
+					}
+
+					if ( policy.Intersects( element, childVolumes[c] ) )
+					{
+						outIndices[c].push_back( indices[i] );
+						outValues[c].push_back( element );
+						if ( outStats )
+						{
+							AddToStats( outStats[c], element );
+						}
+					}
+				}
+			}
+		}
+
+		void Partition( const uint32_t* indices, const ElementType* values, size_t count, const VolumeType* childVolumes,
+			ScratchVector<uint32_t>* indexLists, ScratchVector<ElementType>* valueLists, NodeStats* childStats, TaskPool* pool ) const
+		{
+			if ( !pool || count < size_t( ParallelPartitionThreshold ) )
+			{
+				PartitionRange( indices, values, count, childVolumes, indexLists, valueLists, childStats );
+				return;
+			}
+
+			// Split into chunks, partition each one separately, then concatenate per child
+			// in chunk order, so element order is the same as in a serial partition
+			const size_t numChunks = pool->GetNumThreads() * 4;
+			const size_t chunkSize = (count + numChunks - 1) / numChunks;
+
+			std::pmr::memory_resource* resource = indexLists[0].get_allocator().resource();
+			ScratchVector<ScratchVector<uint32_t>> chunkIndices( numChunks * NumChildren, resource );
+			ScratchVector<ScratchVector<ElementType>> chunkValues( numChunks * NumChildren, resource );
+			TaskGroup group;
+			for ( size_t chunk = 0; chunk < numChunks; chunk++ )
+			{
+				const size_t begin = std::min( count, chunk * chunkSize );
+				const size_t end = std::min( count, begin + chunkSize );
+				pool->Submit( group, [&, chunk, begin, end]()
+					{
+						PartitionRange( indices + begin, values + begin, end - begin, childVolumes,
+							&chunkIndices[chunk * NumChildren], &chunkValues[chunk * NumChildren], nullptr );
+					} );
+			}
+			pool->Wait( group );
+
+			for ( size_t c = 0; c < NumChildren; c++ )
+			{
+				size_t total = 0;
+				for ( size_t chunk = 0; chunk < numChunks; chunk++ )
+				{
+					total += chunkIndices[chunk * NumChildren + c].size();
+				}
+
+				indexLists[c].reserve( total );
+				valueLists[c].reserve( total );
+				for ( size_t chunk = 0; chunk < numChunks; chunk++ )
+				{
+					const ScratchVector<uint32_t>& chunkIndexList = chunkIndices[chunk * NumChildren + c];
+					const ScratchVector<ElementType>& chunkValueList = chunkValues[chunk * NumChildren + c];
+					indexLists[c].insert( indexLists[c].end(), chunkIndexList.begin(), chunkIndexList.end() );
+					valueLists[c].insert( valueLists[c].end(), chunkValueList.begin(), chunkValueList.end() );
+				}
+			}
+
+			// Summing per chunk and adding the chunks up would round differently than the serial
+			// build does, and the subdivision predicate could see that, so each child's stats are
+			// summed in element order instead, one task per child
+			if constexpr ( ElementPosition<ElementType>::HasPosition )
+			{
+				for ( size_t c = 0; c < NumChildren; c++ )
+				{
+					pool->Submit( group, [&, c]()
+						{
+							childStats[c] = GatherStats( valueLists[c].data(), valueLists[c].size() );
+						} );
+				}
+				pool->Wait( group );
+			}
+		}
+
+		// `keys` is the sorted run of codes belonging to `node`
+		void SubdivideMorton( Node& node, const morton::KeyIndex* keys )
+		{
+			constexpr uint32_t BitsPerAxis = 63 / Dimensions;
+			if ( node.depth >= MaxDepth || node.depth >= BitsPerAxis || !policy.ShouldSubdivide( node ) )
+			{
+				return;
+			}
+
+			const size_t firstChild = nodes.size();
+			node.firstChild = int32_t( firstChild );
+			nodes.resize( firstChild + NumChildren );
+
+			// Which child a code falls into is given by this level's group of bits, and
+			// the run is sorted, so each child's codes are right after the previous child's
+			const uint32_t shift = uint32_t( Dimensions * (BitsPerAxis - 1 - node.depth) );
+			const size_t count = size_t( node.numElements );
+
+			size_t childBegin[NumChildren + 1]{};
+			for ( size_t c = 0; c < NumChildren; c++ )
+			{
+				childBegin[c + 1] = std::partition_point( keys + childBegin[c], keys + count,
+					[&]( const morton::KeyIndex& key )
+					{
+						return ((key.code >> shift) & (NumChildren - 1)) <= c;
+					} ) - keys;
+
+				Node& child = nodes[firstChild + c];
+				child.volume = policy.GetChildVolume( node.volume, c );
+				child.depth = node.depth + 1;
+				child.numElements = int32_t( childBegin[c + 1] - childBegin[c] );
+				child.elementIndices = node.elementIndices + childBegin[c];
+				child.elementSlice = node.elementSlice + childBegin[c];
+				child.stats = GatherStats( child.elementSlice, size_t( child.numElements ) );
+			}
+
+			for ( size_t c = 0; c < NumChildren; c++ )
+			{
+				Node child = nodes[firstChild + c];
+				SubdivideMorton( child, keys + childBegin[c] );
+				nodes[firstChild + c] = child;
+			}
+
+			node.elementIndices = nullptr;
+			node.elementSlice = nullptr;
+		}
+
+		// Walks down the same way the build partitions elements, the root (or `fromNode`) is always visited
+		template<typename FunctionType>
+		void VisitNodesTouching( const ElementType& element, FunctionType&& function, int32_t fromNode = 0 ) const
+		{
+			if ( nodes.empty() )
+			{
+				return;
+			}
+
+			int32_t stack[MaxDepth * NumChildren + 1];
+			int32_t stackSize = 0;
+			stack[stackSize++] = fromNode;
+
+			while ( stackSize > 0 )
+			{
+				const int32_t nodeIndex = stack[--stackSize];
+				function( nodeIndex );
+
+				const Node& node = nodes[nodeIndex];
+				if ( node.IsLeaf() )
+				{
+					continue;
+				}
+
+				for ( size_t c = 0; c < NumChildren; c++ )
+				{
+					const int32_t childIndex = node.firstChild + int32_t( c );
+					if ( policy.Occupies( element, nodes[childIndex].volume ) )
+					{
+						stack[stackSize++] = childIndex;
+						break;
+					}
+
+					if ( policy.Intersects( element, nodes[childIndex].volume ) )
+					{
+						stack[stackSize++] = childIndex;
+					}
+				}
+			}
+		}
+
+		// See RebuildMorton, the edits below only work on trees that Build made
+		void LeaveMortonLayout()
+		{
+			if ( builtByMorton )
+			{
+				Build( nullptr );
+			}
+		}
+
+		void InsertIntoTree( uint32_t index )
+		{
+			InsertIntoLeaves( index );
+			for ( const int32_t& leafIndex : scratchLeaves )
+			{
+				SplitLeaf( leafIndex );
+			}
+		}
+
+		void RemoveFromTree( uint32_t index )
+		{
+			RemoveFromLeaves( index, elements[index] );
+			for ( const int32_t& leafIndex : scratchLeaves )
+			{
+				TryCollapse( nodes[leafIndex].parent );
+			}
+		}
+
+		// Adds an element to every leaf it touches and leaves them in scratchLeaves,
+		// without splitting any of them. With `fromNode`, only the leaves below that,
+		// and it and the nodes above it have to have the element counted already
+		void InsertIntoLeaves( uint32_t index, int32_t fromNode = -1 )
+		{
+			adm::Vector<int32_t>& touchedLeaves = scratchLeaves;
+			touchedLeaves.clear();
+
+			VisitNodesTouching( elements[index], [&]( int32_t nodeIndex )
+				{
+					if ( nodeIndex == fromNode )
+					{
+						return;
+					}
+
+					Node& node = nodes[nodeIndex];
+					AddToStats( node.stats, elements[index] );
+					if ( !node.IsLeaf() )
+					{
+						node.numElements++;
+						return;
+					}
+
+					if ( uint32_t( node.numElements ) == node.elementCapacity )
+					{
+						MoveRun( nodeIndex, std::max( 4U, node.elementCapacity * 2 ) );
+					}
+
+					Node& leaf = nodes[nodeIndex];
+					leaf.elementIndices[leaf.numElements] = index;
+					leaf.elementSlice[leaf.numElements] = elements[index];
+					leaf.numElements++;
+					touchedLeaves.push_back( nodeIndex );
+				}, std::max( fromNode, 0 ) );
+		}
+
+		// Takes an element out of every leaf it's in and leaves those in scratchLeaves,
+		// without collapsing any of them. `element` is where the tree thinks it is
+		void RemoveFromLeaves( uint32_t index, const ElementType& element )
+		{
+			adm::Vector<int32_t>& touchedLeaves = scratchLeaves;
+			touchedLeaves.clear();
+
+			VisitNodesTouching( element, [&]( int32_t nodeIndex )
+				{
+					Node& node = nodes[nodeIndex];
+					if ( !node.IsLeaf() )
+					{
+						RemoveFromStats( node.stats, element );
+						node.numElements--;
+						return;
+					}
+
+					uint32_t* begin = node.elementIndices;
+					uint32_t* end = begin + node.numElements;
+					uint32_t* found = std::find( begin, end, index );
+					if ( found != end )
+					{
+						RemoveFromStats( node.stats, element );
+						node.numElements--;
+						*found = begin[node.numElements];
+						node.elementSlice[found - begin] = node.elementSlice[node.numElements];
+						touchedLeaves.push_back( nodeIndex );
+					}
+				} );
+		}
+
+		// Swaps an element out of slot `slot` of a leaf it was entirely inside of, and uncounts it
+		// on the way up until a node that has `newElement` entirely inside, which is returned.
+		// That node and the ones above it keep counting it, only their stats change
+		int32_t TakeOutOfLeaf( Node& leaf, int32_t slot, const ElementType& newElement )
+		{
+			const ElementType oldElement = leaf.elementSlice[slot];
+			RemoveFromStats( leaf.stats, oldElement );
+			leaf.numElements--;
+			leaf.elementIndices[slot] = leaf.elementIndices[leaf.numElements];
+			leaf.elementSlice[slot] = leaf.elementSlice[leaf.numElements];
+
+			int32_t nodeIndex = leaf.parent;
+			while ( nodes[nodeIndex].parent >= 0 && !policy.Occupies( newElement, nodes[nodeIndex].volume ) )
+			{
+				RemoveFromStats( nodes[nodeIndex].stats, oldElement );
+				nodes[nodeIndex].numElements--;
+				nodeIndex = nodes[nodeIndex].parent;
+			}
+
+			for ( int32_t ancestor = nodeIndex; ancestor >= 0; ancestor = nodes[ancestor].parent )
+			{
+				RemoveFromStats( nodes[ancestor].stats, oldElement );
+				AddToStats( nodes[ancestor].stats, newElement );
+			}
+
+			return nodeIndex;
+		}
+
+		bool HasDrifted( const Node& node ) const
+		{
+			const int32_t drift = std::abs( node.numElements - node.builtNumElements );
+			return float( drift ) > refitThreshold * float( std::max( node.builtNumElements, RefitMinElements ) );
+		}
+
+		// Throws away everything below a node and builds it again from the elements it has now,
+		// the same way SplitLeaf does, reusing the freed blocks
+		void RebuildSubtree( int32_t nodeIndex )
+		{
+			adm::Vector<uint32_t>& merged = scratchMerged;
+			adm::Vector<int32_t>& stack = scratchStack;
+			adm::Vector<int32_t>& blocks = scratchBlocks;
+			merged.clear();
+			blocks.clear();
+			stack.clear();
+			stack.push_back( nodeIndex );
+
+			while ( !stack.empty() )
+			{
+				const int32_t current = stack.back();
+				stack.pop_back();
+
+				Node& node = nodes[current];
+				if ( node.IsLeaf() )
+				{
+					merged.insert( merged.end(), node.elementIndices, node.elementIndices + node.numElements );
+					RemoveLeaf( current );
+					leafElementsGarbage += node.elementCapacity;
+					node.elementCapacity = 0;
+					continue;
+				}
+
+				blocks.push_back( node.firstChild );
+				for ( size_t c = 0; c < NumChildren; c++ )
+				{
+					stack.push_back( node.firstChild + int32_t( c ) );
+				}
+			}
+
+			for ( const int32_t& firstChild : blocks )
+			{
+				for ( size_t c = 0; c < NumChildren; c++ )
+				{
+					nodes[firstChild + c] = Node();
+					nodes[firstChild + c].firstChild = Unused;
+				}
+				freeBlocks.push_back( firstChild );
+			}
+
+			// Elements on child boundaries are in more than one leaf
+			std::sort( merged.begin(), merged.end() );
+			merged.erase( std::unique( merged.begin(), merged.end() ), merged.end() );
+
+			adm::Vector<ElementType>& mergedValues = scratchMergedValues;
+			mergedValues.clear();
+			for ( const uint32_t& index : merged )
+			{
+				mergedValues.push_back( elements[index] );
+			}
+
+			Node& node = nodes[nodeIndex];
+			node.firstChild = NoChildren;
+			node.stats = GatherStats( mergedValues.data(), mergedValues.size() );
+			SetLeafElements( nodeIndex, merged, mergedValues );
+			nodes[nodeIndex].builtNumElements = nodes[nodeIndex].numElements;
+			AddLeaf( nodeIndex );
+
+			SplitLeaf( nodeIndex );
+		}
+
+		// Turns a leaf into an internal node if the predicate wants it, and keeps going into its children
+		void SplitLeaf( int32_t nodeIndex )
+		{
+			if ( nodes[nodeIndex].depth >= MaxDepth || !policy.ShouldSubdivide( nodes[nodeIndex] ) )
+			{
+				return;
+			}
+
+			const int32_t firstChild = AllocateBlock();
+			Node& node = nodes[nodeIndex];
+
+			VolumeType childVolumes[NumChildren];
+			for ( size_t c = 0; c < NumChildren; c++ )
+			{
+				childVolumes[c] = policy.GetChildVolume( node.volume, c );
+			}
+
+			ScratchVector<uint32_t> indexLists[NumChildren];
+			ScratchVector<ElementType> valueLists[NumChildren];
+			NodeStats childStats[NumChildren];
+			PartitionRange( node.elementIndices, node.elementSlice, size_t( node.numElements ), childVolumes, indexLists, valueLists, childStats );
+
+			RemoveLeaf( nodeIndex );
+			leafElementsGarbage += node.elementCapacity;
+			node.elementCapacity = 0;
+			node.elementIndices = nullptr;
+			node.elementSlice = nullptr;
+			node.firstChild = firstChild;
+
+			for ( size_t c = 0; c < NumChildren; c++ )
+			{
+				Node child;
+				child.volume = childVolumes[c];
+				child.parent = nodeIndex;
+				child.depth = node.depth + 1;
+				child.stats = childStats[c];
+				nodes[firstChild + c] = child;
+
+				SetLeafElements( firstChild + int32_t( c ), indexLists[c], valueLists[c] );
+				nodes[firstChild + c].builtNumElements = nodes[firstChild + c].numElements;
+				AddLeaf( firstChild + int32_t( c ) );
+			}
+
+			for ( size_t c = 0; c < NumChildren; c++ )
+			{
+				SplitLeaf( firstChild + int32_t( c ) );
+			}
+		}
+
+		// If all children are leaves and the predicate wouldn't subdivide their union, fold
+		// them back into this node, then see if the same can be done one level up
+		void TryCollapse( int32_t nodeIndex )
+		{
+			if ( nodeIndex < 0 || nodes[nodeIndex].IsLeaf() || nodes[nodeIndex].IsUnused() )
+			{
+				return;
+			}
+
+			const int32_t firstChild = nodes[nodeIndex].firstChild;
+			adm::Vector<uint32_t>& merged = scratchMerged;
+			merged.clear();
+
+			for ( size_t c = 0; c < NumChildren; c++ )
+			{
+				const Node& child = nodes[firstChild + c];
+				if ( !child.IsLeaf() )
+				{
+					return;
+				}
+
+				merged.insert( merged.end(), child.elementIndices, child.elementIndices + child.numElements );
+			}
+
+			// Elements on child boundaries are in more than one child
+			std::sort( merged.begin(), merged.end() );
+			merged.erase( std::unique( merged.begin(), merged.end() ), merged.end() );
+
+			adm::Vector<ElementType>& mergedValues = scratchMergedValues;
+			mergedValues.clear();
+			for ( const uint32_t& index : merged )
+			{
+				mergedValues.push_back( elements[index] );
+			}
+
+			Node probe = nodes[nodeIndex];
+			probe.firstChild = NoChildren;
+			probe.numElements = int32_t( merged.size() );
+			probe.elementIndices = merged.data();
+			probe.elementSlice = mergedValues.data();
+			probe.stats = GatherStats( mergedValues.data(), mergedValues.size() );
+			if ( policy.ShouldSubdivide( probe ) )
+			{
+				return;
+			}
+
+			for ( size_t c = 0; c < NumChildren; c++ )
+			{
+				Node& child = nodes[firstChild + c];
+				RemoveLeaf( firstChild + int32_t( c ) );
+				leafElementsGarbage += child.elementCapacity;
+				child = Node();
+				child.firstChild = Unused;
+			}
+			freeBlocks.push_back( firstChild );
+
+			nodes[nodeIndex].firstChild = NoChildren;
+			nodes[nodeIndex].stats = probe.stats;
+			SetLeafElements( nodeIndex, merged, mergedValues );
+			nodes[nodeIndex].builtNumElements = nodes[nodeIndex].numElements;
+			AddLeaf( nodeIndex );
+
+			TryCollapse( nodes[nodeIndex].parent );
+		}
+
+		void AddToStats( NodeStats& stats, const ElementType& element ) const
+		{
+			if constexpr ( ElementPosition<ElementType>::HasPosition )
+			{
+				stats.Add( ElementPosition<ElementType>::Get( element ), trackSecondMoments );
+			}
+		}
+
+		void RemoveFromStats( NodeStats& stats, const ElementType& element ) const
+		{
+			if constexpr ( ElementPosition<ElementType>::HasPosition )
+			{
+				stats.Remove( ElementPosition<ElementType>::Get( element ), trackSecondMoments );
+			}
+		}
+
+		NodeStats GatherStats( const ElementType* values, size_t count ) const
+		{
+			NodeStats stats;
+			for ( size_t i = 0; i < count; i++ )
+			{
+				AddToStats( stats, values[i] );
+			}
+
+			return stats;
+		}
+
+		int32_t AllocateBlock()
+		{
+			if ( !freeBlocks.empty() )
+			{
+				const int32_t firstChild = freeBlocks.back();
+				freeBlocks.pop_back();
+				return firstChild;
+			}
+
+			const Node* oldData = nodes.data();
+			const int32_t firstChild = int32_t( nodes.size() );
+			nodes.resize( nodes.size() + NumChildren );
+
+			// Leaf pointers went stale, happens rarely enough since the array grows geometrically
+			if ( nodes.data() != oldData )
+			{
+				for ( Node& node : nodes )
+				{
+					if ( node.leafSlot >= 0 )
+					{
+						leaves[node.leafSlot] = &node;
+					}
+				}
+			}
+
+			return firstChild;
+		}
+
+		void AddLeaf( int32_t nodeIndex )
+		{
+			nodes[nodeIndex].leafSlot = int32_t( leaves.size() );
+			leaves.push_back( &nodes[nodeIndex] );
+		}
+
+		void RemoveLeaf( int32_t nodeIndex )
+		{
+			Node& node = nodes[nodeIndex];
+			Node* last = leaves.back();
+			leaves[node.leafSlot] = last;
+			last->leafSlot = node.leafSlot;
+			leaves.pop_back();
+			node.leafSlot = -1;
+		}
+
+		// Gives a leaf its own copy of `indices` and `values`, with a bit of room to grow
+		template<typename IndexVector, typename ValueVector>
+		void SetLeafElements( int32_t nodeIndex, const IndexVector& indices, const ValueVector& values )
+		{
+			Node& node = nodes[nodeIndex];
+			leafElementsGarbage += node.elementCapacity;
+			node.elementCapacity = 0;
+			node.numElements = 0;
+
+			MoveRun( nodeIndex, std::max( 4U, uint32_t( indices.size() * 2 ) ) );
+			std::copy( indices.begin(), indices.end(), nodes[nodeIndex].elementIndices );
+			std::copy( values.begin(), values.end(), nodes[nodeIndex].elementSlice );
+			nodes[nodeIndex].numElements = int32_t( indices.size() );
+		}
+
+		// Moves a leaf's run to the end of the leaf arrays with a new capacity
+		// The old spot is wasted until there's enough waste to be worth compacting
+		void MoveRun( int32_t nodeIndex, uint32_t newCapacity )
+		{
+			if ( leafElementsGarbage > leafElements.size() / 2 && leafElements.size() > 4096 )
+			{
+				CompactLeafElements();
+			}
+
+			const uint32_t* oldIndices = leafElements.data();
+			const ElementType* oldValues = leafElementData.data();
+			const size_t offset = leafElements.size();
+			leafElements.resize( offset + newCapacity );
+			leafElementData.resize( offset + newCapacity );
+			if ( leafElements.data() != oldIndices || leafElementData.data() != oldValues )
+			{
+				// Both arrays have the same layout, so the index run's offset works for both
+				for ( Node* leaf : leaves )
+				{
+					const ptrdiff_t leafOffset = leaf->elementIndices - oldIndices;
+					leaf->elementIndices = leafElements.data() + leafOffset;
+					leaf->elementSlice = leafElementData.data() + leafOffset;
+				}
+			}
+
+			Node& node = nodes[nodeIndex];
+			uint32_t* newIndices = leafElements.data() + offset;
+			ElementType* newValues = leafElementData.data() + offset;
+			std::copy( node.elementIndices, node.elementIndices + node.numElements, newIndices );
+			std::copy( node.elementSlice, node.elementSlice + node.numElements, newValues );
+
+			leafElementsGarbage += node.elementCapacity;
+			node.elementIndices = newIndices;
+			node.elementSlice = newValues;
+			node.elementCapacity = newCapacity;
+		}
+
+		void CompactLeafElements()
+		{
+			adm::Vector<uint32_t> compactedIndices;
+			adm::Vector<ElementType> compactedValues;
+			compactedIndices.reserve( leafElements.size() - leafElementsGarbage );
+			compactedValues.reserve( leafElements.size() - leafElementsGarbage );
+
+			adm::Vector<size_t> offsets( leaves.size() );
+			for ( size_t i = 0; i < leaves.size(); i++ )
+			{
+				const Node& leaf = *leaves[i];
+				offsets[i] = compactedIndices.size();
+				compactedIndices.insert( compactedIndices.end(), leaf.elementIndices, leaf.elementIndices + leaf.elementCapacity );
+				compactedValues.insert( compactedValues.end(), leaf.elementSlice, leaf.elementSlice + leaf.elementCapacity );
+			}
+
+			leafElements = std::move( compactedIndices );
+			leafElementData = std::move( compactedValues );
+			for ( size_t i = 0; i < leaves.size(); i++ )
+			{
+				leaves[i]->elementIndices = leafElements.data() + offsets[i];
+				leaves[i]->elementSlice = leafElementData.data() + offsets[i];
+			}
+
+			leafElementsGarbage = 0;
+		}
+
+		VolumeType volume{};
+		PolicyType policy;
+		bool trackSecondMoments{};
+
+		// Behind a pointer so the tree stays movable
+		std::unique_ptr<Arena> buildArena{ std::make_unique<Arena>() };
+		std::pmr::memory_resource* buildResource{};
+
+		adm::Vector<ElementType> elements;
+		// Slots of removed elements, handed out again by Insert
+		adm::Vector<uint32_t> freeElements;
+		adm::Vector<Node> nodes;
+		adm::Vector<Node*> leaves;
+		// Every leaf's element indices, in node order after a build,
+		// though incremental updates move runs around and leave gaps
+		adm::Vector<uint32_t> leafElements;
+		// Copies of the elements above, that's where the leaves' element slices are
+		adm::Vector<ElementType> leafElementData;
+		size_t leafElementsGarbage{};
+		// First nodes of collapsed child blocks
+		adm::Vector<int32_t> freeBlocks;
+
+		adm::Vector<int32_t> scratchLeaves;
+		adm::Vector<uint32_t> scratchMerged;
+		adm::Vector<ElementType> scratchMergedValues;
+
+		BuildTimings buildTimings;
+		// Every element's in the one leaf its Morton code picked, rather than every leaf it touches
+		bool builtByMorton{};
+
+		float refitThreshold{ 0.5f };
+		// Refit marks elements with the number of the refit that saw them,
+		// so the marks never have to be cleared
+		adm::Vector<uint32_t> refitMarks;
+		uint32_t refitEpoch{};
+		adm::Vector<Migrant> scratchMigrants;
+		adm::Vector<int32_t> scratchDirtyLeaves;
+		adm::Vector<int32_t> scratchSubtrees;
+		adm::Vector<int32_t> scratchStack;
+		adm::Vector<int32_t> scratchBlocks;
+	};
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <Precompiled.hpp>
+#include <cstdint>
+#include <ostream>
+
+namespace spatial
+{
+	// How long the last build of a spatial::Tree spent on each step, in milliseconds
+	struct BuildTimings
+	{
+		// Collecting the live elements, and their Morton codes for RebuildMorton
+		float gather{};
+		// Radix sort, RebuildMorton only
+		float sort{};
+		float subdivide{};
+		// Laying the leaves' elements out in the shared arrays, parent links and the leaf list
+		float finish{};
+		float total{};
+	};
+
+	// What a tree looks like and what it costs, see Tree::GetStats
+	// For tuning subdivision predicates against real data instead of guessing constants
+	struct TreeStats
+	{
+		// Bucket 0 counts empty leaves, bucket i counts leaves with 2^(i-1) to 2^i - 1 elements,
+		// and the last one counts everything bigger than that too
+		static constexpr size_t NumOccupancyBuckets = 16;
+
+		size_t numNodes{};
+		size_t numLeaves{};
+		size_t numEmptyLeaves{};
+		uint32_t maxDepth{};
+		// Both indexed by depth, leaves are counted in nodesPerDepth too
+		adm::Vector<uint32_t> nodesPerDepth;
+		adm::Vector<uint32_t> leavesPerDepth;
+		uint32_t occupancy[NumOccupancyBuckets]{};
+		// Elements on child boundaries are in more than one leaf, and get counted for each
+		size_t numLeafElements{};
+		size_t maxLeafElements{};
+
+		// Nodes and the leaf list
+		size_t nodeBytes{};
+		// The elements, plus the leaves' index and element arrays
+		size_t elementBytes{};
+		// Reserved by the build arena, whether or not the last build used all of it
+		size_t arenaBytes{};
+
+		BuildTimings timings;
+
+		static size_t GetOccupancyBucket( size_t numElements )
+		{
+			size_t bucket = 0;
+			while ( numElements > 0 && bucket < NumOccupancyBuckets - 1 )
+			{
+				numElements >>= 1;
+				bucket++;
+			}
+
+			return bucket;
+		}
+
+		float GetEmptyLeafRatio() const
+		{
+			return numLeaves > 0 ? float( numEmptyLeaves ) / float( numLeaves ) : 0.0f;
+		}
+
+		float GetAverageLeafElements() const
+		{
+			return numLeaves > 0 ? float( numLeafElements ) / float( numLeaves ) : 0.0f;
+		}
+
+		void WriteJson( std::ostream& out ) const
+		{
+			const auto writeArray = [&]( const uint32_t* values, size_t count )
+			{
+				out << "[";
+				for ( size_t i = 0; i < count; i++ )
+				{
+					out << (i > 0 ? ", " : "") << values[i];
+				}
+				out << "]";
+			};
+
+			out << "{\n  \"nodes\": " << numNodes << ",\n  \"leaves\": " << numLeaves
+				<< ",\n  \"empty_leaves\": " << numEmptyLeaves << ",\n  \"empty_leaf_ratio\": " << GetEmptyLeafRatio()
+				<< ",\n  \"max_depth\": " << maxDepth << ",\n  \"leaf_elements\": " << numLeafElements
+				<< ",\n  \"max_leaf_elements\": " << maxLeafElements << ",\n  \"nodes_per_depth\": ";
+			writeArray( nodesPerDepth.data(), nodesPerDepth.size() );
+			out << ",\n  \"leaves_per_depth\": ";
+			writeArray( leavesPerDepth.data(), leavesPerDepth.size() );
+			out << ",\n  \"occupancy_log2\": ";
+			writeArray( occupancy, NumOccupancyBuckets );
+			out << ",\n  \"node_bytes\": " << nodeBytes << ",\n  \"element_bytes\": " << elementBytes
+				<< ",\n  \"arena_bytes\": " << arenaBytes
+				<< ",\n  \"build_ms\": { \"gather\": " << timings.gather << ", \"sort\": " << timings.sort
+				<< ", \"subdivide\": " << timings.subdivide << ", \"finish\": " << timings.finish
+				<< ", \"total\": " << timings.total << " }\n}\n";
+		}
+	};
+}